@@ -0,0 +1,368 @@
+// 서버 핵심 함수 마이크로벤치마크 (make bench)
+// server.c를 그대로 포함해 같은 코드와 같은 컴파일 옵션으로 측정
+#define CHAT_BENCH
+#include "server.c"
+
+#define BENCH_REPEAT 7      // 같은 측정을 반복하는 횟수 (최소/중앙값/최대 출력)
+#define BENCH_BATCH 32      // 수신 측 소켓 버퍼를 비우기 전까지 보내는 브로드캐스트 수
+#define BENCH_KEYS 65536    // 미리 만들어 두는 조회 키 수 (2의 거듭제곱)
+#define BENCH_SEED 12345    // 입력 생성용 고정 시드 (실행마다 같은 입력)
+
+// 측정 대상: iters번 실행하고 측정한 시간(ns)을 반환
+typedef uint64_t (*BenchFn)(void *arg, long iters);
+
+// 브로드캐스트 측정용 채팅방 (socketpair로 연결된 가상 사용자)
+typedef struct
+{
+    ChatRoom room;
+    int peer_fds[MAX_ROOM_USERS]; // 수신 측 소켓 (측정 사이에 비움)
+} BenchRoom;
+
+// 클라이언트 조회 측정용 입력
+typedef struct
+{
+    int *keys; // 조회할 fd 목록 (BENCH_KEYS개)
+} BenchLookup;
+
+// 명령 파싱 측정용 입력
+typedef struct
+{
+    const char *line; // 수신한 한 줄 (개행 포함)
+    int as_id;        // 1이면 parse_valid_id, 0이면 parse_valid_int
+} BenchParse;
+
+volatile long bench_sink; // 결과를 버리지 않도록 모아 두는 값
+uint32_t bench_rand_state = BENCH_SEED;
+int bench_repeat = BENCH_REPEAT;
+
+// iters번 실행을 bench_repeat번 재서 한 줄로 출력
+void bench_run(const char *name, const char *param, BenchFn fn, void *arg, long iters);
+
+// 고정 시드 난수 (xorshift32)
+uint32_t bench_rand();
+
+// 가상 사용자 count명이 들어 있는 채팅방 준비
+void bench_room_init(BenchRoom *br, int count);
+
+// 가상 사용자 소켓 정리
+void bench_room_free(BenchRoom *br);
+
+// 측정 대상 함수들
+uint64_t bench_broadcast(void *arg, long iters);
+uint64_t bench_find_client(void *arg, long iters);
+uint64_t bench_get_user(void *arg, long iters);
+uint64_t bench_parse(void *arg, long iters);
+uint64_t bench_tally_poll(void *arg, long iters);
+uint64_t bench_evaluate_guess(void *arg, long iters);
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            bench_repeat = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, " Usage : %s [-r repeat]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (bench_repeat < 1)
+        bench_repeat = 1;
+
+    // 서버와 같은 전역 상태를 준비 (로그는 쌓이지 않도록 끔)
+    signal(SIGPIPE, SIG_IGN);
+    log_level = LOG_ERROR;
+    init_connections();
+    me_prefix = payload_new("[ME] ", strlen("[ME] "));
+
+    printf("# chat_server microbenchmark, repeat=%d, seed=%d, cc=%s\n", bench_repeat, BENCH_SEED, __VERSION__);
+    printf("name\tparam\titers\tns_per_op_min\tns_per_op_median\tns_per_op_max\n");
+
+    // 채팅방 브로드캐스트 (사용자 수별)
+    int room_sizes[] = {2, 5, MAX_ROOM_USERS};
+    for (int k = 0; k < 3; k++)
+    {
+        BenchRoom br;
+        char param[SMALL_BUFF_SIZE];
+        bench_room_init(&br, room_sizes[k]);
+        snprintf(param, sizeof(param), "users=%d", room_sizes[k]);
+        bench_run("broadcast_to_room", param, bench_broadcast, &br, 20000);
+        bench_room_free(&br);
+    }
+
+    // fd -> 클라이언트 슬롯 조회 (등록된 클라이언트 수별, 무작위 순서)
+    int table_sizes[] = {1024, 16384, 65536};
+    BenchLookup lookup;
+    lookup.keys = malloc(sizeof(int) * BENCH_KEYS);
+    if (lookup.keys == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < 3; k++)
+    {
+        // 실제 소켓 없이 fd 번호만 등록 (리스닝 소켓 등이 쓰는 낮은 번호는 피함)
+        int count = table_sizes[k] < max_clients - 64 ? table_sizes[k] : max_clients - 64;
+        while (client_count < count)
+            alloc_client(64 + client_count);
+        for (int j = 0; j < BENCH_KEYS; j++)
+            lookup.keys[j] = 64 + bench_rand() % count;
+
+        char param[SMALL_BUFF_SIZE];
+        snprintf(param, sizeof(param), "clients=%d", count);
+        bench_run("find_client_index", param, bench_find_client, &lookup, 1000000);
+    }
+
+    // 채팅방 안의 사용자 위치 조회 (사용자 수별)
+    for (int k = 0; k < 3; k++)
+    {
+        BenchRoom br;
+        memset(&br, 0, sizeof(br));
+        br.room.user_count = room_sizes[k];
+        for (int j = 0; j < room_sizes[k]; j++)
+            br.room.user_fds[j] = 100 + j;
+
+        char param[SMALL_BUFF_SIZE];
+        snprintf(param, sizeof(param), "users=%d", room_sizes[k]);
+        bench_run("get_user_index", param, bench_get_user, &br.room, 1000000);
+    }
+
+    // 로비 명령 파싱 (strcspn + trim + 숫자 변환)
+    BenchParse parses[] = {
+        {"2\r\n", 0},
+        {"   17  \r\n", 0},
+        {"hello world\n", 0},
+        {"18446744073709551615\n", 1},
+    };
+    const char *parse_names[] = {"menu", "padded", "invalid", "room_id_max"};
+    for (int k = 0; k < 4; k++)
+        bench_run("parse_command", parse_names[k], bench_parse, &parses[k], 1000000);
+
+    // 투표 집계 (모든 사용자가 투표한 뒤 결과 문자열 작성)
+    for (int k = 0; k < 3; k++)
+    {
+        ChatRoom room;
+        memset(&room, 0, sizeof(room));
+        room.user_count = room_sizes[k];
+        room.poll_count = 5;
+        for (int j = 0; j < room.poll_count; j++)
+        {
+            char option[SMALL_BUFF_SIZE];
+            snprintf(option, sizeof(option), "%d. option %d", j + 1, j + 1);
+            room.poll_list[j] = poll_arena_strdup(&room, option);
+        }
+        for (int j = 0; j < room.user_count; j++)
+        {
+            room.vote_received[j] = bench_rand() % room.poll_count;
+            room.poll_votes[room.vote_received[j]]++;
+        }
+
+        char param[SMALL_BUFF_SIZE];
+        snprintf(param, sizeof(param), "users=%d", room_sizes[k]);
+        bench_run("tally_poll", param, bench_tally_poll, &room, 200000);
+    }
+
+    // 숫자 야구 판정
+    bench_run("evaluate_guess", "-", bench_evaluate_guess, NULL, 1000000);
+
+    free(lookup.keys);
+    return EXIT_SUCCESS;
+}
+
+void bench_run(const char *name, const char *param, BenchFn fn, void *arg, long iters)
+{
+    uint64_t samples[bench_repeat];
+
+    // 캐시와 분기 예측을 데운 뒤 측정
+    fn(arg, iters / 10 + 1);
+    for (int r = 0; r < bench_repeat; r++)
+        samples[r] = fn(arg, iters);
+
+    qsort(samples, bench_repeat, sizeof(uint64_t), cmp_u64);
+    printf("%s\t%s\t%ld\t%.2f\t%.2f\t%.2f\n", name, param, iters,
+           (double)samples[0] / iters,
+           (double)samples[bench_repeat / 2] / iters,
+           (double)samples[bench_repeat - 1] / iters);
+    fflush(stdout);
+}
+
+uint32_t bench_rand()
+{
+    uint32_t x = bench_rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    bench_rand_state = x;
+    return x;
+}
+
+void bench_room_init(BenchRoom *br, int count)
+{
+    memset(br, 0, sizeof(*br));
+    pthread_mutex_init(&br->room.lock, NULL);
+    br->room.user_count = count;
+
+    for (int j = 0; j < count; j++)
+    {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 || sv[0] >= max_conns)
+        {
+            perror("socketpair");
+            exit(EXIT_FAILURE);
+        }
+        set_nonblocking(sv[1]);
+        conn_open(sv[0]);
+        br->room.user_fds[j] = sv[0];
+        br->peer_fds[j] = sv[1];
+    }
+}
+
+void bench_room_free(BenchRoom *br)
+{
+    for (int j = 0; j < br->room.user_count; j++)
+    {
+        conn_reset(br->room.user_fds[j]);
+        close(br->room.user_fds[j]);
+        close(br->peer_fds[j]);
+    }
+    pthread_mutex_destroy(&br->room.lock);
+}
+
+uint64_t bench_broadcast(void *arg, long iters)
+{
+    BenchRoom *br = arg;
+    const char *msg = "[NOTICE] benchmark님이 채팅방에서 나갔습니다.\n";
+    char drain[LARGE_BUFF_SIZE * 16];
+    uint64_t total = 0;
+
+    // 송신 큐에 쌓이지 않도록 몇 번 보낼 때마다 수신 측을 비움 (비우는 시간은 제외)
+    for (long done = 0; done < iters;)
+    {
+        long batch = iters - done < BENCH_BATCH ? iters - done : BENCH_BATCH;
+        uint64_t start = now_ns();
+        for (long n = 0; n < batch; n++)
+            broadcast_to_room(&br->room, msg, -1);
+        total += now_ns() - start;
+        done += batch;
+
+        for (int j = 0; j < br->room.user_count; j++)
+        {
+            while (read(br->peer_fds[j], drain, sizeof(drain)) > 0)
+                ;
+        }
+    }
+    return total;
+}
+
+uint64_t bench_find_client(void *arg, long iters)
+{
+    BenchLookup *lookup = arg;
+    long sum = 0;
+
+    uint64_t start = now_ns();
+    for (long n = 0; n < iters; n++)
+        sum += find_client_index(lookup->keys[n & (BENCH_KEYS - 1)]);
+    uint64_t elapsed = now_ns() - start;
+
+    bench_sink = sum;
+    return elapsed;
+}
+
+uint64_t bench_get_user(void *arg, long iters)
+{
+    ChatRoom *room = arg;
+    long sum = 0;
+
+    // 모든 사용자와 없는 fd 하나를 돌아가며 조회
+    uint64_t start = now_ns();
+    for (long n = 0; n < iters; n++)
+        sum += get_user_index(room, 100 + (int)(n % (room->user_count + 1)));
+    uint64_t elapsed = now_ns() - start;
+
+    bench_sink = sum;
+    return elapsed;
+}
+
+uint64_t bench_parse(void *arg, long iters)
+{
+    BenchParse *bp = arg;
+    char buffer[MEDIUM_BUFF_SIZE];
+    size_t len = strlen(bp->line) + 1;
+    long sum = 0;
+
+    // 로비에서 한 줄을 받아 처리하는 순서를 그대로 따름 (버퍼 복사 포함)
+    uint64_t start = now_ns();
+    for (long n = 0; n < iters; n++)
+    {
+        memcpy(buffer, bp->line, len);
+        buffer[strcspn(buffer, "\r\n")] = 0;
+        char *input = trim(buffer);
+
+        if (bp->as_id)
+        {
+            uint64_t id;
+            if (parse_valid_id(input, &id))
+                sum += (long)id;
+        }
+        else
+        {
+            int value;
+            if (parse_valid_int(input, &value))
+                sum += value;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    bench_sink = sum;
+    return elapsed;
+}
+
+uint64_t bench_tally_poll(void *arg, long iters)
+{
+    ChatRoom *room = arg;
+    char list[LARGE_BUFF_SIZE];
+    long sum = 0;
+
+    uint64_t start = now_ns();
+    for (long n = 0; n < iters; n++)
+        sum += tally_poll(room, list, sizeof(list));
+    uint64_t elapsed = now_ns() - start;
+
+    bench_sink = sum + list[0];
+    return elapsed;
+}
+
+uint64_t bench_evaluate_guess(void *arg, long iters)
+{
+    // 중복 없는 세 자리 숫자를 고정 시드로 미리 만들어 둠
+    static char numbers[256][4];
+    static int ready = 0;
+    if (!ready)
+    {
+        for (int k = 0; k < 256; k++)
+        {
+            do
+            {
+                snprintf(numbers[k], sizeof(numbers[k]), "%03u", bench_rand() % 1000);
+            } while (!is_valid_number(numbers[k]));
+        }
+        ready = 1;
+    }
+
+    long sum = 0;
+    uint64_t start = now_ns();
+    for (long n = 0; n < iters; n++)
+    {
+        int s, b;
+        evaluate_guess(numbers[n & 255], numbers[(n >> 8) & 255], &s, &b);
+        sum += s * 4 + b;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    bench_sink = sum;
+    return elapsed;
+}
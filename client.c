@@ -5,39 +5,242 @@
 #include <signal.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
-#include <pthread.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <ctype.h>
+
+#include "protocol.h"
 
-#define BUF_SIZE 128
 #define NORMAL_SIZE 64
 
-void *send_msg(void *arg);
-void *recv_msg(void *arg);
-void cleanup(int signo);
+// 연결 코어 관련 상수
+#define CONN_BUF_SIZE 8192   // 연결별 수신 버퍼 크기 (이보다 긴 줄은 버리고, 들어가지 않는 바이너리 메시지는 연결 실패로 처리)
+#define INPUT_BUF_SIZE 4096  // 표준 입력 한 줄의 최대 길이 (더 길면 잘라서 보냄)
+#define OUTPUT_BUF_SIZE 65536 // 화면 출력 버퍼 크기 (수신한 만큼 모아서 한 번에 출력)
+
+// 부하 생성 모드 관련 상수
+#define BOT_SEND_LIMIT 8192  // 봇별로 쌓아 둘 미전송 데이터 상한 (넘으면 메시지를 버리고 전송 실패로 집계)
+#define BOT_TICK_MS 5        // 전송 일정을 확인하는 주기
+#define BOT_JOIN_TIMEOUT 10  // 모든 봇이 입장하기를 기다리는 최대 시간 (초)
+#define BOT_DRAIN_SEC 1      // 전송 종료 후 남은 메시지를 받는 시간 (초)
+#define BOT_CONNECT_WINDOW 8 // 첫 응답을 기다리는 접속 수 상한 (서버 listen 백로그를 넘지 않도록)
+#define MAX_EVENTS 256
+
+typedef struct ChatConn ChatConn;
+
+// 서버가 보낸 메시지 하나를 처리하는 콜백 (텍스트 모드는 개행을 뺀 NUL 종료 줄, 바이너리 모드는 길이 접두사를 뺀 본문)
+typedef void (*ChatFrameFn)(ChatConn *conn, char *frame, size_t len);
+
+// 서버 연결 하나 (논블로킹 소켓, 스레드 없이 호출자의 이벤트 루프에서 구동)
+struct ChatConn
+{
+    int fd;
+    int binary;                 // 바이너리 모드 연결
+    char in_buf[CONN_BUF_SIZE]; // 메시지 단위로 자르기 전 수신 데이터
+    size_t in_len;
+    int in_skip;                // 버퍼보다 긴 줄을 버리는 중
+    char *out_buf;              // 소켓 버퍼가 가득 차 아직 보내지 못한 데이터
+    size_t out_len;
+    size_t out_cap;
+    size_t out_limit;           // 미전송 데이터 상한 (0이면 제한 없음)
+    uint64_t bytes_in;          // 지금까지 받은 바이트 수
+    ChatFrameFn on_frame;
+    void *ctx;                  // 호출자 데이터
+};
+
+// 봇 상태 정의 (로비 프로토콜을 따라 진행)
+typedef enum
+{
+    BOT_CONNECTING, // 접속 완료 대기
+    BOT_CREATING,   // 그룹 대표가 채팅방 개설 응답 대기
+    BOT_WAITING,    // 그룹 대표의 채팅방 번호 대기
+    BOT_JOINING,    // 입장 응답 대기
+    BOT_JOINED,     // 채팅 중
+    BOT_FAILED
+} BotState;
+
+// 부하 생성 설정 및 결과
+typedef struct
+{
+    int conns;          // 동시 접속 수 (-n)
+    double rate;        // 접속당 초당 메시지 수 (-r)
+    int duration;       // 측정 시간 (-d, 초)
+    int group;          // 채팅방 하나에 넣을 봇 수 (-g)
+    int size;           // 메시지 길이 (-s, 바이트)
+    int binary;         // 바이너리 모드로 접속 (-B)
+
+    uint64_t sent;      // 보낸 메시지 수
+    uint64_t send_drop; // 미전송 데이터가 상한을 넘어 보내지 못한 메시지 수
+    uint64_t received;  // 다른 봇에게서 받은 메시지 수
+    uint64_t bytes_in;  // 측정 중 받은 바이트 수
+    int measuring;      // 측정 시작 이후 (전송 종료 후 남은 메시지를 받는 동안 포함)
+    int handshaking;    // 접속 후 첫 응답을 기다리는 봇 수
+    uint32_t *lat_us;   // 수신 지연 시간 표본 (마이크로초)
+    size_t lat_count;
+    size_t lat_cap;
+} BotRun;
+
+// 부하 생성용 가상 사용자
+typedef struct
+{
+    ChatConn conn;          // 서버 연결 (접속 전에는 conn.fd = -1)
+    int index;
+    BotState state;
+    long room_id;           // 입장할 채팅방 번호 (-1: 아직 모름)
+    int greeted;            // 서버의 첫 응답을 받음
+    long user_id;           // 바이너리 모드: 서버가 알려준 사용자 번호 (본인 메시지 구분용)
+    BotRun *run;
+} Bot;
+
+// 연결 초기화 (fd는 논블로킹 소켓, out_limit = 0이면 미전송 데이터를 제한 없이 쌓음)
+void chat_conn_init(ChatConn *conn, int fd, int binary, size_t out_limit, ChatFrameFn on_frame, void *ctx);
+
+// 읽을 수 있는 데이터를 모두 읽고 완성된 메시지마다 on_frame 호출 (연결이 끊기면 0 반환)
+int chat_conn_read(ChatConn *conn);
+
+// 데이터 전송 (보내지 못한 부분은 쌓아 두고, 상한을 넘어 버렸거나 연결 오류면 0 반환)
+int chat_conn_send(ChatConn *conn, const char *data, size_t len);
+
+// 텍스트 모드: 한 줄 전송 (개행을 붙여 보냄)
+int chat_conn_line(ChatConn *conn, const char *line, size_t len);
+
+// 바이너리 모드: 요청 하나를 만들어 전송 (id < 0이면 정수 필드, str이 NULL이면 문자열 필드 생략)
+int chat_conn_request(ChatConn *conn, int op, int64_t id, const char *str, size_t len);
+
+// 접속 인사 전송 (텍스트 모드는 이름 한 줄, 바이너리 모드는 매직과 REQ_HELLO, 이어서 하트비트 시작 요청)
+int chat_conn_hello(ChatConn *conn, const char *user_name);
+
+// 하트비트 응답 전송 (번호 0은 서버에 하트비트 시작 요청)
+int chat_conn_pong(ChatConn *conn, uint32_t nonce);
+
+// 서버의 PING이면 바로 응답하고 1 반환 (on_frame으로 넘기지 않음)
+int chat_conn_ping(ChatConn *conn, const char *frame, size_t len);
+
+// 쌓아 둔 데이터를 소켓이 받는 만큼 전송 (연결 오류면 0 반환)
+int chat_conn_flush(ChatConn *conn);
+
+// 보내지 못한 데이터가 남아 있는지 (1이면 소켓이 쓰기 가능해질 때 chat_conn_flush 필요)
+int chat_conn_pending(const ChatConn *conn);
+
+// 연결 종료 및 버퍼 해제
+void chat_conn_close(ChatConn *conn);
+
+// 대화형 모드 실행 (표준 입력과 서버 소켓을 poll 하나로 처리, Ctrl+C나 연결 종료 시 반환)
+void run_chat(int sock, const char *user_name);
+
+// 대화형 모드: 서버가 보낸 한 줄을 출력 버퍼에 씀
+void print_frame(ChatConn *conn, char *frame, size_t len);
+
+// 대화형 모드: 표준 입력에서 읽은 데이터를 줄 단위로 서버에 전송 (빈 줄은 건너뜀, 입력이 끝나면 0 반환)
+int read_input(ChatConn *conn, char *input, size_t *input_len);
+
+void sigint_handler(int signo);
+void cleanup();
 void menu();
 
+// 부하 생성 모드 실행
+int run_bots(const char *ip, const char *port, BotRun *run);
+
+// 봇 하나의 논블로킹 접속 시작
+void bot_connect(int epfd, Bot *bot, struct sockaddr_in *serv_addr, BotRun *run);
+
+// 봇 연결에서 읽을 수 있는 데이터를 모두 읽어 처리 (연결이 끊기면 0 반환)
+int bot_read(Bot *bot);
+
+// 봇 연결의 on_frame 콜백 (모드에 따라 bot_line, bot_packet 호출)
+void bot_frame(ChatConn *conn, char *frame, size_t len);
+
+// 서버가 보낸 한 줄을 봇 상태에 맞게 처리
+void bot_line(Bot *bot, char *line, BotRun *run);
+
+// 바이너리 모드: 서버가 보낸 메시지 하나를 봇 상태에 맞게 처리
+void bot_packet(Bot *bot, const char *packet, size_t len, BotRun *run);
+
+// 봇 실패 처리 (연결 종료)
+void bot_fail(Bot *bot);
+
+// 지연 시간 표본 추가
+void bot_record(BotRun *run, uint64_t latency_ns);
+
+// 결과 출력 (지연 시간 백분위수, 처리량)
+void bot_report(BotRun *run, double elapsed);
+
+// 단조 증가 시각 (나노초)
+uint64_t mono_ns();
+
 char name[NORMAL_SIZE] = "[DEFALT]"; // 사용자 이름
 char serv_time[NORMAL_SIZE];         // 서버 시간 문자열
 char serv_port[NORMAL_SIZE];         // 서버 포트 문자열
 char clnt_ip[NORMAL_SIZE];           // 클라이언트 IP 문자열
-pthread_t snd_thread, rcv_thread;
 
-int sock = -1; // 소켓 디스크립터
+int sock = -1;                             // 소켓 디스크립터
+volatile sig_atomic_t stop_requested = 0; // Ctrl+C 입력됨 (이벤트 루프가 확인 후 종료)
 
+// client.c를 다른 프로그램에 포함해 연결 코어만 쓸 때는 CHAT_CLIENT_LIB를 정의해 main을 제외
+#ifndef CHAT_CLIENT_LIB
 int main(int argc, char *argv[])
 {
-    signal(SIGINT, cleanup); // Ctrl+C 시 종료 처리
-
     struct sockaddr_in serv_addr;
-    void *thread_return;
 
-    if (argc != 4)
+    // 부하 생성 모드: client.out -b [-B] [-n 접속수] [-r 초당메시지] [-d 초] [-g 방당인원] [-s 바이트] <ip> <port>
+    BotRun run = {.conns = 100, .rate = 1.0, .duration = 10, .group = 10, .size = 64};
+    int bot_mode = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "bBn:r:d:g:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            bot_mode = 1;
+            break;
+        case 'B':
+            run.binary = 1;
+            break;
+        case 'n':
+            run.conns = atoi(optarg);
+            break;
+        case 'r':
+            run.rate = atof(optarg);
+            break;
+        case 'd':
+            run.duration = atoi(optarg);
+            break;
+        case 'g':
+            run.group = atoi(optarg);
+            break;
+        case 's':
+            run.size = atoi(optarg);
+            break;
+        default:
+            bot_mode = -1;
+            break;
+        }
+    }
+
+    if (bot_mode == 1 && optind == argc - 2 && run.conns > 0 && run.rate > 0 && run.duration > 0 && run.group > 0)
+        return run_bots(argv[optind], argv[optind + 1], &run);
+
+    if (bot_mode != 0 || run.binary || argc != 4)
     {
         printf(" Usage : %s <ip> <port> <name>\n", argv[0]);
+        printf("         %s -b [-B] [-n conns] [-r msgs_per_sec] [-d seconds] [-g per_room] [-s bytes] <ip> <port>\n", argv[0]);
         exit(1);
     }
 
+    // Ctrl+C 시 종료 처리 (핸들러는 표시만 하고, 정리는 이벤트 루프를 빠져나와 수행)
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler;
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
     // 사용자 정보 설정
     sprintf(clnt_ip, "%s", argv[1]);
     sprintf(serv_port, "%s", argv[2]);
@@ -56,9 +259,6 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
-    // 서버에 사용자 이름 전송
-    send(sock, argv[3], strlen(argv[3]), 0);
-
     // 접속 시간 기록
     time_t timer = time(NULL);
     struct tm *t = localtime(&timer);
@@ -67,72 +267,121 @@ int main(int argc, char *argv[])
              t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
              t->tm_hour, t->tm_min, t->tm_sec);
 
+    // 서버 출력은 모아 두었다가 읽기 한 번이 끝날 때 한꺼번에 화면에 씀
+    static char out[OUTPUT_BUF_SIZE];
+    setvbuf(stdout, out, _IOFBF, sizeof(out));
+
     menu();
 
-    // 송신/수신 스레드 생성
-    pthread_create(&snd_thread, NULL, send_msg, (void *)&sock);
-    pthread_create(&rcv_thread, NULL, recv_msg, (void *)&sock);
-    pthread_join(snd_thread, &thread_return);
-    pthread_join(rcv_thread, &thread_return);
+    run_chat(sock, argv[3]);
 
-    cleanup(0);
+    cleanup();
     return EXIT_SUCCESS;
 }
+#endif
 
-void *send_msg(void *arg)
+void run_chat(int sock, const char *user_name)
 {
-    int sock = *((int *)arg);
-    char buffer[BUF_SIZE];
+    char input[INPUT_BUF_SIZE];
+    size_t input_len = 0;
+    int input_open = 1;
+    int write_closed = 0;
 
-    while (1)
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    ChatConn conn;
+    chat_conn_init(&conn, sock, 0, 0, print_frame, NULL);
+
+    // 서버에 사용자 이름 전송 (모든 메시지는 개행으로 구분)
+    chat_conn_hello(&conn, user_name);
+
+    while (!stop_requested)
     {
-        memset(buffer, 0, sizeof(buffer));
-        if (fgets(buffer, sizeof(buffer), stdin) == NULL)
+        // 입력이 끝나고 보낼 데이터도 다 보냈으면 송신 쪽만 닫고 서버가 연결을 정리하기를 기다림
+        if (!input_open && !write_closed && !chat_conn_pending(&conn))
         {
-            perror("fgets");
-            break;
+            shutdown(sock, SHUT_WR);
+            write_closed = 1;
         }
 
-        buffer[strcspn(buffer, "\r\n")] = '\0';
-        if (strlen(buffer) == 0)
-            continue;
+        struct pollfd fds[2];
+        fds[0].fd = input_open ? STDIN_FILENO : -1;
+        fds[0].events = POLLIN;
+        fds[1].fd = sock;
+        fds[1].events = POLLIN | (chat_conn_pending(&conn) ? POLLOUT : 0);
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
 
-        if (send(sock, buffer, strlen(buffer), 0) < 0)
+        if ((fds[1].revents & POLLOUT) && !chat_conn_flush(&conn))
         {
             perror("send");
             break;
         }
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            int open = chat_conn_read(&conn);
+            fflush(stdout);
+            if (!open)
+            {
+                printf("\n[INFO] 서버와 연결 종료됨\n");
+                break;
+            }
+        }
+
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && !read_input(&conn, input, &input_len))
+            input_open = 0;
     }
 
-    return NULL;
+    fflush(stdout);
+    conn.fd = -1; // 소켓은 cleanup에서 닫음
+    chat_conn_close(&conn);
 }
 
-void *recv_msg(void *arg)
+void print_frame(ChatConn *conn, char *frame, size_t len)
 {
-    int sock = *((int *)arg);
-    char buffer[BUF_SIZE];
+    fwrite(frame, 1, len, stdout);
+    putchar('\n');
+}
 
-    while (1)
+int read_input(ChatConn *conn, char *input, size_t *input_len)
+{
+    ssize_t n = read(STDIN_FILENO, input + *input_len, INPUT_BUF_SIZE - *input_len);
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR;
+
+    // 입력이 끝나면 마지막 줄까지 보내고 종료
+    int open = n > 0;
+    *input_len += n;
+    size_t off = 0;
+    while (off < *input_len)
     {
-        memset(buffer, 0, sizeof(buffer));
-        int n = recv(sock, buffer, sizeof(buffer) - 1, 0);
+        char *line = input + off;
+        char *nl = memchr(line, '\n', *input_len - off);
 
-        if (n < 0)
-        {
-            perror("recv");
-            sleep(1);
-            continue;
-        }
-        if (n == 0)
+        // 개행이 없는 조각은 입력이 끝났거나 버퍼를 가득 채웠을 때만 한 줄로 보냄
+        if (nl == NULL && open && !(off == 0 && *input_len == INPUT_BUF_SIZE))
+            break;
+        size_t len = nl != NULL ? (size_t)(nl - line) : *input_len - off;
+        off += len + (nl != NULL);
+
+        while (len > 0 && line[len - 1] == '\r')
+            len--;
+        if (len > 0 && !chat_conn_line(conn, line, len))
         {
-            printf("\n[INFO] 서버와 연결 종료됨\n");
-            cleanup(0);
+            perror("send");
+            return 0;
         }
-
-        printf("%s", buffer); 
     }
-
-    return NULL;
+    memmove(input, input + off, *input_len - off);
+    *input_len -= off;
+    return open;
 }
 
 void menu()
@@ -143,15 +392,668 @@ void menu()
     printf(" Client IP   : %s \n", clnt_ip);
     printf(" Chat Name   : %s \n", name);
     printf(" Server Time : %s \n", serv_time);
+    fflush(stdout);
 }
 
-void cleanup(int signo)
+void sigint_handler(int signo)
 {
-    if (sock != -1) close(sock);
+    stop_requested = 1;
+}
 
-    pthread_cancel(snd_thread);
-    pthread_cancel(rcv_thread);
+void cleanup()
+{
+    if (sock != -1)
+        close(sock);
+    sock = -1;
 
     printf("\n[NOTICE] 클라이언트 종료\n");
-    exit(0);
+    fflush(stdout);
+}
+
+void chat_conn_init(ChatConn *conn, int fd, int binary, size_t out_limit, ChatFrameFn on_frame, void *ctx)
+{
+    conn->fd = fd;
+    conn->binary = binary;
+    conn->in_len = 0;
+    conn->in_skip = 0;
+    conn->out_buf = NULL;
+    conn->out_len = 0;
+    conn->out_cap = 0;
+    conn->out_limit = out_limit;
+    conn->bytes_in = 0;
+    conn->on_frame = on_frame;
+    conn->ctx = ctx;
+}
+
+int chat_conn_read(ChatConn *conn)
+{
+    while (1)
+    {
+        ssize_t n = recv(conn->fd, conn->in_buf + conn->in_len, sizeof(conn->in_buf) - conn->in_len - 1, MSG_DONTWAIT);
+        if (n == 0)
+            return 0;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn->in_len += n;
+        conn->bytes_in += n;
+
+        // 완성된 메시지를 모두 처리하고 남은 부분은 앞으로 당김
+        size_t off = 0;
+        if (conn->binary)
+        {
+            while (1)
+            {
+                const char *p = conn->in_buf + off;
+                uint64_t body_len;
+                int r = proto_get_varint(&p, conn->in_buf + conn->in_len, &body_len);
+
+                // 길이가 아직 다 도착하지 않았으면 다음 수신까지 기다림
+                if (r == 0)
+                    break;
+
+                // 버퍼에 다 들어가지 않는 메시지는 건너뛸 수 없으므로 연결 실패로 처리
+                if (r < 0 || body_len == 0 || body_len > sizeof(conn->in_buf) - PROTO_MAX_VARINT - 1)
+                    return 0;
+                if ((size_t)(conn->in_buf + conn->in_len - p) < body_len)
+                    break;
+                if (!chat_conn_ping(conn, p, body_len))
+                    conn->on_frame(conn, (char *)p, body_len);
+                off = p - conn->in_buf + body_len;
+            }
+        }
+        else
+        {
+            char *nl;
+            while ((nl = memchr(conn->in_buf + off, '\n', conn->in_len - off)) != NULL)
+            {
+                char *line = conn->in_buf + off;
+                *nl = '\0';
+                if (!conn->in_skip && !chat_conn_ping(conn, line, nl - line))
+                    conn->on_frame(conn, line, nl - line);
+                conn->in_skip = 0;
+                off = nl - conn->in_buf + 1;
+            }
+        }
+        memmove(conn->in_buf, conn->in_buf + off, conn->in_len - off);
+        conn->in_len -= off;
+
+        // 버퍼보다 긴 줄은 버림
+        if (conn->in_len == sizeof(conn->in_buf) - 1)
+        {
+            conn->in_len = 0;
+            conn->in_skip = 1;
+        }
+    }
+}
+
+int chat_conn_send(ChatConn *conn, const char *data, size_t len)
+{
+    // 앞서 쌓인 데이터가 없으면 바로 보내고, 소켓 버퍼에 들어가지 않은 나머지만 쌓음
+    size_t sent = 0;
+    if (conn->out_len == 0)
+    {
+        ssize_t n = send(conn->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return 0;
+        sent = n > 0 ? n : 0;
+        if (sent == len)
+            return 1;
+    }
+
+    // 일부라도 보낸 메시지는 이어지는 메시지가 깨지지 않도록 상한과 관계없이 나머지를 쌓음
+    size_t rest = len - sent;
+    if (sent == 0 && conn->out_limit > 0 && conn->out_len + rest > conn->out_limit)
+        return 0;
+    if (conn->out_len + rest > conn->out_cap)
+    {
+        size_t cap = conn->out_cap ? conn->out_cap * 2 : CONN_BUF_SIZE;
+        while (cap < conn->out_len + rest)
+            cap *= 2;
+        char *buf = realloc(conn->out_buf, cap);
+        if (buf == NULL)
+            return 0;
+        conn->out_buf = buf;
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out_buf + conn->out_len, data + sent, rest);
+    conn->out_len += rest;
+    return 1;
+}
+
+int chat_conn_line(ChatConn *conn, const char *line, size_t len)
+{
+    char buf[CONN_BUF_SIZE];
+    if (len > sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    memcpy(buf, line, len);
+    buf[len++] = '\n';
+    return chat_conn_send(conn, buf, len);
+}
+
+int chat_conn_request(ChatConn *conn, int op, int64_t id, const char *str, size_t len)
+{
+    char packet[CONN_BUF_SIZE];
+    if (len > sizeof(packet) - PROTO_HEAD_MAX)
+        len = sizeof(packet) - PROTO_HEAD_MAX;
+    return chat_conn_send(conn, packet, proto_build(packet, op, id, str, len, 0));
+}
+
+int chat_conn_hello(ChatConn *conn, const char *user_name)
+{
+    size_t len = strlen(user_name);
+    if (len > NORMAL_SIZE)
+        len = NORMAL_SIZE;
+    if (!conn->binary)
+        return chat_conn_line(conn, user_name, len) && chat_conn_pong(conn, 0);
+
+    // 매직과 이름, 하트비트 시작 요청을 한 번에 전송
+    char hello[PROTO_MAGIC_LEN + PROTO_HEAD_MAX * 2 + NORMAL_SIZE];
+    memcpy(hello, PROTO_MAGIC, PROTO_MAGIC_LEN);
+    size_t n = PROTO_MAGIC_LEN + proto_build(hello + PROTO_MAGIC_LEN, REQ_HELLO, -1, user_name, len, 0);
+    n += proto_build(hello + n, REQ_PONG, 0, NULL, 0, 0);
+    return chat_conn_send(conn, hello, n);
+}
+
+int chat_conn_pong(ChatConn *conn, uint32_t nonce)
+{
+    if (conn->binary)
+        return chat_conn_request(conn, REQ_PONG, nonce, NULL, 0);
+
+    char line[NORMAL_SIZE];
+    int len = snprintf(line, sizeof(line), "/pong %u", nonce);
+    return chat_conn_line(conn, line, len);
+}
+
+int chat_conn_ping(ChatConn *conn, const char *frame, size_t len)
+{
+    if (conn->binary)
+    {
+        if ((uint8_t)frame[0] != RES_PING)
+            return 0;
+        const char *p = frame + 1;
+        uint64_t nonce = 0;
+        proto_get_varint(&p, frame + len, &nonce);
+        chat_conn_pong(conn, (uint32_t)nonce);
+        return 1;
+    }
+
+    // 번호만 있는 줄만 PING으로 봄
+    char *end;
+    if (strncmp(frame, "[PING] ", 7) != 0 || !isdigit((unsigned char)frame[7]))
+        return 0;
+    unsigned long nonce = strtoul(frame + 7, &end, 10);
+    if (*end != '\0')
+        return 0;
+    chat_conn_pong(conn, (uint32_t)nonce);
+    return 1;
+}
+
+int chat_conn_flush(ChatConn *conn)
+{
+    size_t off = 0;
+    while (off < conn->out_len)
+    {
+        ssize_t n = send(conn->fd, conn->out_buf + off, conn->out_len - off, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return 0;
+            break;
+        }
+        off += n;
+    }
+    memmove(conn->out_buf, conn->out_buf + off, conn->out_len - off);
+    conn->out_len -= off;
+    return 1;
+}
+
+int chat_conn_pending(const ChatConn *conn)
+{
+    return conn->out_len > 0;
+}
+
+void chat_conn_close(ChatConn *conn)
+{
+    if (conn->fd >= 0)
+        close(conn->fd);
+    conn->fd = -1;
+    free(conn->out_buf);
+    conn->out_buf = NULL;
+    conn->out_len = conn->out_cap = 0;
+}
+
+int run_bots(const char *ip, const char *port, BotRun *run)
+{
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = inet_addr(ip);
+    serv_addr.sin_port = htons(atoi(port));
+
+    // 접속 수만큼 fd를 쓸 수 있도록 소프트 한도를 하드 한도까지 올림
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    Bot *bots = calloc(run->conns, sizeof(Bot));
+    int epfd = epoll_create1(0);
+    if (bots == NULL || epfd < 0)
+    {
+        perror("init");
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < run->conns; i++)
+    {
+        bots[i].index = i;
+        bots[i].conn.fd = -1;
+        bots[i].room_id = -1;
+        bots[i].state = BOT_CONNECTING;
+        bots[i].run = run;
+    }
+
+    printf("[BENCH] %d개 연결, 연결당 초당 %.2f개 메시지, 채팅방당 %d명, %d초 측정 (%s 모드)\n",
+           run->conns, run->rate, run->group, run->duration, run->binary ? "바이너리" : "텍스트");
+
+    // 메시지 본문: "T <보낸 시각 ns> <봇 번호>" 뒤를 지정한 길이까지 채움
+    char *msg = malloc(run->size + 64);
+    if (msg == NULL)
+        return EXIT_FAILURE;
+
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t start_ns = mono_ns();
+    uint64_t bench_start = 0, bench_end = 0;
+    uint64_t due_base = 0;
+    int next_bot = 0;
+    int next_connect = 0;
+
+    while (1)
+    {
+        // 서버 listen 백로그가 넘치지 않도록 몇 개씩 나눠서 접속
+        while (next_connect < run->conns && run->handshaking < BOT_CONNECT_WINDOW)
+            bot_connect(epfd, &bots[next_connect++], &serv_addr, run);
+
+        int nfds = epoll_wait(epfd, events, MAX_EVENTS, BOT_TICK_MS);
+        for (int e = 0; e < nfds; e++)
+        {
+            Bot *bot = events[e].data.ptr;
+            if (bot->state == BOT_FAILED)
+                continue;
+
+            // 접속이 완료되면 이름을 보내고, 그룹 대표는 채팅방을 개설
+            if (bot->state == BOT_CONNECTING && (events[e].events & EPOLLOUT))
+            {
+                int err = 0;
+                socklen_t elen = sizeof(err);
+                getsockopt(bot->conn.fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+                if (err != 0)
+                {
+                    run->handshaking--;
+                    bot_fail(bot);
+                    continue;
+                }
+
+                char text[NORMAL_SIZE];
+                int leader = bot->index % run->group == 0;
+                snprintf(text, sizeof(text), "bot%d", bot->index);
+                chat_conn_hello(&bot->conn, text);
+                if (leader)
+                {
+                    int text_len = snprintf(text, sizeof(text), "load-%d", bot->index / run->group);
+                    if (run->binary)
+                    {
+                        chat_conn_request(&bot->conn, REQ_CREATE, -1, text, text_len);
+                    }
+                    else
+                    {
+                        chat_conn_line(&bot->conn, "3", 1);
+                        chat_conn_line(&bot->conn, text, text_len);
+                    }
+                }
+                bot->state = leader ? BOT_CREATING : BOT_WAITING;
+            }
+            else if ((events[e].events & EPOLLOUT) && !chat_conn_flush(&bot->conn))
+            {
+                bot_fail(bot);
+                continue;
+            }
+
+            if ((events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !bot_read(bot))
+            {
+                if (!bot->greeted)
+                    run->handshaking--;
+                bot_fail(bot);
+            }
+        }
+
+        // 그룹 대표의 채팅방 번호가 정해지면 나머지 봇도 입장
+        int joined = 0, pending = 0;
+        for (int i = 0; i < run->conns; i++)
+        {
+            Bot *bot = &bots[i];
+            if (bot->state == BOT_WAITING)
+            {
+                Bot *leader = &bots[i - i % run->group];
+                if (leader->room_id >= 0)
+                {
+                    if (run->binary)
+                    {
+                        chat_conn_request(&bot->conn, REQ_JOIN, leader->room_id, NULL, 0);
+                    }
+                    else
+                    {
+                        char join[NORMAL_SIZE];
+                        int len = snprintf(join, sizeof(join), "2\n%ld\n", leader->room_id);
+                        chat_conn_send(&bot->conn, join, len);
+                    }
+                    bot->state = BOT_JOINING;
+                }
+                else if (leader->state == BOT_FAILED)
+                {
+                    bot_fail(bot);
+                }
+            }
+            if (bot->state == BOT_JOINED)
+                joined++;
+            else if (bot->state != BOT_FAILED)
+                pending++;
+        }
+
+        uint64_t now = mono_ns();
+
+        // 모두 입장했거나 입장 대기 시간이 지나면 측정 시작
+        if (bench_start == 0 && (pending == 0 || now - start_ns > (uint64_t)BOT_JOIN_TIMEOUT * 1000000000ULL))
+        {
+            if (joined == 0)
+            {
+                printf("[BENCH] 입장한 봇이 없습니다.\n");
+                return EXIT_FAILURE;
+            }
+            printf("[BENCH] %d/%d개 연결 입장 완료 (%.2f초), 측정 시작\n", joined, run->conns, (now - start_ns) / 1e9);
+            bench_start = now;
+            run->measuring = 1;
+            due_base = 0;
+        }
+        if (bench_start == 0)
+            continue;
+
+        // 전체 전송률에 맞춰 밀린 만큼 보냄 (봇을 돌아가며 선택)
+        if (bench_end == 0)
+        {
+            double elapsed = (now - bench_start) / 1e9;
+            uint64_t due = (uint64_t)(elapsed * run->rate * joined);
+            while (due_base < due)
+            {
+                Bot *bot = &bots[next_bot];
+                next_bot = (next_bot + 1) % run->conns;
+                if (bot->state != BOT_JOINED)
+                    continue;
+
+                int len = snprintf(msg, run->size + 64, "T %llu %d ", (unsigned long long)mono_ns(), bot->index);
+                while (len < run->size)
+                    msg[len++] = 'x';
+
+                int ok;
+                if (run->binary)
+                    ok = chat_conn_request(&bot->conn, REQ_SAY, -1, msg, len);
+                else
+                    ok = chat_conn_line(&bot->conn, msg, len);
+                if (ok)
+                    run->sent++;
+                else
+                    run->send_drop++;
+                due_base++;
+            }
+
+            if (elapsed >= run->duration)
+                bench_end = now;
+        }
+        else if (now - bench_end > (uint64_t)BOT_DRAIN_SEC * 1000000000ULL)
+        {
+            break;
+        }
+    }
+
+    bot_report(run, (bench_end - bench_start) / 1e9);
+
+    for (int i = 0; i < run->conns; i++)
+        chat_conn_close(&bots[i].conn);
+    close(epfd);
+    free(msg);
+    free(bots);
+    free(run->lat_us);
+    return EXIT_SUCCESS;
+}
+
+void bot_connect(int epfd, Bot *bot, struct sockaddr_in *serv_addr, BotRun *run)
+{
+    int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        bot->state = BOT_FAILED;
+        return;
+    }
+    if (connect(fd, (struct sockaddr *)serv_addr, sizeof(*serv_addr)) < 0 && errno != EINPROGRESS)
+    {
+        perror("connect");
+        close(fd);
+        bot->state = BOT_FAILED;
+        return;
+    }
+    chat_conn_init(&bot->conn, fd, run->binary, BOT_SEND_LIMIT, bot_frame, bot);
+
+    // 짧은 메시지를 모아 보내지 않도록 Nagle 알고리즘을 끔
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // 엣지 트리거로 한 번만 등록 (쓰기 가능 알림은 접속 완료와 쌓인 데이터 전송에 사용)
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = bot;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    run->handshaking++;
+}
+
+int bot_read(Bot *bot)
+{
+    BotRun *run = bot->run;
+    uint64_t before = bot->conn.bytes_in;
+    int open = chat_conn_read(&bot->conn);
+
+    if (bot->conn.bytes_in > before)
+    {
+        if (!bot->greeted)
+        {
+            bot->greeted = 1;
+            run->handshaking--;
+        }
+        if (run->measuring)
+            run->bytes_in += bot->conn.bytes_in - before;
+    }
+    return open;
+}
+
+void bot_frame(ChatConn *conn, char *frame, size_t len)
+{
+    Bot *bot = conn->ctx;
+    if (bot->state == BOT_FAILED)
+        return;
+    if (conn->binary)
+        bot_packet(bot, frame, len, bot->run);
+    else
+        bot_line(bot, frame, bot->run);
+}
+
+void bot_line(Bot *bot, char *line, BotRun *run)
+{
+    if (bot->state == BOT_CREATING && strstr(line, "개설되었습니다") != NULL)
+    {
+        // "채팅방 <이름> (<번호>)이 개설되었습니다." 에서 번호를 꺼내 입장
+        char *open = strrchr(line, '(');
+        if (open == NULL)
+            return;
+        bot->room_id = strtol(open + 1, NULL, 10);
+
+        char join[NORMAL_SIZE];
+        int len = snprintf(join, sizeof(join), "2\n%ld\n", bot->room_id);
+        chat_conn_send(&bot->conn, join, len);
+        bot->state = BOT_JOINING;
+        return;
+    }
+
+    if (bot->state == BOT_CREATING && strstr(line, "개설할 수 없습니다") != NULL)
+    {
+        printf("[BENCH] 봇 %d: 채팅방을 개설할 수 없습니다.\n", bot->index);
+        bot->state = BOT_FAILED;
+        return;
+    }
+
+    if (bot->state == BOT_JOINING && strstr(line, "에 입장했습니다") != NULL)
+    {
+        bot->state = BOT_JOINED;
+        return;
+    }
+
+    if (bot->state == BOT_JOINING && (strstr(line, "가득 찼습니다") != NULL || strstr(line, "존재하지 않는") != NULL))
+    {
+        printf("[BENCH] 봇 %d: 채팅방 입장 실패 (%s)\n", bot->index, line);
+        bot->state = BOT_FAILED;
+        return;
+    }
+
+    // 다른 봇의 메시지 "[botN] T <보낸 시각> ..." 의 지연 시간 기록 (본인 [ME] 메시지는 제외)
+    if (bot->state == BOT_JOINED && line[0] == '[' && strncmp(line, "[ME]", 4) != 0)
+    {
+        char *body = strstr(line, "] T ");
+        if (body == NULL)
+            return;
+
+        uint64_t sent_ns = strtoull(body + 4, NULL, 10);
+        uint64_t now = mono_ns();
+        if (sent_ns > 0 && now >= sent_ns)
+        {
+            run->received++;
+            bot_record(run, now - sent_ns);
+        }
+    }
+}
+
+void bot_packet(Bot *bot, const char *packet, size_t len, BotRun *run)
+{
+    const char *p = packet + 1, *end = packet + len;
+    uint64_t value;
+    char text[CONN_BUF_SIZE];
+
+    switch ((unsigned char)packet[0])
+    {
+    case RES_WELCOME: // 본인 메시지를 구분하기 위해 사용자 번호 기억
+        if (proto_get_varint(&p, end, &value) == 1)
+            bot->user_id = (long)value;
+        break;
+    case RES_CREATED: // 그룹 대표가 개설한 채팅방에 입장
+        if (bot->state != BOT_CREATING || proto_get_varint(&p, end, &value) != 1)
+            break;
+        bot->room_id = (long)value;
+        chat_conn_request(&bot->conn, REQ_JOIN, bot->room_id, NULL, 0);
+        bot->state = BOT_JOINING;
+        break;
+    case RES_JOINED:
+        if (bot->state == BOT_JOINING)
+            bot->state = BOT_JOINED;
+        break;
+    case RES_ERROR:
+        if ((bot->state == BOT_CREATING || bot->state == BOT_JOINING) && proto_get_varint(&p, end, &value) == 1)
+        {
+            printf("[BENCH] 봇 %d: 채팅방 %s 실패 (오류 코드 %llu)\n", bot->index,
+                   bot->state == BOT_CREATING ? "개설" : "입장", (unsigned long long)value);
+            bot->state = BOT_FAILED;
+        }
+        break;
+    case RES_MSG: // 다른 봇의 메시지 "T <보낸 시각> ..." 의 지연 시간 기록
+        if (bot->state != BOT_JOINED || proto_get_varint(&p, end, &value) != 1 || (long)value == bot->user_id)
+            break;
+        if (proto_get_str(&p, end, text, sizeof(text)) && strncmp(text, "T ", 2) == 0)
+        {
+            uint64_t sent_ns = strtoull(text + 2, NULL, 10);
+            uint64_t now = mono_ns();
+            if (sent_ns > 0 && now >= sent_ns)
+            {
+                run->received++;
+                bot_record(run, now - sent_ns);
+            }
+        }
+        break;
+    }
+}
+
+void bot_fail(Bot *bot)
+{
+    bot->state = BOT_FAILED;
+    chat_conn_close(&bot->conn);
+}
+
+void bot_record(BotRun *run, uint64_t latency_ns)
+{
+    if (run->lat_count == run->lat_cap)
+    {
+        size_t cap = run->lat_cap ? run->lat_cap * 2 : 65536;
+        uint32_t *lat = realloc(run->lat_us, cap * sizeof(uint32_t));
+        if (lat == NULL)
+            return;
+        run->lat_us = lat;
+        run->lat_cap = cap;
+    }
+
+    uint64_t us = latency_ns / 1000;
+    run->lat_us[run->lat_count++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void bot_report(BotRun *run, double elapsed)
+{
+    printf("[BENCH] 보낸 메시지 %llu개 (전송 실패 %llu개), 받은 메시지 %llu개, %.2f초\n",
+           (unsigned long long)run->sent, (unsigned long long)run->send_drop,
+           (unsigned long long)run->received, elapsed);
+    if (elapsed > 0)
+        printf("[BENCH] 처리량: 송신 %.1f msg/s, 수신 %.1f msg/s\n", run->sent / elapsed, run->received / elapsed);
+    if (run->received > 0)
+        printf("[BENCH] 수신 %llu바이트 (받은 메시지당 %.1f바이트)\n",
+               (unsigned long long)run->bytes_in, (double)run->bytes_in / run->received);
+
+    if (run->lat_count == 0)
+        return;
+
+    qsort(run->lat_us, run->lat_count, sizeof(uint32_t), cmp_u32);
+    double pct[4] = {0.50, 0.99, 0.999, 1.0};
+    const char *label[4] = {"p50", "p99", "p999", "max"};
+    printf("[BENCH] 전달 지연:");
+    for (int k = 0; k < 4; k++)
+    {
+        size_t idx = (size_t)(pct[k] * (run->lat_count - 1));
+        printf(" %s=%.3fms", label[k], run->lat_us[idx] / 1000.0);
+    }
+    printf("\n");
+}
+
+uint64_t mono_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
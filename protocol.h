@@ -0,0 +1,139 @@
+// protocol.h
+// 바이너리 모드 프로토콜 정의 (server.c, client.c 공용)
+//
+// 접속 직후 클라이언트가 PROTO_MAGIC 4바이트를 먼저 보내면 바이너리 모드, 아니면 기존 텍스트 모드 (첫 줄 = 사용자 이름)
+// 바이너리 모드의 모든 메시지는 [본문 길이 varint][명령 코드 1바이트][필드...] 형태이고,
+// 정수 필드는 varint(LEB128), 문자열 필드는 [길이 varint][바이트] (NUL 종료 없음)
+// 채팅방과 사용자는 번호로만 구분하며 (사용자 번호는 접속 중에만 유효), 메뉴 문구는 보내지 않음
+// 연결이 끊기면 RES_SESSION 토큰과 마지막으로 받은 메시지 번호로 REQ_RESUME을 보내 채팅방과 놓친 메시지를 이어받음
+
+#ifndef CHAT_PROTOCOL_H
+#define CHAT_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROTO_MAGIC "\0CH\1"                    // 텍스트 이름은 NUL로 시작할 수 없으므로 첫 바이트로 구분 (마지막 바이트는 버전)
+#define PROTO_MAGIC_LEN 4
+#define PROTO_MAX_VARINT 10                     // 64비트 정수의 varint 최대 길이
+#define PROTO_HEAD_MAX (1 + 3 * PROTO_MAX_VARINT) // 길이 + 명령 코드 + 정수 필드 + 문자열 길이
+
+// 클라이언트 -> 서버
+typedef enum
+{
+    REQ_HELLO = 1, // {이름} 매직 바로 뒤 첫 메시지
+    REQ_NAME,      // {이름} 이름 변경 (로비)
+    REQ_LIST,      // 채팅방 목록 요청 (로비)
+    REQ_JOIN,      // {채팅방 번호} 입장 (로비)
+    REQ_CREATE,    // {채팅방 이름} 개설 (로비)
+    REQ_SAY,       // {본문} 채팅 메시지, 게임/투표 입력 (채팅방)
+    REQ_LEAVE,     // 채팅방 나가기 (채팅방)
+    REQ_INFO,      // 채팅방 정보 (채팅방, RES_TEXT로 응답)
+    REQ_HISTORY,   // {개수} 최근 메시지 (채팅방, 0이면 메모리에 있는 전부, RES_TEXT로 응답)
+    REQ_GAME,      // 숫자 야구 시작 (채팅방)
+    REQ_POLL,      // 투표 시작 (채팅방)
+    REQ_BYE,       // 접속 종료 (로비)
+    REQ_RESUME,    // {마지막으로 받은 메시지 번호, 토큰} 매직 바로 뒤 REQ_HELLO 대신 보내 끊긴 세션을 이어받음
+    REQ_PONG       // {번호} RES_PING 응답 (접속 직후 번호 0으로 한 번 보내면 서버가 하트비트를 시작, 상태와 무관)
+} ProtoRequest;
+
+// 서버 -> 클라이언트
+typedef enum
+{
+    RES_WELCOME = 1, // {사용자 번호, 이름} REQ_HELLO, REQ_NAME 응답
+    RES_TEXT,        // {문자열} 안내, 게임/투표 진행, 채팅방 정보, 최근 메시지 등 텍스트 모드와 같은 문구
+    RES_ROOMS,       // {채팅방 수, (채팅방 번호, 인원, 이름)...}
+    RES_JOINED,      // {채팅방 번호, 이름, 인원, (사용자 번호, 이름)..., 마지막 메시지 번호} 입장 완료
+    RES_MEMBER,      // {사용자 번호, 이름} 다른 사용자가 입장
+    RES_LEFT,        // {사용자 번호} 사용자가 나감 (본인 번호면 로비로 돌아감)
+    RES_MSG,         // {사용자 번호, 본문, 메시지 번호} 채팅 메시지 (본인 메시지 포함, 번호는 채팅방마다 1씩 증가)
+    RES_CREATED,     // {채팅방 번호} 개설 완료
+    RES_ERROR,       // {오류 코드}
+    RES_SESSION,     // {토큰} 재접속용 세션 토큰 (RES_WELCOME 다음, 서버가 세션을 유지할 때만)
+    RES_PING,        // {번호} 하트비트 (같은 번호로 REQ_PONG 응답, 응답이 계속 없으면 연결을 끊음)
+    RES_REPLAY       // {메시지 번호, 문자열} REQ_RESUME으로 다시 받는 놓친 메시지 하나 ("[이름] 본문" 줄, 번호 순서대로 RES_TEXT 안내 뒤에 옴)
+} ProtoResponse;
+
+// RES_ERROR 오류 코드
+typedef enum
+{
+    PROTO_ERR_BAD_REQUEST = 1, // 해석할 수 없거나 현재 상태에서 쓸 수 없는 요청
+    PROTO_ERR_NO_ROOM,         // 존재하지 않는 채팅방
+    PROTO_ERR_ROOM_FULL,       // 채팅방 인원 초과
+    PROTO_ERR_TOO_MANY_ROOMS,  // 더 이상 채팅방을 개설할 수 없음
+    PROTO_ERR_SERVER_FULL,     // 서버 인원 초과
+    PROTO_ERR_NO_SESSION,      // REQ_RESUME의 세션이 없거나 만료됨 (새 사용자로 접속)
+    PROTO_ERR_SLOW_DOWN        // 입력이 속도 제한을 넘음 (서버 설정에 따라 나중에 처리되거나 버려짐)
+} ProtoError;
+
+// varint 작성 (작성한 바이트 수 반환)
+static inline size_t proto_put_varint(char *out, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        out[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (char)v;
+    return n;
+}
+
+// varint 읽기 (읽었으면 1, 데이터가 더 필요하면 0, 잘못된 값이면 -1)
+static inline int proto_get_varint(const char **p, const char *end, uint64_t *v)
+{
+    uint64_t value = 0;
+    const char *q = *p;
+    for (int shift = 0; shift < 7 * PROTO_MAX_VARINT; shift += 7)
+    {
+        if (q == end)
+            return 0;
+        unsigned char b = (unsigned char)*q++;
+        value |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *v = value;
+            *p = q;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+// 문자열 필드를 out에 복사 (size보다 길면 자름, 필드가 잘못되었으면 0 반환)
+static inline int proto_get_str(const char **p, const char *end, char *out, size_t size)
+{
+    uint64_t len;
+    if (proto_get_varint(p, end, &len) != 1 || len > (uint64_t)(end - *p))
+        return 0;
+    size_t copy = len < size - 1 ? (size_t)len : size - 1;
+    memcpy(out, *p, copy);
+    out[copy] = '\0';
+    *p += len;
+    return 1;
+}
+
+// 정수 필드 하나(id < 0이면 생략)와 문자열 필드 하나(str이 NULL이면 생략)로 된 메시지를 작성
+// 문자열 길이는 len + extra로 기록하고 len바이트만 복사하므로 나머지 extra바이트는 호출자가 이어서 보냄
+// out은 PROTO_HEAD_MAX + len바이트 이상이어야 하며, 작성한 바이트 수 반환
+static inline size_t proto_build(char *out, int op, int64_t id, const char *str, size_t len, size_t extra)
+{
+    char fields[1 + 2 * PROTO_MAX_VARINT];
+    size_t k = 0;
+    fields[k++] = (char)op;
+    if (id >= 0)
+        k += proto_put_varint(fields + k, (uint64_t)id);
+    if (str != NULL)
+        k += proto_put_varint(fields + k, len + extra);
+    else
+        len = extra = 0;
+
+    size_t n = proto_put_varint(out, k + len + extra);
+    memcpy(out + n, fields, k);
+    if (len > 0)
+        memcpy(out + n + k, str, len);
+    return n + k + len;
+}
+
+#endif
@@ -1,24 +1,70 @@
 // server.c
 
+#define _GNU_SOURCE // memrchr
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
 #include <time.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/sendfile.h>
+#include <sys/random.h>
+
+#include "protocol.h"
 
 // 서버 설정 상수
-#define MAX_CLIENTS 20
-#define MAX_CHATROOMS 50
+#define CLIENT_CHUNK 1024 // 클라이언트 슬롯을 한 번에 할당하는 단위
+#define MAX_CHATROOMS 4096 // 동시에 열 수 있는 최대 채팅방 수
+#define ROOM_CHUNK 64      // 채팅방 슬롯을 한 번에 할당하는 단위
+#define DEFAULT_ROOM_IDLE_TIMEOUT 600 // 빈 채팅방을 회수하기까지의 시간 (초)
 #define MAX_ROOM_USERS 10
+#define MAX_EVENTS 64
+#define DEFAULT_LISTEN_BACKLOG 1024   // 리스닝 소켓 대기열 길이 (커널의 somaxconn을 넘으면 잘림)
+#define DEFAULT_HANDSHAKE_TIMEOUT 10  // 접속 후 사용자 이름을 보내야 하는 시간 (초)
+
+// 타이머 관련 상수 (계층형 타이머 휠: 한 단계 64칸, 4단계면 약 97일까지 표현)
+#define TIMER_TICK_MS 500             // 타이머 휠 한 칸의 시간
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define DEFAULT_CONN_IDLE_TIMEOUT 0   // 입력이 없는 연결을 끊기까지의 시간 (초, 0이면 끊지 않음)
+#define DEFAULT_POLL_TIMEOUT 120      // 투표를 자동으로 마감하기까지의 시간 (초)
+#define DEFAULT_GAME_TIMEOUT 300      // 진행이 없는 숫자 야구 게임을 끝내기까지의 시간 (초)
+#define DEFAULT_PING_INTERVAL 5       // 하트비트 PING 간격 (초)
+#define PING_MISS_LIMIT 3             // 연속으로 이만큼 PING에 응답하지 않으면 연결 종료
+
+// 입력 속도 제한 관련 상수 (토큰 버킷: 초당 설정값만큼 채워지고 RATE_BURST_SEC초 분량까지 모아 둠)
+#define DEFAULT_RATE_LINES 20          // 사용자별 채팅방 입력 초당 줄 수
+#define DEFAULT_RATE_BYTES (32 * 1024) // 사용자별 채팅방 입력 초당 바이트
+#define DEFAULT_RATE_COMMANDS 10       // 사용자별 로비 명령 초당 개수
+#define DEFAULT_ROOM_RATE 100          // 채팅방 전체 입력 초당 줄 수 (줄마다 모든 사용자에게 전송하므로 브로드캐스트 양의 상한)
+#define RATE_BURST_SEC 2
+#define RATE_NOTICE_SEC 5              // 속도 제한 안내를 다시 보내기까지의 최소 간격
+
+// 재접속 세션 관련 상수
+#define DEFAULT_SESSION_GRACE 60 // 연결이 끊긴 뒤 세션을 유지하는 시간 (초)
+#define SESSION_BUCKETS 1024     // 세션 토큰 해시 버킷 수
+#define SESSION_TOKEN_LEN 16     // 토큰 문자열 길이 (64비트 16진수)
 
 // 버퍼크기 상수
 #define SMALL_BUFF_SIZE 64
@@ -26,17 +72,156 @@
 #define MEDIUM_LARGE_BUFF_SIZE 512
 #define LARGE_BUFF_SIZE 1024
 
+// 프레임 관련 상수 (개행으로 구분되는 한 줄 = 한 메시지)
+#define INPUT_BUFF_INIT 256   // 연결별 입력 버퍼 초기 크기
+#define INPUT_BACKLOG_BYTES (64 * 1024) // 처리하지 않은 입력이 이만큼 쌓이면 소켓에서 더 읽지 않음 (나머지는 커널에 남겨 TCP 흐름 제어로 보내는 쪽을 늦춤)
+#define MAX_FRAME_SIZE 4096   // 한 줄의 최대 길이 (초과분은 잘라서 처리)
+
+// 송신 큐 관련 상수
+#define DEFAULT_OUT_QUEUE_LIMIT (256 * 1024) // 연결별 송신 대기 최대 바이트
+#define MAX_IOV 64                           // writev 한 번에 묶는 최대 조각 수
+#define ROOM_HISTORY_MAX (MAX_IOV - 1)       // 채팅방별 최근 메시지 기록 최대 개수 (안내 문구 + 기록을 한 번에 전송)
+#define DEFAULT_ROOM_HISTORY 30              // 채팅방별 최근 메시지 기록 기본 개수
+#define DEFAULT_COALESCE_BYTES (16 * 1024)   // 모아 보내는 중 송신 큐가 이만큼 쌓이면 창이 끝나기 전에 바로 전송
+#define MAX_COALESCE_MS 1000                 // 모아 보내기 창 최대 길이
+#define CONN_EVENTS (EPOLLIN | EPOLLOUT | EPOLLET)
+
+// 송신 큐가 가득 찼을 때의 처리 정책
+typedef enum
+{
+    OVERFLOW_DROP_OLDEST, // 가장 오래된 미전송 메시지부터 버림
+    OVERFLOW_DISCONNECT,  // 연결을 끊음
+    OVERFLOW_LAG          // 큐가 빌 때까지 새 메시지를 버리고 지연 상태로 표시
+} OverflowPolicy;
+
+// 입력 속도 제한을 넘었을 때의 처리 정책
+typedef enum
+{
+    RATE_DEFER, // 토큰이 찰 때까지 입력 처리를 미룸
+    RATE_DROP   // 넘은 입력을 버림
+} RatePolicy;
+
+// 메모리 풀 관련 상수 (자주 만들고 버리는 메시지, 송신 큐 조각, 입력 버퍼를 크기 등급별로 재사용)
+#define POOL_MIN_SHIFT 6                   // 가장 작은 등급 64바이트
+#define POOL_CLASSES 8                     // 64바이트 ~ 8KB (2의 거듭제곱), 더 크면 malloc으로 할당
+#define POOL_CACHE_MAX 128                 // 스레드별로 들고 있는 등급별 빈 블록 수 (넘으면 공용 저장소로 넘김)
+#define POOL_BATCH 32                      // 공용 저장소와 한 번에 주고받는 블록 수
+#define POOL_DEPOT_BYTES (4 * 1024 * 1024) // 등급별 공용 저장소 최대 크기 (넘는 블록은 시스템에 반환)
+
+// 로그 관련 상수
+#define LOG_RING_SIZE (256 * 1024)   // 스레드별 로그 버퍼 크기 (2의 거듭제곱)
+#define LOG_LINE_SIZE 1024           // 로그 한 줄의 최대 길이
+#define LOG_BATCH_SIZE (64 * 1024)   // 기록 스레드가 한 번에 쓰는 최대 바이트
+#define LOG_BATCH_DELAY_US 2000      // 일부만 찬 묶음을 쓴 뒤 다음 묶음을 모으는 시간
+
+// 로그 수준 (설정한 수준보다 자세한 로그는 만들지 않음)
+typedef enum
+{
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG // 채팅 메시지 내용 등 메시지마다 남는 로그
+} LogLevel;
+
+// 저장 관련 상수 (채팅방 메시지 로그, -D)
+#define STORE_SEGMENT_SIZE (1024 * 1024) // 세그먼트 파일 하나의 최대 크기
+#define STORE_KEEP_SEGMENTS 16           // 채팅방별로 남겨 두는 세그먼트 수 (넘으면 오래된 것부터 삭제)
+#define STORE_COMMIT_DELAY_US 2000       // 요청을 모아 한 번의 fsync로 기록하기 위해 기다리는 시간
+#define STORE_BUCKETS 1024               // 저장 스레드의 채팅방 파일 해시 버킷 수
+#define STORE_MAX_OPEN 128               // 동시에 열어 두는 세그먼트 파일 수 (클라이언트용 fd에서 제외)
+#define SENDFILE_CHUNK (256 * 1024)      // 송신 큐를 한 번 비울 때 파일에서 소켓으로 보내는 최대 바이트 (나머지는 다음 차례에)
+#define COPY_CHUNK (64 * 1024)           // sendfile을 쓸 수 없을 때 버퍼로 복사해 보내는 단위
+
+// 저장 스레드에 보내는 요청 종류
+typedef enum
+{
+    STORE_CREATE, // 채팅방 디렉터리와 정보 파일 생성
+    STORE_APPEND, // 메시지 한 줄 추가
+    STORE_DROP,    // 회수된 채팅방의 파일 삭제
+    STORE_CATCHUP, // 지난 메시지를 세그먼트 파일에서 바로 클라이언트에게 전송
+    STORE_LOAD     // 재시작 후 처음 입장한 채팅방의 최근 메시지를 읽어 채팅방 reactor로 넘김
+} StoreOpKind;
+
+// 지표 관련 상수
+#define FANOUT_BUCKETS 12 // 브로드캐스트 소요 시간 히스토그램 구간 수 (+Inf 제외)
+
 // 모드 관련 상수
 #define POLLSIZE 100
 #define CHAT_MODE 0
 #define GAME_MODE 1
 #define POLL_MODE 2
 #define MAX_POLL 10
+#define POLL_ARENA_SIZE (MAX_POLL * MEDIUM_BUFF_SIZE) // 채팅방별 투표 항목 문자열 영역 (항목 하나는 최대 MEDIUM_BUFF_SIZE - 1바이트)
+
+struct Reactor;
+
+// 타이머 휠에 등록하는 타이머 (연결과 채팅방에 내장되어 따로 할당하지 않음)
+typedef struct Timer
+{
+    struct Timer *next;   // 같은 칸의 다음 타이머
+    struct Timer **pprev; // 앞 타이머의 next를 가리킴 (NULL이면 등록되지 않은 상태)
+    uint64_t expires;     // 만료 틱
+    int wheel;            // 등록된 reactor 번호
+    unsigned long arg;    // 콜백에 넘길 값 (연결 번호나 채팅방 번호로 대상이 바뀌지 않았는지 확인)
+    void (*fn)(struct Reactor *r, struct Timer *t, unsigned long arg); // 만료 시 reactor 스레드에서 락 없이 호출
+} Timer;
+
+// 풀 블록 머리 (사용자에게는 바로 뒤의 주소를 돌려줌)
+typedef struct PoolBlock
+{
+    struct PoolBlock *next; // 빈 블록 목록의 다음 블록
+    size_t cls;             // 크기 등급 (POOL_CLASSES면 등급보다 커서 malloc으로 할당한 블록)
+} PoolBlock;
+
+// 빈 블록 목록
+typedef struct
+{
+    PoolBlock *head;
+    int count;
+} PoolList;
+
+// 등급별 공용 저장소 (스레드 캐시가 넘치거나 비면 묶음 단위로 주고받음)
+typedef struct
+{
+    pthread_mutex_t lock;
+    PoolList free;
+    atomic_long blocks; // 시스템에서 받아 아직 반환하지 않은 블록 수
+} PoolDepot;
+
+// 입력 속도 제한용 토큰 버킷 (바이트 버킷은 긴 줄 하나로 음수가 될 수 있고, 다시 찰 때까지 기다림)
+typedef struct
+{
+    double tokens;
+    uint64_t stamp_ns; // 마지막으로 채운 시각 (0이면 아직 쓰지 않아 가득 찬 상태)
+} TokenBucket;
+
+// 계층형 타이머 휠 (reactor마다 하나, 등록/취소/만료 모두 O(1))
+typedef struct
+{
+    pthread_mutex_t lock;                   // 다른 스레드의 등록/취소와 만료 처리 보호
+    Timer *slots[WHEEL_LEVELS][WHEEL_SIZE]; // 단계별 칸 (0단계는 한 칸에 한 틱, 위 단계는 64배씩)
+    uint64_t now;                           // 마지막으로 처리한 틱
+    int count;                              // 등록된 타이머 수 (0이면 timerfd를 멈춤)
+    int fd;                                 // 틱마다 reactor를 깨우는 timerfd
+    struct TimerFire *fire;                 // 만료된 타이머를 모아 두는 배열 (락을 놓고 호출)
+    int fire_cap;
+} TimerWheel;
+
+// 만료되어 호출을 기다리는 타이머 (등록 정보를 복사해 두어 호출 전에 대상이 초기화되어도 안전)
+typedef struct TimerFire
+{
+    Timer *timer;
+    void (*fn)(struct Reactor *r, Timer *t, unsigned long arg);
+    unsigned long arg;
+} TimerFire;
 
 // 클라이언트 상태 정의
 typedef enum
 {
     STATE_LOBBY,
+    STATE_AWAIT_NAME,       // 메뉴1: 새 이름 입력 대기
+    STATE_AWAIT_ROOM_ID,    // 메뉴2: 입장할 채팅방 번호 입력 대기
+    STATE_AWAIT_ROOM_TITLE, // 메뉴3: 개설할 채팅방 이름 입력 대기
     STATE_IN_CHATROOM
 } ClientState;
 
@@ -46,19 +231,55 @@ typedef struct
     int fd;
     char user_name[SMALL_BUFF_SIZE];
     ClientState state;
-    int room_id;
+    struct ChatRoom *room; // 참여 중인 채팅방 (로비면 NULL)
+    int next_free; // 빈 슬롯 목록의 다음 슬롯 (사용 중이면 -1)
+    uint64_t token; // 재접속 세션 토큰 (0: 세션을 유지하지 않음)
 } ClientInfo;
 
+// 연결이 끊긴 사용자의 세션 (유지 시간 안에 같은 토큰으로 재접속하면 이름과 채팅방을 이어받음)
+typedef struct Session
+{
+    uint64_t token;
+    char user_name[SMALL_BUFF_SIZE];
+    int in_room;          // 끊길 때 채팅방에 있었는지
+    uint64_t room_id;
+    uint64_t seq;         // 끊길 때까지 소켓에 모두 쓴 마지막 메시지 번호 (텍스트 모드에서 번호를 생략하면 그 다음부터 전송)
+    time_t expires;
+    struct Session *next; // 해시 버킷의 다음 세션
+} Session;
+
 // 채팅방 정보 구조체
-typedef struct
+typedef struct ChatRoom
 {
-    int id;
+    uint64_t id; // 채팅방 번호 (회수된 뒤에도 다시 쓰지 않음)
     char title[MEDIUM_BUFF_SIZE];
     int user_fds[MAX_ROOM_USERS];
     char *user_names[MAX_ROOM_USERS];
     int user_count;
     pthread_mutex_t lock;
-    
+    int reactor;                       // 채팅방 사용자를 처리하는 reactor 번호
+
+    // 채팅방 목록 관련
+    int slot;                    // 채팅방 슬롯 번호
+    int active;                  // 사용 중인 슬롯인지
+    int persistent;              // 기본 채팅방은 비어 있어도 회수하지 않음
+    time_t idle_since;           // 마지막 사용자가 나간 시각
+    int next_free;               // 빈 슬롯 목록의 다음 슬롯
+    struct ChatRoom *hash_next;  // 번호 해시 버킷의 다음 채팅방
+
+    // 최근 메시지 기록 (입장 시와 history 명령에 재전송)
+    struct Payload *history[ROOM_HISTORY_MAX]; // 보낸 사람 접두어까지 붙은 메시지 (링 버퍼)
+    int history_head;                          // 다음에 기록할 위치
+    int history_count;                         // 기록된 메시지 수
+    int history_loaded;                        // 디스크의 최근 메시지를 불러오도록 요청했는지 (재시작 후 처음 입장할 때 요청)
+    int history_loading;                       // 저장 스레드가 불러오는 중 (그동안 입장하면 디스크에서 바로 전송)
+    uint64_t seq;                              // 마지막 채팅 메시지 번호 (기록할 때마다 1씩 증가, 재접속 시 놓친 메시지 계산)
+
+    // 지표 관련
+    atomic_ulong msgs_in;  // 채팅방에서 받은 메시지 수
+    atomic_ulong msgs_out; // 채팅방 사용자에게 보낸 메시지 수
+    TokenBucket rate;      // 채팅방 전체 입력 속도 제한 (-C)
+
     // 숫자 야구 게임 관련
     int mode;         // CHAT_MODE or GAME_MODE
     int game_host_fd; // 게임을 시작한 유저의 fd
@@ -69,69 +290,760 @@ typedef struct
     int poll_mode_stage;               // 0: 항목 수 입력 중, 1: 항목 이름 입력 중, 2: 투표 중
     int poll_count;                    // 항목 개수
     int poll_index;                    // 현재 몇 번째 항목 입력 중
-    char *poll_list[MAX_POLL];         // 항목 저장
+    char *poll_list[MAX_POLL];         // 항목 저장 (poll_arena 안을 가리킴)
+    char poll_arena[POLL_ARENA_SIZE];  // 항목 문자열 영역 (투표가 끝나면 사용량만 되돌림)
+    size_t poll_arena_used;
     int poll_votes[MAX_POLL];          // 득표수
     int vote_received[MAX_ROOM_USERS]; // 사용자별 투표 여부
+    time_t poll_deadline;              // 투표(항목 입력 포함)를 자동으로 마감하는 시각
+    Timer poll_timer;                  // 투표 마감 타이머 (채팅방의 reactor에 등록)
+
+    time_t game_active_at;             // 숫자 야구 게임의 마지막 입력 시각
+    Timer game_timer;                  // 진행이 없는 게임 종료 타이머 (채팅방의 reactor에 등록)
 } ChatRoom;
 
+// 한 번 만들어 여러 수신자의 송신 큐가 공유하는 불변 메시지
+typedef struct Payload
+{
+    atomic_int refcnt; // 참조 중인 송신 큐 조각 수 (+ 만든 쪽)
+    uint64_t seq;      // 채팅 메시지 번호 (0이면 번호 없는 안내 등, 소켓에 모두 쓰면 연결의 sent_seq 갱신)
+    size_t len;
+    char data[];
+} Payload;
+
+// 송신 대기 중인 메시지 조각
+typedef struct OutChunk
+{
+    struct OutChunk *next;
+    Payload *payload; // 공유 메시지 (조각이 참조 하나를 가짐, NULL이면 파일 조각)
+    size_t off;       // 이미 전송한 바이트 수
+    int file_fd;      // 파일 조각: 보낼 세그먼트 파일 (조각이 닫음)
+    off_t file_off;   // 파일 조각: 다음에 보낼 파일 위치
+    size_t file_len;  // 파일 조각: 남은 바이트 수 (송신 큐 한도에는 포함하지 않음)
+    int cont;         // 앞 조각과 같은 메시지의 나머지 (송신 큐가 넘쳐도 따로 버리지 않음)
+} OutChunk;
+
+// 연결별 입출력 상태 (fd로 인덱싱)
+typedef struct
+{
+    char *in_buf;   // 아직 처리하지 않은 수신 데이터
+    size_t in_len;  // in_buf에 쌓인 바이트 수
+    size_t in_off;  // 다음 프레임이 시작하는 위치
+    size_t in_cap;  // in_buf 할당 크기
+    int in_skip;    // 최대 길이를 넘은 줄의 나머지를 버리는 중
+    int binary;     // 바이너리 모드 (접속 직후 정해지고 바뀌지 않음, protocol.h)
+
+    pthread_mutex_t out_lock; // 송신 큐 보호 (여러 스레드가 같은 연결로 전송 가능)
+    OutChunk *out_head;       // 다음에 전송할 조각
+    OutChunk *out_tail;       // 마지막에 추가된 조각
+    size_t out_bytes;         // 송신 큐에 남은 바이트 수
+    int lagging;              // OVERFLOW_LAG: 큐가 넘쳐 메시지를 버리는 중
+    int closing;              // 송신 실패 또는 OVERFLOW_DISCONNECT로 종료 예정
+    int flush_pending;        // 모아 보낼 연결 목록에 들어 있음 (out_lock)
+    uint64_t sent_seq;        // 현재 채팅방 메시지 중 소켓에 모두 쓴 마지막 번호 (out_lock, 끊기면 세션에 저장)
+    int catchup_hold;         // 디스크의 지난 메시지를 큐에 넣기 전이라 새 메시지를 held 목록에 모아 둠 (out_lock)
+    OutChunk *held_head;      // 지난 메시지 뒤에 이어 붙일 새 메시지 (out_bytes에는 포함)
+    OutChunk *held_tail;
+
+    int reactor; // 연결을 소유한 reactor 번호 (채팅방 입장 시 채팅방의 reactor로 이전)
+    unsigned long serial; // 연결마다 다른 번호 (fd가 재사용되어도 다른 스레드가 구분할 수 있음)
+    struct in_addr addr;  // 접속한 클라이언트 IP (로그용)
+
+    int handshaking;      // 아직 사용자 이름(또는 재접속 요청)을 기다리는 중 (로비에 등록 전)
+    Timer hs_timer;       // 이름 대기 제한 시간
+    time_t last_input;    // 마지막으로 메시지를 받은 시각 (하트비트 응답 제외)
+    Timer idle_timer;     // 입력이 없는 연결 종료 타이머 (-I)
+
+    int heartbeat;         // 하트비트에 응답하는 클라이언트 (번호 0인 PONG을 받으면 켜짐)
+    unsigned lines_in;     // 텍스트 모드에서 꺼낸 줄 수 (하트비트 시작 요청은 이름 바로 다음 줄에서만 받음)
+    uint32_t ping_seq;     // 마지막으로 보낸 PING 번호
+    uint32_t ping_wait;    // 응답을 기다리는 PING 번호 (0이면 없음)
+    uint64_t ping_sent_ns; // 응답을 기다리는 PING을 보낸 시각
+    int ping_missed;       // 연속으로 응답하지 않은 PING 수
+    uint32_t rtt_us;       // 왕복 시간 EWMA (마이크로초, 0이면 아직 측정 안 됨)
+    uint32_t rtt_max_us;   // 측정한 왕복 시간 중 최대
+    Timer ping_timer;      // 다음 PING 전송 타이머
+
+    TokenBucket line_bucket; // 채팅방 입력 줄 수 (-r)
+    TokenBucket byte_bucket; // 채팅방 입력 바이트 (-R)
+    TokenBucket cmd_bucket;  // 로비 명령 수 (-c)
+    int throttled;           // 속도 제한으로 입력 처리를 미루는 중 (rate_timer가 이어서 처리)
+    time_t rate_notice_at;   // 마지막으로 속도 제한 안내를 보낸 시각
+    Timer rate_timer;        // 미룬 입력 처리 재개 타이머
+} Connection;
+
+// 이벤트 루프 스레드 (연결과 채팅방을 나눠 맡음)
+typedef struct Reactor
+{
+    int id;
+    int epfd;      // 소유한 연결과 리스닝 소켓 감시용 epoll
+    int listen_fd; // reactor별 리스닝 소켓 (SO_REUSEPORT)
+    int notify_fd; // 연결 이전 통지용 eventfd
+    TimerWheel wheel;  // 이 reactor가 맡은 연결과 채팅방의 타이머
+
+    int flush_fd;                // 모아 보내기 창 timerfd (-W, 끄면 -1)
+    pthread_mutex_t flush_lock;  // 모아 보낼 연결 목록 보호
+    int *flush_fds;              // 창이 끝나면 송신 큐를 비울 연결 목록
+    int flush_count;
+    int flush_cap;
+
+    pthread_mutex_t handoff_lock; // 이전 목록 보호
+    int *handoff_fds;             // 다른 reactor에서 넘어온 연결 목록
+    int handoff_count;
+    int handoff_cap;
+    struct StoreOp *store_done;   // 저장 스레드가 처리를 마치고 넘긴 요청 (handoff_lock으로 보호, 최근 요청이 앞)
+} Reactor;
+
+// 스레드별 지표 (해당 스레드만 증가시키고 지표 요청 시 모두 합산)
+typedef struct ThreadStats
+{
+    atomic_ulong msgs_in;      // 받은 메시지(줄) 수
+    atomic_ulong msgs_out;     // 송신 큐에 넣은 메시지 수
+    atomic_ulong bytes_out;    // 송신 큐에 넣은 바이트 수
+    atomic_ulong accepts;      // 수락한 연결 수
+    atomic_ulong lock_waits;   // 다른 스레드가 잡고 있어 기다린 락 획득 수
+    atomic_ulong lock_wait_ns; // 락을 기다린 시간 합계
+    atomic_ulong fanout_count; // 브로드캐스트 횟수
+    atomic_ulong fanout_ns;    // 브로드캐스트 소요 시간 합계
+    atomic_ulong fanout_buckets[FANOUT_BUCKETS + 1];
+    atomic_ulong ping_timeouts; // 하트비트 응답이 없어 끊은 연결 수
+    atomic_ulong rate_deferred; // 속도 제한으로 입력 처리를 미룬 횟수
+    atomic_ulong rate_dropped;  // 속도 제한으로 버린 입력 수
+    atomic_ulong send_calls;    // 클라이언트 소켓에 쓴 시스템 콜 수 (send, sendmsg, writev)
+    atomic_ulong coalesce_flushes; // 모아 보내기 창이 끝나 송신 큐를 비운 연결 수
+    struct ThreadStats *next;  // 등록된 지표 목록
+} ThreadStats;
+
+// 지표 텍스트를 이어 붙이는 버퍼
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} TextBuf;
+
+// 세그먼트 파일의 연속된 구간 (완성된 줄들)
+typedef struct
+{
+    int fd;
+    off_t off;
+    size_t len;
+} StoreRange;
+
+// 저장 스레드가 처리할 요청 (채팅방 슬롯은 재사용되므로 번호로 구분)
+typedef struct StoreOp
+{
+    StoreOpKind kind;
+    uint64_t room_id;
+    int persistent;       // STORE_CREATE: 기본 채팅방 여부
+    Payload *payload;     // STORE_CREATE: 채팅방 제목, STORE_APPEND: 기록할 메시지, STORE_CATCHUP: 보낼 머리말
+    int fd;               // STORE_CATCHUP: 받을 연결
+    unsigned long serial; // STORE_CATCHUP: 요청한 연결의 번호 (그사이 fd가 재사용되었는지 확인)
+    int count;            // STORE_CATCHUP: 보낼 메시지 수
+    int64_t last_seq;     // STORE_CATCHUP: 바이너리 모드 재접속이면 요청 시점의 마지막 메시지 번호 (아니면 -1)
+    int reactor;          // STORE_LOAD, STORE_CATCHUP: 결과를 넘겨받을 reactor (채팅방 또는 연결 담당)
+    Payload **frames;     // STORE_LOAD: 불러온 메시지, STORE_CATCHUP: 번호를 붙인 RES_REPLAY 메시지 (오래된 것부터)
+    int frame_count;
+    StoreRange ranges[STORE_KEEP_SEGMENTS]; // STORE_CATCHUP: 파일 조각으로 보낼 세그먼트 구간
+    int range_count;
+    struct StoreOp *next;
+} StoreOp;
+
+// 저장 스레드가 관리하는 채팅방별 현재 세그먼트 (저장 스레드만 접근)
+typedef struct StoreFile
+{
+    uint64_t room_id;
+    int fd;                       // 현재 세그먼트 (-1: 닫힘)
+    long segment;                 // 현재 세그먼트 번호 (-1: 아직 모름)
+    off_t size;                   // 현재 세그먼트 크기
+    int dirty;                    // 이번 묶음에서 기록해 fsync가 필요함
+    struct StoreFile *next;       // 해시 버킷의 다음 항목
+    struct StoreFile *dirty_next; // fsync할 항목 목록
+} StoreFile;
+
+// 스레드별 로그 버퍼 (쓰는 스레드와 기록 스레드 하나씩만 접근하므로 락이 필요 없음)
+typedef struct LogRing
+{
+    char buf[LOG_RING_SIZE];
+    atomic_size_t head;    // 다음에 쓸 위치 (쓰는 스레드만 증가)
+    atomic_size_t tail;    // 다음에 읽을 위치 (기록 스레드만 증가)
+    atomic_ulong dropped;  // 버퍼가 가득 차 버린 줄 수
+    struct LogRing *next;  // 등록된 로그 버퍼 목록
+
+    time_t stamp_sec;      // 시각 문자열을 만든 시점 (초 단위)
+    char stamp[48];        // "    (YYYY-MM-DD HH:MM:SS)\n" 캐시
+    size_t stamp_len;
+} LogRing;
+
 
 // 전역 변수 선언
 
-ChatRoom chatrooms[MAX_CHATROOMS];
-ClientInfo clients[MAX_CLIENTS];
+// 채팅방 슬롯도 묶음 단위로 할당하므로 회수되어도 주소와 락은 그대로 유지됨
+ChatRoom **room_chunks;  // 슬롯 묶음 배열
+int room_chunk_count = 0;
+int room_free = -1;      // 빈 슬롯 목록의 첫 슬롯
+ChatRoom **room_buckets; // 채팅방 번호 -> 채팅방 해시 테이블
+size_t room_bucket_count = 0;
+uint64_t next_room_id = 0;
+int room_idle_timeout = DEFAULT_ROOM_IDLE_TIMEOUT; // 빈 채팅방 회수 시간 (-i, 0이면 회수 안 함)
+int room_history_size = DEFAULT_ROOM_HISTORY; // 채팅방별 최근 메시지 기록 개수 (-H, 0이면 기록 안 함)
+int room_sweep_fd = -1;  // 빈 채팅방과 만료된 세션 점검 주기 timerfd (0번 reactor가 처리)
+// 락 순서: room_registry_lock -> room->lock -> client_lock -> out_lock
+// (session_lock, 타이머 휠, 플러시 목록 락은 가장 안쪽에서만 잡음)
+// client_lock을 잡은 로비 처리에서 채팅방 목록이나 채팅방에 접근할 때는 client_lock을 먼저 놓음
+pthread_mutex_t room_registry_lock = PTHREAD_MUTEX_INITIALIZER; // 채팅방 목록 보호
+
+// 클라이언트 슬롯은 CLIENT_CHUNK 단위로 할당하므로 늘어나도 기존 슬롯 주소가 바뀌지 않음
+ClientInfo **client_chunks; // 슬롯 묶음 배열
+int client_chunk_count = 0;
+int client_free = -1;       // 빈 슬롯 목록의 첫 슬롯
+int *client_slot_of;        // fd -> 슬롯 번호 (-1: 클라이언트 아님)
+int max_clients;            // 최대 접속자 수 (fd 한도)
 
 int room_count = 0;
 int client_count = 0;
-int server_sock;
-
-pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
 
-// 서버 소켓을 설정하고 바인딩하는 함수
+Reactor *reactors;     // reactor 배열 (0번은 메인 스레드에서 실행)
+int reactor_count = 0; // reactor 수 (-t, 기본값은 CPU 코어 수)
+int listen_backlog = DEFAULT_LISTEN_BACKLOG;       // 리스닝 소켓 대기열 길이 (-b)
+int handshake_timeout = DEFAULT_HANDSHAKE_TIMEOUT; // 사용자 이름 대기 시간 (-w)
+int conn_idle_timeout = DEFAULT_CONN_IDLE_TIMEOUT; // 입력이 없는 연결을 끊는 시간 (-I, 0이면 끊지 않음)
+int poll_timeout = DEFAULT_POLL_TIMEOUT;           // 투표 자동 마감 시간 (-P, 0이면 모두 투표할 때까지)
+int game_timeout = DEFAULT_GAME_TIMEOUT;           // 진행이 없는 게임 종료 시간 (-G, 0이면 끝내지 않음)
+int ping_interval = DEFAULT_PING_INTERVAL;         // 하트비트 간격 (-p, 0이면 보내지 않음)
+int rate_lines = DEFAULT_RATE_LINES;               // 사용자별 채팅방 입력 초당 줄 수 (-r, 0이면 제한 없음)
+int rate_bytes = DEFAULT_RATE_BYTES;               // 사용자별 채팅방 입력 초당 바이트 (-R, 0이면 제한 없음)
+int rate_commands = DEFAULT_RATE_COMMANDS;         // 사용자별 로비 명령 초당 개수 (-c, 0이면 제한 없음)
+int room_rate = DEFAULT_ROOM_RATE;                 // 채팅방 전체 입력 초당 줄 수 (-C, 0이면 제한 없음)
+RatePolicy rate_policy = RATE_DEFER;               // 속도 제한 초과 시 정책 (-f)
+int coalesce_ms = 0;                               // 채팅방 브로드캐스트를 모아 보내는 창 (-W, 0이면 바로 전송)
+size_t coalesce_bytes = DEFAULT_COALESCE_BYTES;    // 창이 끝나기 전에 바로 보내는 송신 큐 크기 (-N)
+
+Connection *conns; // fd로 인덱싱하는 연결 테이블
+atomic_ulong conn_serial_next; // 다음 연결 번호
+int max_conns;     // 연결 테이블 크기 (RLIMIT_NOFILE)
+
+OverflowPolicy overflow_policy = OVERFLOW_DROP_OLDEST;  // 송신 큐 초과 시 정책 (-q)
+size_t out_queue_limit = DEFAULT_OUT_QUEUE_LIMIT;       // 연결별 송신 큐 한도 (-Q)
+
+Payload *me_prefix; // 보낸 사람 본인에게 붙는 "[ME] " 접두어 (서버 종료까지 유지)
+
+pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER; // 클라이언트 목록 보호 (채팅방 락보다 나중에 잡음)
+
+Session *session_buckets[SESSION_BUCKETS]; // 토큰 -> 연결이 끊긴 세션
+int session_count = 0;
+int session_grace = DEFAULT_SESSION_GRACE; // 세션 유지 시간 (-g, 0이면 세션을 만들지 않음)
+pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER; // 세션 목록 보호 (다른 락을 잡은 채 가장 나중에 잡음)
+
+LogLevel log_level = LOG_INFO;   // 출력할 로그 수준 (-l)
+const char *log_path = NULL;     // 로그 파일 경로 (-L, 없으면 stdout)
+int log_fd = STDOUT_FILENO;
+int log_wake_fd = -1;            // 기록 스레드 깨우기용 eventfd
+atomic_int log_sleeping;         // 기록 스레드가 대기 중이면 1
+atomic_int log_stopping;         // 종료 시 남은 로그를 모두 기록하고 끝냄
+_Atomic(LogRing *) log_rings;    // 등록된 스레드별 로그 버퍼 목록
+pthread_t log_tid;
+__thread LogRing *log_ring;      // 현재 스레드의 로그 버퍼
+
+const char *store_dir = NULL;      // 채팅방 메시지 로그 디렉터리 (-D, 없으면 저장 안 함)
+int store_wake_fd = -1;            // 저장 스레드 깨우기용 eventfd
+pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER; // 저장 요청 목록 보호
+StoreOp *store_queue;              // 아직 처리하지 않은 저장 요청 (최근 요청이 앞)
+atomic_int store_stopping;         // 종료 시 남은 요청을 모두 기록하고 끝냄
+pthread_t store_tid;
+StoreFile *store_files[STORE_BUCKETS]; // 채팅방 번호 -> 현재 세그먼트 (저장 스레드만 접근)
+int store_open_count = 0;          // 열려 있는 세그먼트 파일 수
+
+int metrics_port = 0;                // 지표 조회용 포트 (-m, 0이면 사용 안 함)
+_Atomic(ThreadStats *) all_stats;    // 등록된 스레드별 지표 목록
+__thread ThreadStats *thread_stats;  // 현재 스레드의 지표
+__thread PoolList pool_cache[POOL_CLASSES]; // 현재 스레드의 등급별 빈 블록
+PoolDepot pool_depots[POOL_CLASSES] = {[0 ... POOL_CLASSES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+__thread int out_batching;           // 채팅방 브로드캐스트 중 (모아 보내기를 켜면 바로 보내지 않고 송신 큐에 넣음)
+
+// 브로드캐스트 소요 시간 히스토그램 구간 상한 (나노초)
+const unsigned long fanout_bounds_ns[FANOUT_BUCKETS] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 10000000};
+
+// reactor들을 생성하고 각각의 리스닝 소켓을 바인딩하는 함수
 void init_server(char port[]);
 
-// 기본 채팅방 3개를 초기화하고 각각의 스레드를 생성하는 함수
+// reactor 하나의 리스닝 소켓, epoll, 통지용 eventfd 생성
+void init_reactor(Reactor *r, int id, char port[]);
+
+// 기본 채팅방 3개를 초기화하고 reactor에 분배하는 함수
 void default_rooms();
 
-// 로비 상태의 클라이언트를 처리하는 메인 루프 스레드 함수
-void *main_loop();
+// reactor 이벤트 루프 스레드 함수 (로비와 채팅방 연결을 모두 처리)
+void *reactor_thread(void *arg);
+
+// 대기 중인 신규 접속을 모두 수락하고 이름 대기 목록에 등록
+void accept_clients(Reactor *r);
+
+// 이름을 기다리는 연결의 첫 메시지를 처리해 로비에 등록 (등록했으면 1, 더 기다리거나 연결을 닫았으면 0 반환)
+int handshake_input(Reactor *r, int fd, int open);
+
+// 이름 대기 상태로 두고 제한 시간 타이머 등록
+void handshake_add(Reactor *r, int fd);
+
+// 이름 대기 상태와 타이머 해제
+void handshake_remove(int fd);
+
+// 이름을 기다리던 연결을 닫음
+void handshake_drop(int fd);
+
+// 이름 대기 시간이 지난 연결 종료 (타이머 콜백)
+void handshake_expire(Reactor *r, Timer *t, unsigned long serial);
+
+// 입력이 없는 시간이 -I를 넘은 연결 종료 (타이머 콜백)
+void idle_expire(Reactor *r, Timer *t, unsigned long serial);
+
+// 투표 마감 시각이 되면 받은 표로 결과를 알리고 종료 (타이머 콜백)
+void poll_expire(Reactor *r, Timer *t, unsigned long room_id);
+
+// 진행이 없는 숫자 야구 게임 종료 (타이머 콜백)
+void game_expire(Reactor *r, Timer *t, unsigned long room_id);
+
+// PING을 보내고 응답이 계속 없는 연결 종료 (타이머 콜백)
+void ping_expire(Reactor *r, Timer *t, unsigned long serial);
+
+// 속도 제한으로 미룬 입력 처리 재개 (타이머 콜백)
+void rate_expire(Reactor *r, Timer *t, unsigned long serial);
+
+// 하트비트 응답 처리 (번호 0이면 하트비트 시작, 아니면 왕복 시간 갱신)
+void handle_pong(int fd, uint32_t nonce);
+
+// 왕복 시간을 "12.3ms" 형태로 작성 (측정 전이면 "-")
+void format_rtt(char *out, size_t size, uint32_t us);
+
+// 연결 소켓에서 읽을 수 있는 메시지를 모두 처리
+void handle_conn_input(Reactor *r, int fd);
+
+// 입력 버퍼에 쌓인 메시지를 상태에 맞게 처리 (연결이 다른 reactor로 넘어가거나 닫히면 0 반환)
+int process_frames(Reactor *r, int fd);
+
+// 입력 버퍼에 쌓인 채팅방 메시지를 처리 (채팅방에 남아 있으면 1 반환)
+int process_room_frames(ChatRoom *room, int fd);
+
+// 끊어진 연결을 채팅방과 클라이언트 목록에서 제거
+void close_client(int fd);
+
+// 로비 메시지 하나를 클라이언트 상태에 맞게 처리
+void handle_lobby_frame(int i, char *input);
+
+// 로비 메뉴 명령 하나를 처리
+void handle_lobby_message(int i, const char *menu);
+
+// 바이너리 모드 로비 요청 하나를 처리
+void handle_lobby_packet(int i, const char *packet, size_t len);
+
+// STATE_AWAIT_NAME: 새 사용자 이름 입력 처리
+void handle_name_input(int i, const char *name);
+
+// STATE_AWAIT_ROOM_ID: 입장할 채팅방 번호 입력 처리
+void handle_room_id_input(int i, const char *rnum);
+
+// STATE_AWAIT_ROOM_TITLE: 개설할 채팅방 이름 입력 처리
+void handle_room_title_input(int i, const char *cname);
+
+// 클라이언트를 채팅방에 참여시키고 연결을 채팅방의 reactor로 이전 (성공하면 0, 실패하면 오류 코드 반환)
+// resume_seq >= 0이면 재접속으로 보고 그 번호 이후의 메시지만 전송
+int join_room(int i, uint64_t room_id, int64_t resume_seq);
+
+// 사용자가 요청한 채팅방 개설 (client_lock을 잡은 채 호출, 잠시 놓음, 더 개설할 수 없으면 0 반환)
+int open_room(int i, const char *title, uint64_t *room_id);
+
+// 바이너리 모드 사용자들에게 입장을 알리고, 입장한 사용자가 바이너리 모드면 사용자 목록 전송 (room->lock 필요)
+void announce_join(ChatRoom *room, int fd);
+
+// 빈 슬롯에 채팅방 생성 (room_registry_lock 필요, 가득 차면 NULL 반환)
+ChatRoom *create_room(const char *title, int persistent);
+
+// 번호로 채팅방 검색 (room_registry_lock 필요)
+ChatRoom *find_room(uint64_t id);
+
+// 슬롯 번호에 해당하는 채팅방 반환
+ChatRoom *room_at(int slot);
+
+// 채팅방을 목록에서 빼고 슬롯 반환 (room_registry_lock, room->lock 필요)
+void release_room(ChatRoom *room);
+
+// 일정 시간 비어 있던 채팅방 회수
+void sweep_idle_rooms();
+
+// 최근 메시지 기록에 추가 (참조 하나를 가져감, room->lock 필요)
+void history_push(ChatRoom *room, Payload *frame);
+
+// 안내 문구와 최근 메시지 n개를 한 번에 전송 (room->lock 필요)
+void history_send(ChatRoom *room, int fd, Payload *header, int n);
+
+// 재접속한 사용자에게 seq 번호 이후 놓친 메시지 전송 (room->lock 필요)
+void history_resume(ChatRoom *room, int fd, uint64_t seq);
+
+// 바이너리 모드 재접속: 안내는 RES_TEXT로, 최근 메시지 n개는 번호를 붙인 RES_REPLAY로 하나씩 전송 (room->lock 필요)
+void history_replay(ChatRoom *room, int fd, Payload *header, int n);
+
+// 최근 메시지 기록 비우기 (room->lock 필요)
+void history_clear(ChatRoom *room);
+
+// 저장 디렉터리를 만들고 저장 스레드 시작
+void init_store();
+
+// 저장된 채팅방들을 다시 만듦 (room_registry_lock 필요, 다시 만든 채팅방 수 반환)
+int store_restore();
+
+// 채팅방 정보를 디스크에 기록하도록 요청
+void store_create(ChatRoom *room);
+
+// 메시지 한 줄을 채팅방 로그에 추가하도록 요청 (참조는 따로 잡음)
+void store_append(ChatRoom *room, Payload *frame);
+
+// 회수된 채팅방의 로그를 삭제하도록 요청
+void store_drop(uint64_t room_id);
+
+// 지난 메시지 n개를 디스크에서 보내도록 요청 (앞서 요청된 기록이 모두 끝난 뒤 처리되므로 빠지는 메시지가 없음)
+// 큐에 들어갈 때까지 이 연결로 가는 새 메시지는 뒤로 미룸 (room->lock 필요, 이미 처리 중인 요청이 있으면 0 반환)
+// replay면 바이너리 모드 재접속이므로 파일을 읽어 메시지마다 번호를 붙인 RES_REPLAY로 보냄
+int store_catchup(ChatRoom *room, int fd, int n, int replay);
+
+// 세그먼트 파일에서 지난 메시지 구간과 머리말을 찾아 요청에 담음 (저장 스레드에서 호출, 연결은 건드리지 않음)
+void store_read_catchup(StoreOp *op);
+
+// 찾아 둔 지난 메시지를 연결의 송신 큐에 넣고 미뤄 둔 새 메시지를 뒤에 이어 붙임 (연결을 소유한 reactor에서 호출)
+void store_send_catchup(StoreOp *op);
+
+// 세그먼트 구간의 줄마다 메시지를 만듦 (first_seq가 0 이상이면 그 번호부터 붙인 RES_REPLAY로 감쌈)
+// 구간의 fd를 닫고 만든 개수를 count에 기록 (저장 스레드에서 호출)
+Payload **store_read_lines(StoreRange *ranges, int range_count, int64_t first_seq, int *count);
+
+// 마지막 n줄이 들어 있는 세그먼트 구간들을 오래된 것부터 반환 (찾은 줄 수 반환, 구간의 fd는 호출자가 닫음)
+int store_tail_ranges(uint64_t room_id, int n, StoreRange *ranges, int *range_count);
+
+// 저장 요청을 목록에 넣고 필요하면 저장 스레드를 깨움
+void store_enqueue(StoreOp *op);
+
+// 요청을 모아 세그먼트에 기록하고 한 번에 fsync하는 스레드 함수
+void *store_thread(void *arg);
+
+// 종료 시 남은 요청을 모두 기록할 때까지 대기
+void store_shutdown();
+
+// 요청 묶음 하나를 처리 (오래된 요청부터)
+void store_apply(StoreOp *ops);
+
+// 모아 둔 메시지를 세그먼트에 기록하고 fsync할 목록에 추가
+void store_write(StoreFile *f, struct iovec *iov, int count, StoreFile **dirty);
+
+// 채팅방의 세그먼트 파일 항목 검색 (없으면 생성)
+StoreFile *store_file(uint64_t room_id);
+
+// 채팅방의 마지막 세그먼트를 추가 모드로 열기 (끝이 잘린 줄은 잘라냄)
+int store_open_segment(StoreFile *f);
+
+// 현재 세그먼트를 닫고 다음 세그먼트로 넘어감 (오래된 세그먼트 삭제)
+void store_roll(StoreFile *f);
+
+// 채팅방의 세그먼트 번호 목록 (오름차순, 호출자가 free)
+int store_list_segments(uint64_t room_id, long **segments);
+
+// 정렬용 비교 함수
+int cmp_long(const void *a, const void *b);
+int cmp_u64(const void *a, const void *b);
+
+// 재시작 후 처음 입장할 때 최근 메시지를 불러오도록 저장 스레드에 요청 (room->lock 필요)
+void store_load(ChatRoom *room);
+
+// 마지막 세그먼트들에서 최근 메시지를 읽어 요청에 담음 (저장 스레드에서 호출, 세그먼트를 자르는 스레드와 같으므로 mmap이 안전)
+void store_read_history(StoreOp *op);
+
+// 처리를 마친 요청을 결과를 받을 reactor에 넘기고 깨움 (저장 스레드, 또는 연결이 넘어가 다시 넘기는 reactor에서 호출)
+void store_complete(StoreOp *op);
+
+// 저장 스레드가 넘긴 결과를 reactor에서 반영하고 요청 해제 (연결이 다른 reactor로 넘어갔으면 그쪽으로 다시 넘김)
+void store_deliver(Reactor *r, StoreOp *op);
+
+// 불러온 최근 메시지를 채팅방 기록에 반영 (채팅방을 담당하는 reactor에서 호출)
+void store_finish_load(StoreOp *op);
+
+// 불러온 메시지를 기록 앞쪽에 채우고 불러오는 동안 쌓인 메시지를 그 뒤에 둠 (room->lock 필요, 참조를 넘겨받음)
+void history_merge(ChatRoom *room, Payload **frames, int count);
+
+// 채팅방 메시지 하나를 처리 (채팅방에 남아 있으면 1 반환)
+int handle_room_message(ChatRoom *room, int i, char *buffer);
+
+// 바이너리 모드 채팅방 요청 하나를 처리 (채팅방에 남아 있으면 1 반환)
+int handle_room_packet(ChatRoom *room, int i, const char *packet, size_t len);
+
+// 채팅방 명령 처리 (quit, info, history, game, poll을 요청 코드로 받음, 채팅방에 남아 있으면 1 반환)
+int room_command(ChatRoom *room, int i, int op, int arg);
+
+// 명령이 아닌 입력 처리 (게임/투표 진행 중이면 해당 입력, 아니면 채팅 메시지)
+int handle_room_input(ChatRoom *room, int i, char *buffer);
+
+// 연결 테이블 할당
+void init_connections();
+
+// 소켓에서 한 번 읽어 입력 버퍼에 누적 (recv 반환값 그대로 반환)
+int conn_recv(int fd, int flags);
+
+// 소켓에서 읽을 수 있는 데이터를 INPUT_BACKLOG_BYTES까지 누적 (연결이 끊기면 0, 다 읽었으면 1, 소켓에 남겨 두었으면 2 반환)
+int conn_read(int fd);
+
+// 입력 버퍼에서 완성된 한 줄을 꺼냄 (없으면 NULL)
+char *conn_next_frame(int fd);
+
+// 입력 버퍼에서 완성된 바이너리 메시지 본문을 꺼냄 (없으면 NULL, 길이가 잘못되었으면 연결 종료)
+char *conn_next_packet(int fd, size_t *len);
 
-// 채팅방 내 사용자 메시지를 처리하는 스레드 함수
-void *chatroom_thread(void *arg);
+// 입력 버퍼에 꺼낼 수 있는 메시지가 있는지 (꺼내지 않고 확인)
+int conn_frame_ready(int fd);
 
-// 로비에 있는 클라이언트 목록을 로그 출력
-void print_log_lobby();
+// 토큰 버킷을 지난 시간만큼 채우고, 토큰이 하나 이상이면 0, 아니면 기다려야 하는 시간(ms) 반환 (rate가 0이면 제한 없음)
+long bucket_wait(TokenBucket *b, int rate, uint64_t now);
 
-// 특정 채팅방의 유저 목록을 로그 출력
-void print_log_room(ChatRoom *room);
+// 토큰 버킷에서 cost만큼 사용 (rate가 0이면 무시)
+void bucket_take(TokenBucket *b, int rate, double cost);
 
-// 게임 모드 상태를 로그 출력
-void print_log_game(ChatRoom *room);
+// 채팅방 입력 하나를 처리하기 전 사용자별/채팅방 버킷 확인 (기다릴 시간(ms) 반환, 0이면 바로 처리)
+long room_rate_wait(ChatRoom *room, int fd);
 
-// 투표 모드 상태를 로그 출력
-void print_log_poll(ChatRoom *room);
+// 속도 제한에 걸린 입력 처리 (미루기 정책이면 재개 타이머를 걸고 1, 버리기 정책이면 0 반환)
+int rate_limited(int fd, long wait_ms);
 
-// 현재 서버 접속자 수 출력
-void server_state();
+// 첫 입력으로 텍스트/바이너리 모드를 정하고 사용자 이름 또는 재접속 토큰을 꺼냄
+// (이름이면 1, 재접속 요청이면 2와 함께 마지막으로 받은 메시지 번호(없으면 -1), 더 받아야 하면 0, 잘못된 요청이면 -1)
+int conn_handshake(int fd, char *name, size_t size, int64_t *resume_seq);
 
-// 현재 시간을 출력하는 함수
-void print_time();
+// 새 연결의 입출력 상태 초기화
+void conn_open(int fd);
+
+// 연결 종료 시 입출력 버퍼 해제
+void conn_reset(int fd);
+
+// 소켓을 논블로킹 모드로 전환
+int set_nonblocking(int fd);
+
+// 송신 큐를 거쳐 메시지 전송 (블로킹하지 않음)
+void conn_send(int fd, const char *data, size_t len);
+
+// 공유 메시지 조각들을 이어서 전송 (접두어 + 본문 등, 복사하지 않음, 바이너리 모드는 RES_TEXT로 감쌈)
+void conn_send_parts(int fd, Payload **parts, int count);
+
+// 공유 메시지 조각들을 그대로 전송 (바이너리 모드 메시지를 직접 만든 경우)
+void conn_write_parts(int fd, Payload **parts, int count);
+
+// 소켓에 모두 쓴 조각이 채팅 메시지면 연결의 sent_seq 갱신 (out_lock 필요)
+void conn_mark_sent(Connection *conn, Payload *payload);
+
+// 송신 큐 끝에 공유 메시지 조각 추가 (참조 하나를 가져감, 추가한 조각 반환, 실패하면 NULL)
+OutChunk *conn_enqueue(Connection *conn, Payload *payload, size_t off);
+
+// 송신 큐 끝에 파일 구간 추가 (fd를 가져감, out_lock 필요)
+void conn_enqueue_file(Connection *conn, int file_fd, off_t off, size_t len);
+
+// 파일 조각을 sendfile로 전송 (쓸 수 없으면 버퍼로 복사, 보낸 바이트 수 반환)
+ssize_t conn_send_file(int fd, OutChunk *chunk);
+
+// 송신 큐 조각 해제 (메시지 참조 반환, 파일 조각은 파일 닫기)
+void chunk_free(OutChunk *chunk);
+
+// 크기 등급에 맞는 블록 할당 (스레드 캐시 -> 공용 저장소 -> malloc 순, 등급보다 크면 malloc, 실패하면 NULL)
+void *pool_alloc(size_t size);
+
+// pool_alloc으로 받은 블록 반환 (NULL이면 무시)
+void pool_free(void *ptr);
+
+// 블록 크기 변경 (같은 등급 안이면 그대로 두고, 아니면 새 블록으로 내용 복사)
+void *pool_realloc(void *ptr, size_t size);
+
+// 공용 저장소에서 빈 블록을 묶음으로 가져옴
+void pool_refill(size_t cls);
+
+// 스레드 캐시의 빈 블록을 묶음으로 공용 저장소에 넘김 (저장소가 가득 차면 시스템에 반환)
+void pool_spill(size_t cls);
+
+// 채팅방 투표 항목 문자열을 영역에 복사 (MEDIUM_BUFF_SIZE - 1바이트까지, 공간이 없으면 빈 문자열)
+char *poll_arena_strdup(ChatRoom *room, const char *str);
+
+// 공유 메시지 생성 (참조 카운트 1)
+Payload *payload_new(const char *data, size_t len);
+
+// printf 형식으로 공유 메시지 생성
+Payload *payload_printf(const char *fmt, ...);
+
+// 공유 메시지 참조 추가
+Payload *payload_ref(Payload *payload);
+
+// 공유 메시지 참조 해제 (마지막 참조면 메모리 해제)
+void payload_unref(Payload *payload);
+
+// 정수 필드 하나와 문자열 필드 하나로 된 바이너리 메시지 생성 (protocol.h의 proto_build 참고)
+Payload *proto_pack(int op, int64_t id, const char *str, size_t len, size_t extra);
+
+// 바이너리 메시지 하나를 만들어 바로 전송
+void proto_reply(int fd, int op, int64_t id, const char *str);
+
+// 메시지 번호가 붙은 바이너리 채팅 메시지(RES_MSG) 생성
+Payload *proto_pack_msg(int64_t uid, const char *str, uint64_t seq);
+
+// 목록이 들어가는 바이너리 메시지 작성 시작 (proto_finish로 길이를 붙여 공유 메시지로 만듦)
+void proto_begin(TextBuf *tb, int op);
+
+// 작성 중인 바이너리 메시지에 정수/문자열 필드 추가
+void proto_append_varint(TextBuf *tb, uint64_t v);
+void proto_append_str(TextBuf *tb, const char *str);
+
+// 작성한 본문 앞에 길이를 붙여 공유 메시지 생성 (버퍼 해제)
+Payload *proto_finish(TextBuf *tb);
+
+// 송신 큐를 writev로 가능한 만큼 비움 (EPOLLOUT 시 호출)
+void conn_flush(int fd);
+
+// 송신 큐 초과 시 정책에 따라 공간 확보 (새 메시지를 넣을 수 있으면 1 반환)
+int conn_make_room(Connection *conn, int fd, size_t len);
+
+// 송신 큐 전체 해제
+void conn_clear_queue(Connection *conn);
+
+// 연결을 다른 reactor로 넘기고 통지
+void reactor_handoff(int fd, Reactor *target);
+
+// 다른 reactor에서 넘어온 연결의 남은 메시지와 저장 스레드가 넘긴 결과 처리
+void handle_handoffs(Reactor *r);
+
+// 연결을 소유한 reactor의 모아 보낼 목록에 넣고, 창 타이머가 멈춰 있으면 시작
+void coalesce_add(int fd);
+
+// 모아 보내기 창이 끝나면 목록의 연결마다 쌓인 메시지를 writev 한 번으로 전송
+void coalesce_run(Reactor *r);
+
+// 타이머 휠과 틱 timerfd 초기화
+void wheel_init(TimerWheel *w);
+
+// 현재 시각의 타이머 틱 번호
+uint64_t timer_ticks();
+
+// 타이머를 r의 휠에 ms 뒤 만료로 등록 (이미 등록되어 있으면 옮김)
+void timer_set(Reactor *r, Timer *t, long ms, void (*fn)(Reactor *, Timer *, unsigned long), unsigned long arg);
+
+// 등록된 타이머 취소 (등록되지 않았으면 아무것도 하지 않음)
+void timer_cancel(Timer *t);
+
+// 타이머를 만료 틱에 맞는 단계와 칸에 연결 (w->lock 필요)
+void wheel_insert(TimerWheel *w, Timer *t);
+
+// 지난 틱을 따라잡으며 만료된 타이머 호출
+void timer_run(Reactor *r);
+
+// epoll 인스턴스에 fd를 주어진 이벤트로 등록
+void epoll_add_fd(int epfd, int fd, uint32_t events);
+
+// epoll 인스턴스에서 소켓 등록 해제
+void epoll_del_fd(int epfd, int fd);
+
+// 엣지 트리거로 등록된 fd를 다시 감시 (준비된 상태면 다음 epoll_wait에서 이벤트가 다시 옴)
+void epoll_rearm_fd(int epfd, int fd, uint32_t events);
+
+// 로그 출력 대상을 열고 기록 스레드 시작
+void init_logging();
+
+// 스레드별 로그 버퍼를 모아 묶음 단위로 기록하는 스레드 함수
+void *log_writer_thread(void *arg);
+
+// 남은 로그를 모두 기록하고 기록 스레드 종료
+void log_shutdown();
+
+// 현재 스레드의 로그 버퍼 반환 (처음 호출 시 등록)
+LogRing *log_thread_ring();
+
+// 로그 한 줄을 만들어 현재 스레드의 로그 버퍼에 추가 (블로킹하지 않음)
+void log_vwrite(LogLevel level, const char *kind, const char *tag, const char *fmt, va_list ap);
+
+// 태그 없는 로그 출력
+void log_write(LogLevel level, const char *fmt, ...);
+
+// 로비 로그 출력
+void log_lobby(LogLevel level, const char *fmt, ...);
+
+// 채팅방 로그 출력
+void log_room(LogLevel level, ChatRoom *room, const char *fmt, ...);
+
+// 게임 모드 로그 출력
+void log_game(LogLevel level, ChatRoom *room, const char *fmt, ...);
+
+// 투표 모드 로그 출력
+void log_poll(LogLevel level, ChatRoom *room, const char *fmt, ...);
+
+// 현재 서버 접속자 수 로그 출력
+void log_state();
+
+// 현재 스레드의 지표 반환 (처음 호출 시 등록)
+ThreadStats *stats_thread();
+
+// 락을 잡고, 다른 스레드가 잡고 있어 기다렸다면 대기 시간을 기록
+void lock_mutex(pthread_mutex_t *mutex);
+
+// 단조 증가 시각 (나노초)
+uint64_t now_ns();
+
+// 브로드캐스트 소요 시간을 히스토그램에 기록
+void record_fanout(uint64_t elapsed_ns);
+
+// 지표 조회용 리스닝 소켓을 열고 응답 스레드 시작
+void init_metrics();
+
+// 지표 요청을 받아 텍스트로 응답하는 스레드 함수
+void *metrics_thread(void *arg);
+
+// 현재 지표를 Prometheus 텍스트 형식으로 작성 (호출자가 free)
+char *render_metrics(size_t *len);
+
+// 버퍼 끝에 printf 형식으로 추가 (공간이 부족하면 두 배로 확장)
+void text_appendf(TextBuf *tb, const char *fmt, ...);
+
+// 버퍼 끝에 바이트 추가 (공간이 부족하면 두 배로 확장)
+void text_append(TextBuf *tb, const char *data, size_t len);
+
+// 레이블 값에 넣을 수 있도록 \, ", 개행을 이스케이프해서 추가
+void text_append_label(TextBuf *tb, const char *value);
 
 // 클라이언트에게 메인 메뉴 전송
 void send_menu(int client_fd);
 
-// 클라이언트에게 채팅방 목록 전송
+// 클라이언트에게 채팅방 목록 전송 (client_lock을 잡은 채 호출, 목록을 읽는 동안 잠시 놓음)
 void send_room_list(int client_fd);
 
 // 채팅방 정보를 클라이언트에게 전송
 void send_chatroom_info(ChatRoom *room, int idx);
 
-// 파일 디스크립터에 해당하는 클라이언트 인덱스 반환
+// 파일 디스크립터에 해당하는 클라이언트 슬롯 번호 반환 (없으면 -1)
 int find_client_index(int fd);
 
+// 슬롯 번호에 해당하는 클라이언트 정보 반환
+ClientInfo *client_at(int slot);
+
+// 빈 슬롯을 할당해 fd와 연결 (가득 차면 -1 반환)
+int alloc_client(int fd);
+
+// 재접속 토큰 생성 (세션을 유지하지 않으면 0)
+uint64_t session_new_token();
+
+// 연결이 끊긴 클라이언트의 세션을 유지 시간 동안 보관
+void session_save(ClientInfo *client, int in_room, uint64_t room_id, uint64_t seq);
+
+// 토큰에 해당하는 세션을 꺼냄 (없거나 만료되었으면 0 반환)
+int session_take(const char *token, Session *out);
+
+// 유지 시간이 지난 세션 정리
+void session_sweep();
+
+// 클라이언트에게 재접속 토큰 안내
+void send_session(int fd, uint64_t token);
+
 // 채팅방에서 주어진 fd의 사용자 인덱스 반환
 int get_user_index(ChatRoom *room, int fd);
 
-// 클라이언트 배열에서 클라이언트를 제거
+// 클라이언트 연결을 닫고 슬롯을 반환
 void remove_client(int index);
 
 // 채팅방에서 사용자를 제거
@@ -143,6 +1055,9 @@ char *trim(char *str);
 // 문자열을 정수로 안전하게 파싱
 bool parse_valid_int(const char *input, int *result);
 
+// 문자열을 채팅방 번호로 파싱
+bool parse_valid_id(const char *input, uint64_t *result);
+
 // 세 자리 숫자인지 유효성 검사
 int is_valid_number(const char *num);
 
@@ -158,1052 +1073,5259 @@ void start_poll(ChatRoom *room, int host_fd, const char *host_name);
 // 투표 상태 초기화
 void reset_poll_state(ChatRoom *room);
 
+// 모든 사용자가 투표했으면 결과 문자열을 만들고 1 반환
+int tally_poll(ChatRoom *room, char *list, size_t size);
+
+// 지금까지 받은 표로 결과 문자열 작성
+void format_poll_result(ChatRoom *room, char *list, size_t size);
+
 // SIGINT 수신 시 서버 종료 및 자원 해제 처리
 void sigint_handler(int signo);
 
-// 메인 함수
+// 메인 함수 (bench.c가 이 파일을 포함할 때는 제외)
+#ifndef CHAT_BENCH
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    int opt;
+    while ((opt = getopt(argc, argv, "q:Q:t:i:l:L:m:H:D:g:b:w:I:P:G:p:r:R:c:C:f:W:N:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'q': // 송신 큐 초과 정책
+            if (strcmp(optarg, "drop") == 0)
+                overflow_policy = OVERFLOW_DROP_OLDEST;
+            else if (strcmp(optarg, "disconnect") == 0)
+                overflow_policy = OVERFLOW_DISCONNECT;
+            else if (strcmp(optarg, "lag") == 0)
+                overflow_policy = OVERFLOW_LAG;
+            else
+                optind = argc + 1; // 잘못된 값이면 사용법 출력
+            break;
+        case 'Q': // 송신 큐 한도 (바이트)
+            out_queue_limit = strtoul(optarg, NULL, 10);
+            if (out_queue_limit == 0)
+                out_queue_limit = DEFAULT_OUT_QUEUE_LIMIT;
+            break;
+        case 't': // reactor 스레드 수
+            reactor_count = atoi(optarg);
+            if (reactor_count <= 0)
+                optind = argc + 1;
+            break;
+        case 'i': // 빈 채팅방 회수 시간 (초)
+            room_idle_timeout = atoi(optarg);
+            if (room_idle_timeout < 0)
+                optind = argc + 1;
+            break;
+        case 'l': // 로그 수준
+            if (strcmp(optarg, "error") == 0)
+                log_level = LOG_ERROR;
+            else if (strcmp(optarg, "warn") == 0)
+                log_level = LOG_WARN;
+            else if (strcmp(optarg, "info") == 0)
+                log_level = LOG_INFO;
+            else if (strcmp(optarg, "debug") == 0)
+                log_level = LOG_DEBUG;
+            else
+                optind = argc + 1;
+            break;
+        case 'L': // 로그 파일
+            log_path = optarg;
+            break;
+        case 'm': // 지표 조회 포트
+            metrics_port = atoi(optarg);
+            if (metrics_port <= 0 || metrics_port > 65535)
+                optind = argc + 1;
+            break;
+        case 'H': // 채팅방별 최근 메시지 기록 개수
+            room_history_size = atoi(optarg);
+            if (room_history_size < 0 || room_history_size > ROOM_HISTORY_MAX)
+                optind = argc + 1;
+            break;
+        case 'D': // 채팅방 메시지 로그 디렉터리
+            store_dir = optarg;
+            break;
+        case 'b': // 리스닝 소켓 대기열 길이
+            listen_backlog = atoi(optarg);
+            if (listen_backlog <= 0)
+                optind = argc + 1;
+            break;
+        case 'w': // 사용자 이름 대기 시간 (초)
+            handshake_timeout = atoi(optarg);
+            if (handshake_timeout <= 0)
+                optind = argc + 1;
+            break;
+        case 'I': // 입력이 없는 연결을 끊는 시간 (초)
+            conn_idle_timeout = atoi(optarg);
+            if (conn_idle_timeout < 0)
+                optind = argc + 1;
+            break;
+        case 'P': // 투표 자동 마감 시간 (초)
+            poll_timeout = atoi(optarg);
+            if (poll_timeout < 0)
+                optind = argc + 1;
+            break;
+        case 'G': // 진행이 없는 게임 종료 시간 (초)
+            game_timeout = atoi(optarg);
+            if (game_timeout < 0)
+                optind = argc + 1;
+            break;
+        case 'p': // 하트비트 간격 (초)
+            ping_interval = atoi(optarg);
+            if (ping_interval < 0)
+                optind = argc + 1;
+            break;
+        case 'r': // 사용자별 채팅방 입력 초당 줄 수
+            rate_lines = atoi(optarg);
+            if (rate_lines < 0)
+                optind = argc + 1;
+            break;
+        case 'R': // 사용자별 채팅방 입력 초당 바이트
+            rate_bytes = atoi(optarg);
+            if (rate_bytes < 0)
+                optind = argc + 1;
+            break;
+        case 'c': // 사용자별 로비 명령 초당 개수
+            rate_commands = atoi(optarg);
+            if (rate_commands < 0)
+                optind = argc + 1;
+            break;
+        case 'C': // 채팅방 전체 입력 초당 줄 수
+            room_rate = atoi(optarg);
+            if (room_rate < 0)
+                optind = argc + 1;
+            break;
+        case 'f': // 속도 제한 초과 정책
+            if (strcmp(optarg, "defer") == 0)
+                rate_policy = RATE_DEFER;
+            else if (strcmp(optarg, "drop") == 0)
+                rate_policy = RATE_DROP;
+            else
+                optind = argc + 1;
+            break;
+        case 'W': // 채팅방 브로드캐스트를 모아 보내는 창 (ms)
+            coalesce_ms = atoi(optarg);
+            if (coalesce_ms < 0 || coalesce_ms > MAX_COALESCE_MS)
+                optind = argc + 1;
+            break;
+        case 'N': // 창이 끝나기 전에 바로 보내는 송신 큐 크기 (바이트)
+            coalesce_bytes = strtoul(optarg, NULL, 10);
+            if (coalesce_bytes == 0)
+                coalesce_bytes = DEFAULT_COALESCE_BYTES;
+            break;
+        case 'g': // 끊긴 연결의 세션 유지 시간 (초)
+            session_grace = atoi(optarg);
+            if (session_grace < 0)
+                optind = argc + 1;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if (optind != argc - 1)
     {
-        printf(" Usage : %s <port>\n", argv[0]);
+        printf(" Usage : %s [-q drop|disconnect|lag] [-Q queue_bytes] [-t threads] [-i room_idle_sec] [-l error|warn|info|debug] [-L log_file] [-m metrics_port] [-H history_count] [-D store_dir] [-g session_grace_sec] [-b listen_backlog] [-w name_timeout_sec] [-I conn_idle_sec] [-P poll_sec] [-G game_sec] [-p ping_sec] [-r lines_per_sec] [-R bytes_per_sec] [-c commands_per_sec] [-C room_lines_per_sec] [-f defer|drop] [-W coalesce_ms] [-N coalesce_bytes] <port>\n", argv[0]);
         exit(1);
     }
 
+    if (reactor_count == 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        reactor_count = cores > 0 ? (int)cores : 1;
+    }
+
     signal(SIGINT, sigint_handler);
+    signal(SIGPIPE, SIG_IGN); // 끊긴 소켓에 쓰더라도 서버가 종료되지 않도록 함
+    init_logging();
+    init_connections();
+    me_prefix = payload_new("[ME] ", strlen("[ME] "));
+    if (store_dir != NULL)
+        init_store();
     default_rooms();
-    init_server(argv[1]);
+    init_server(argv[optind]);
+    init_metrics();
+
+    // 0번 reactor는 메인 스레드에서, 나머지는 별도 스레드에서 실행
+    for (int i = 1; i < reactor_count; i++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, reactor_thread, (void *)&reactors[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(tid);
+    }
 
-    main_loop(NULL);
+    reactor_thread(&reactors[0]);
 
     return EXIT_SUCCESS;
 }
+#endif
 
 
 void init_server(char port[])
+{
+    reactors = calloc(reactor_count, sizeof(Reactor));
+    if (reactors == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < reactor_count; i++)
+        init_reactor(&reactors[i], i, port);
+
+    // 빈 채팅방 점검은 회수 시간의 절반마다, 세션 정리는 유지 시간마다 0번 reactor에서 수행
+    if (room_idle_timeout > 0 || session_grace > 0)
+    {
+        int interval = room_idle_timeout > 1 ? room_idle_timeout / 2 : 1;
+        if (session_grace > 0 && (room_idle_timeout == 0 || session_grace < interval))
+            interval = session_grace;
+
+        room_sweep_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (room_sweep_fd < 0)
+        {
+            perror("timerfd_create");
+            exit(EXIT_FAILURE);
+        }
+
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = interval;
+        its.it_interval = its.it_value;
+        timerfd_settime(room_sweep_fd, 0, &its, NULL);
+        epoll_add_fd(reactors[0].epfd, room_sweep_fd, EPOLLIN);
+    }
+
+    // 서버 초기 정보 출력
+    system("clear");
+    printf("<<<< Chat server >>>>\n");
+    printf("Server Port : %s\n", port);
+    printf("Max Client : %d\n", max_clients);
+    printf("Reactor Threads : %d\n", reactor_count);
+    printf(" <<<<          Log         >>>>\n\n");
+    fflush(stdout); // 이후 로그는 기록 스레드가 직접 씀
+}
+
+void init_reactor(Reactor *r, int id, char port[])
 {
     struct sockaddr_in serv_addr;
+    int opt = 1;
+
+    r->id = id;
+    pthread_mutex_init(&r->handoff_lock, NULL);
 
-    // 서버 소켓 생성
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    // reactor마다 같은 포트에 리스닝 소켓을 열고 커널이 접속을 나눠 줌 (SO_REUSEPORT)
+    // 대기 중인 접속을 EAGAIN까지 모두 받을 수 있도록 논블로킹으로 엶
+    r->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (r->listen_fd < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    setsockopt(r->listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (setsockopt(r->listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        perror("setsockopt");
+        close(r->listen_fd);
+        exit(EXIT_FAILURE);
+    }
 
     // 주소 정보 설정
+    memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
     serv_addr.sin_port = htons(atoi(port));
 
-    if (server_sock < 0)
-    {
-        perror("socket");
-        exit(EXIT_FAILURE);
-    }
- 
     // 소켓에 주소 바인딩
-    if (bind(server_sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    if (bind(r->listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
     {
         perror("bind");
-        close(server_sock);
+        close(r->listen_fd);
         exit(EXIT_FAILURE);
     }
-    
+
     // 클라이언트 연결 대기 시작
-    if (listen(server_sock, 10) < 0)
+    if (listen(r->listen_fd, listen_backlog) < 0)
     {
         perror("listen");
-        close(server_sock);
+        close(r->listen_fd);
         exit(EXIT_FAILURE);
     }
 
-    // 서버 초기 정보 출력
-    system("clear");
-    printf("<<<< Chat server >>>>\n");
-    printf("Server Port : %s\n", port);
-    printf("Max Client : %d\n", MAX_CLIENTS);
-    printf(" <<<<          Log         >>>>\n\n");
+    // reactor epoll 생성 후 리스닝 소켓 등록 (accept는 레벨 트리거로 처리)
+    r->epfd = epoll_create1(0);
+    if (r->epfd < 0)
+    {
+        perror("epoll_create1");
+        close(r->listen_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = r->listen_fd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listen_fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        close(r->listen_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // 다른 reactor에서 넘어온 연결을 처리하기 위한 통지 채널
+    r->notify_fd = eventfd(0, EFD_NONBLOCK);
+    if (r->notify_fd < 0)
+    {
+        perror("eventfd");
+        close(r->listen_fd);
+        exit(EXIT_FAILURE);
+    }
+    epoll_add_fd(r->epfd, r->notify_fd, EPOLLIN | EPOLLET);
+
+    // 타이머 휠 (등록된 타이머가 있을 때만 틱마다 깨어남)
+    wheel_init(&r->wheel);
+    epoll_add_fd(r->epfd, r->wheel.fd, EPOLLIN);
+
+    // 모아 보내기 창 (타이머 휠보다 짧은 ms 단위라 따로 둠, 쌓인 메시지가 있을 때만 한 번씩 울림)
+    pthread_mutex_init(&r->flush_lock, NULL);
+    r->flush_fd = -1;
+    if (coalesce_ms > 0)
+    {
+        r->flush_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (r->flush_fd < 0)
+        {
+            perror("timerfd_create");
+            exit(EXIT_FAILURE);
+        }
+        epoll_add_fd(r->epfd, r->flush_fd, EPOLLIN);
+    }
 }
 
 
 void default_rooms()
 {
-    for (int i = 0; i < 3; i++)
-    {
-        // 채팅방 락 초기화
-        pthread_mutex_init(&chatrooms[i].lock, NULL);
+    char title[MEDIUM_BUFF_SIZE];
 
-        // 채팅방 관리 스레드 생성
-        pthread_mutex_lock(&chatrooms[i].lock);
-        chatrooms[i].id = i;
-        snprintf(chatrooms[i].title, sizeof(chatrooms[i].title), "Chatroom-%d", i);
-        chatrooms[i].user_count = 0;
-        chatrooms[i].mode = CHAT_MODE;
-        chatrooms[i].game_host_fd = -1;
-        memset(chatrooms[i].game_answer, 0, sizeof(chatrooms[i].game_answer));
-        pthread_mutex_unlock(&chatrooms[i].lock);
+    lock_mutex(&room_registry_lock);
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, chatroom_thread, (void *)&chatrooms[i]) != 0)
+    // 저장된 채팅방이 있으면 그대로 다시 만들고 기본 채팅방은 새로 만들지 않음
+    if (store_dir != NULL && store_restore() > 0)
+    {
+        log_write(LOG_INFO, "[STORE] 저장된 채팅방 %d개를 불러왔습니다.", room_count);
+        pthread_mutex_unlock(&room_registry_lock);
+        return;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(title, sizeof(title), "Chatroom-%d", i);
+        ChatRoom *room = create_room(title, 1);
+        if (room == NULL)
         {
-            perror("pthread_create");
-            pthread_mutex_lock(&chatrooms[i].lock);
-            chatrooms[i].title[0] = '\0';
-            chatrooms[i].user_count = 0;
-            chatrooms[i].mode = CHAT_MODE;
-            chatrooms[i].game_host_fd = -1;
-            pthread_mutex_unlock(&chatrooms[i].lock);
-            continue;
+            perror("create_room");
+            exit(EXIT_FAILURE);
         }
-        pthread_detach(tid); // 쓰레드 리소스 자동 반환
-        room_count++;
+        store_create(room);
     }
+    pthread_mutex_unlock(&room_registry_lock);
 }
 
-void *main_loop()
+void *reactor_thread(void *arg)
 {
-    fd_set read_fds;
-    char buffer[MEDIUM_BUFF_SIZE];
+    Reactor *r = (Reactor *)arg;
+    struct epoll_event events[MAX_EVENTS];
 
     while (1)
     {
-        FD_ZERO(&read_fds);
-        FD_SET(server_sock, &read_fds);
-        int max_fd = server_sock;
-        
-        // 현재 접속한 클라이언트들의 소켓을 select 대상으로 등록
-        pthread_mutex_lock(&client_lock);
-        for (int i = 0; i < client_count; i++)
+        // 등록된 소켓 중 이벤트가 발생한 것만 돌려받음
+        int nfds = epoll_wait(r->epfd, events, MAX_EVENTS, -1);
+        if (nfds < 0)
+        {
+            if (errno != EINTR)
+                perror("epoll_wait");
+            continue;
+        }
+
+        for (int e = 0; e < nfds; e++)
         {
-            FD_SET(clients[i].fd, &read_fds);
-            if (clients[i].fd > max_fd)
+            int fd = events[e].data.fd;
+
+            // 신규 클라이언트 접속 처리
+            if (fd == r->listen_fd)
+            {
+                accept_clients(r);
+                continue;
+            }
+
+            // 타이머 휠의 틱 (이름 대기, 입력 없는 연결, 투표 마감, 게임 종료)
+            if (fd == r->wheel.fd)
+            {
+                timer_run(r);
+                continue;
+            }
+
+            // 다른 reactor에서 넘어온 연결의 입력 버퍼에 남은 메시지 처리
+            if (fd == r->notify_fd)
+            {
+                handle_handoffs(r);
+                continue;
+            }
+
+            // 모아 보내기 창이 끝난 연결의 송신 큐 전송
+            if (fd == r->flush_fd)
+            {
+                coalesce_run(r);
+                continue;
+            }
+
+            // 비어 있는 채팅방 회수와 만료된 세션 정리 주기
+            if (fd == room_sweep_fd)
             {
-                max_fd = clients[i].fd;
+                sweep_idle_rooms();
+                session_sweep();
+                continue;
             }
+
+            // 소켓 송신 버퍼에 여유가 생기면 송신 큐를 비움
+            if (events[e].events & EPOLLOUT)
+                conn_flush(fd);
+            if (!(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                continue;
+
+            // 클라이언트 메시지 처리 (로비/채팅방 모두)
+            handle_conn_input(r, fd);
         }
-        pthread_mutex_unlock(&client_lock);
+    }
+    return NULL;
+}
 
-        
-        if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0)
+void accept_clients(Reactor *r)
+{
+    // 접속이 몰려도 한 번의 이벤트에서 대기 중인 접속을 모두 받음 (리스닝 소켓은 논블로킹)
+    while (1)
+    {
+        struct sockaddr_in cli_addr;
+        socklen_t cli_len = sizeof(cli_addr);
+        int cli_fd = accept4(r->listen_fd, (struct sockaddr *)&cli_addr, &cli_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cli_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // EAGAIN이면 다 받은 것이고, fd 부족(EMFILE 등)은 다음 이벤트에서 다시 시도
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_write(LOG_WARN, "[WARN] accept 실패: %s", strerror(errno));
+            return;
+        }
+        atomic_fetch_add_explicit(&stats_thread()->accepts, 1, memory_order_relaxed);
+        if (cli_fd >= max_conns)
         {
-            perror("select");
+            close(cli_fd);
             continue;
         }
+        conn_open(cli_fd);
+        conns[cli_fd].reactor = r->id;
+        conns[cli_fd].addr = cli_addr.sin_addr;
 
-        // 신규 클라이언트 접속 처리
-        if (FD_ISSET(server_sock, &read_fds))
-        {
-            struct sockaddr_in cli_addr;
-            socklen_t cli_len = sizeof(cli_addr);
-            int cli_fd = accept(server_sock, (struct sockaddr *)&cli_addr, &cli_len);
-            if (cli_fd >= 0)
-            {
-                memset(buffer, 0, sizeof(buffer));
-                int n = recv(cli_fd, buffer, sizeof(buffer) - 1, 0);
-                if (n < 0)
-                {
-                    perror("recv");
-                    continue;
-                }
-                if (n == 0)
-                {
-                    print_log_lobby();
-                    printf("연결 종료됨 (%d)", cli_fd);
-                    print_time();
-                    close(cli_fd);
-                    server_state();
-                    print_time();
-                    continue;
-                }
+        // 이름이 도착할 때까지 다른 연결을 막지 않도록 대기 목록에 넣고 이벤트로 이어서 받음
+        handshake_add(r, cli_fd);
+        epoll_add_fd(r->epfd, cli_fd, CONN_EVENTS);
 
-                buffer[strcspn(buffer, "\r\n")] = 0;
-                char *name = trim(buffer);
+        // 엣지 트리거이므로 접속과 함께 도착한 이름은 바로 읽어 둠
+        handle_conn_input(r, cli_fd);
+    }
+}
 
-                pthread_mutex_lock(&client_lock);
-                if (client_count < MAX_CLIENTS)
-                {
-                    int idx = client_count;
-                    clients[idx].fd = cli_fd;
-                    if (strlen(name) == 0)
-                        snprintf(clients[idx].user_name, sizeof(clients[idx].user_name), "User%d", idx + 1);
-                    else
-                        snprintf(clients[idx].user_name, sizeof(clients[idx].user_name), "%s", name);
-                    clients[idx].state = STATE_LOBBY;
-                    clients[idx].room_id = -1;
-                    client_count++;
-
-                    print_log_lobby();
-                    printf("새로운 사용자 %s 접속 - Connceted client IP : %s ", clients[idx].user_name, inet_ntoa(cli_addr.sin_addr));
-                    print_time();
-                    server_state();
-                    print_time();
-
-                    send_menu(cli_fd);
-                }
-                else
-                {
-                    const char *msg = "서버에 인원이 가득 찼습니다.\n";
-                    send(cli_fd, msg, strlen(msg), 0);
-                    close(cli_fd);
-                }
+int handshake_input(Reactor *r, int fd, int open)
+{
+    char name_buf[SMALL_BUFF_SIZE];
+
+    // 사용자 이름(텍스트 모드의 첫 줄 또는 바이너리 모드의 REQ_HELLO)이나 재접속 요청이 완성될 때까지 대기
+    int64_t resume_seq = -1;
+    int ready = conn_handshake(fd, name_buf, sizeof(name_buf), &resume_seq);
+    if (ready == 0)
+    {
+        if (open)
+            return 0;
+        log_lobby(LOG_INFO, "연결 종료됨 (%d)", fd);
+        handshake_drop(fd);
+        return 0;
+    }
+    if (ready < 0)
+    {
+        log_lobby(LOG_WARN, "잘못된 바이너리 모드 요청으로 연결 종료 (%d)", fd);
+        handshake_drop(fd);
+        return 0;
+    }
+    handshake_remove(fd);
+    char *name = trim(name_buf);
+
+    // 재접속 요청이면 보관된 세션의 이름과 채팅방을 이어받음 (없으면 새 사용자로 접속)
+    Session session;
+    int resumed = 0;
+    if (ready == 2)
+    {
+        resumed = session_take(name, &session);
+        name = resumed ? session.user_name : "";
+    }
 
-                pthread_mutex_unlock(&client_lock);
+    int accepted = 0;
+    lock_mutex(&client_lock);
+    int slot = alloc_client(fd);
+    if (slot != -1)
+    {
+        ClientInfo *client = client_at(slot);
+        if (strlen(name) == 0)
+            snprintf(client->user_name, sizeof(client->user_name), "User%d", slot + 1);
+        else
+            snprintf(client->user_name, sizeof(client->user_name), "%s", name);
+        // 재접속해도 새 토큰을 발급해 한 번 새어 나간 토큰으로 이후의 세션까지 가로챌 수 없게 함
+        client->token = session_new_token();
+
+        // 입력이 없는 연결 종료 (채팅방으로 돌아가며 다른 reactor로 넘어가면 타이머도 함께 옮겨짐)
+        conns[fd].last_input = time(NULL);
+        if (conn_idle_timeout > 0)
+            timer_set(r, &conns[fd].idle_timer, conn_idle_timeout * 1000L, idle_expire, conns[fd].serial);
+
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &conns[fd].addr, ip, sizeof(ip));
+        log_lobby(LOG_INFO, "%s 사용자 %s 접속%s - Connceted client IP : %s ", resumed ? "재접속한" : "새로운", client->user_name,
+                  conns[fd].binary ? " (바이너리 모드)" : "", ip);
+        log_state();
+
+        // 세션을 찾지 못한 재접속은 새 사용자로 받고 그 사실을 먼저 알림
+        if (ready == 2 && !resumed)
+        {
+            if (conns[fd].binary)
+                proto_reply(fd, RES_ERROR, PROTO_ERR_NO_SESSION, NULL);
+            else
+            {
+                const char *msg = "[NOTICE] 세션이 만료되어 새로 접속합니다.\n";
+                conn_send(fd, msg, strlen(msg));
             }
         }
 
-        // 클라이언트 명령 처리
-        pthread_mutex_lock(&client_lock);
-        for (int i = 0; i < client_count; i++)
+        // 바이너리 모드는 메뉴 대신 사용자 번호를 알려줌
+        if (conns[fd].binary)
+            proto_reply(fd, RES_WELCOME, slot, client->user_name);
+        send_session(fd, client->token);
+
+        // 끊기기 전에 있던 채팅방으로 돌아가고 놓친 메시지를 받음 (채팅방이 사라졌으면 로비에 남음)
+        int rejoined = 0;
+        if (resumed && session.in_room)
         {
-            int fd = clients[i].fd;
-            char *user_name = clients[i].user_name;
-            if (FD_ISSET(fd, &read_fds))
+            int err = join_room(slot, session.room_id, resume_seq >= 0 ? resume_seq : (int64_t)session.seq);
+            if (err == 0)
+                rejoined = 1;
+            else if (conns[fd].binary)
+                proto_reply(fd, RES_ERROR, err, NULL);
+            else
             {
-                // 로비 상태 클라이언트만 처리
-                if (clients[i].state == STATE_LOBBY)
-                {
-                    memset(buffer, 0, sizeof(buffer));
-                    int n = recv(fd, buffer, sizeof(buffer) - 1, 0);
-                    if (n < 0)
-                    {
-                        perror("recv");
-                        continue;
-                    }
-                    if (n == 0)
-                    {
-                        print_log_lobby();
-                        printf("사용자 %s - 접속이 끊어졌습니다.", user_name);
-                        remove_client(i);
-                        i--;
-                        server_state();
-                        print_time();
-                        continue;
-                    }
+                const char *msg = "[NOTICE] 이전 채팅방에 다시 입장할 수 없어 로비로 접속합니다.\n";
+                conn_send(fd, msg, strlen(msg));
+            }
+        }
+        if (!rejoined && !conns[fd].binary)
+            send_menu(fd);
+        accepted = 1;
+    }
+    else if (conns[fd].binary)
+    {
+        char msg[PROTO_HEAD_MAX];
+        send(fd, msg, proto_build(msg, RES_ERROR, PROTO_ERR_SERVER_FULL, NULL, 0, 0), MSG_DONTWAIT);
+        conn_reset(fd);
+        close(fd);
+    }
+    else
+    {
+        const char *msg = "서버에 인원이 가득 찼습니다.\n";
+        send(fd, msg, strlen(msg), MSG_DONTWAIT);
+        conn_reset(fd);
+        close(fd);
+    }
+    pthread_mutex_unlock(&client_lock);
+    return accepted;
+}
 
-                    buffer[strcspn(buffer, "\r\n")] = 0;
-                    const char *menu = trim(buffer);
+void handshake_add(Reactor *r, int fd)
+{
+    conns[fd].handshaking = 1;
+    timer_set(r, &conns[fd].hs_timer, handshake_timeout * 1000L, handshake_expire, conns[fd].serial);
+}
 
-                    if (strlen(menu) == 0)
-                    {
-                        const char *msg = " 메뉴를 비워둘 수 없습니다.\n";
-                        send(fd, msg, strlen(msg), 0);
-                        send_menu(fd);
-                        continue;
-                    }
+void handshake_remove(int fd)
+{
+    conns[fd].handshaking = 0;
+    timer_cancel(&conns[fd].hs_timer);
+}
 
+void handshake_drop(int fd)
+{
+    handshake_remove(fd);
+    conn_reset(fd);
+    close(fd);
+}
 
+void handshake_expire(Reactor *r, Timer *t, unsigned long serial)
+{
+    Connection *conn = (Connection *)((char *)t - offsetof(Connection, hs_timer));
+    int fd = conn - conns;
 
-                    if (strcmp(menu, "0") == 0)
-                    { // 메뉴 재전송
-                        send_menu(fd);
-                    }
-                    else if (strcmp(menu, "1") == 0)
-                    { // 사용자 이름 변경 처리
-                        print_log_lobby();
-                        printf("사용자 %s - 메뉴1 선택", user_name);
-                        print_time();
-
-                        int done = 0;
-
-                        while (!done)
-                        {
-                            const char *msg = "새로운 이름을 입력하세요.\n";
-                            send(fd, msg, strlen(msg), 0);
-
-                            memset(buffer, 0, sizeof(buffer));
-                            int n = recv(fd, buffer, sizeof(buffer) - 1, 0);
-                            if (n <= 0)
-                            {
-                                print_log_lobby();
-                                printf("사용자 %s - 접속이 끊어졌습니다.", user_name);
-                                print_time();
-                                remove_client(i);
-                                i--;
-                                server_state();
-                                print_time();
-                                continue;
-                            }
-
-                            buffer[strcspn(buffer, "\r\n")] = 0;
-                            char *name = trim(buffer);
-
-                            if (strlen(name) == 0)
-                            {
-                                const char *msg = "이름은 비워둘 수 없습니다. 다시 입력해주세요.\n";
-                                send(fd, msg, strlen(msg), 0);
-                                continue;
-                            }
-
-                            // 이름 저장
-                            snprintf(clients[i].user_name, sizeof(clients[i].user_name), "%.31s", name);
-                            send(fd, "이름이 성공적으로 변경되었습니다.\n", strlen("이름이 성공적으로 변경되었습니다."), 0);
-                            print_log_lobby();
-                            printf("사용자 %.31s로 변경", user_name);
-                            print_time();
-                            done = 1;
-                        }
-
-                        send_menu(fd);
-                    }
-                    else if (strcmp(menu, "2") == 0)
-                    { // 채팅방 입장 처리
-
-                        print_log_lobby();
-                        printf("사용자 %s - 메뉴2 선택", user_name);
-                        print_time();
-
-                        if (clients[i].state != STATE_LOBBY)
-                        {
-                            const char *msg = "<WARN!> 현재 상태에서는 채팅방에 입장할 수 없습니다.\n";
-                            send(fd, msg, strlen(msg), 0);
-                            send_menu(fd);
-                            continue;
-                        }
-                        int done = 0;
-                        while (!done)
-                        {
-                            send_room_list(fd);
-
-                            memset(buffer, 0, sizeof(buffer));
-                            int n = recv(fd, buffer, sizeof(buffer) - 1, 0);
-
-                            if (n <= 0)
-                            {
-                                print_log_lobby();
-                                printf("사용자 %s - 접속이 끊어졌습니다.", user_name);
-                                print_time();
-                                remove_client(i);
-                                i--;
-                                server_state();
-                                print_time();
-                                continue;
-                            }
-
-                            buffer[strcspn(buffer, "\r\n")] = 0;
-                            char *rnum = trim(buffer);
-
-                            if (strlen(rnum) == 0)
-                            {
-                                const char *msg = "입장할 채팅방 번호를 입력하세요.\n";
-                                send(fd, msg, strlen(msg), 0);
-                                continue;
-                            }
-
-                            if (strcasecmp(rnum, "b") == 0)
-                            {
-                                send_menu(fd);
-                                print_log_lobby();
-                                done = 1;
-                                continue;
-                            }
-
-                            int room_id;
-
-                            if (!parse_valid_int(rnum, &room_id))
-                            {
-                                const char *msg = "유효한 숫자를 입력해주세요.\n";
-                                send(fd, msg, strlen(msg), 0);
-                                continue;
-                            }
-
-                            if (room_id >= 0 && room_id < room_count)
-                            {
-                                pthread_mutex_lock(&chatrooms[room_id].lock);
-                                if (chatrooms[room_id].user_count < MAX_ROOM_USERS)
-                                {
-                                    chatrooms[room_id].user_fds[chatrooms[room_id].user_count++] = fd;
-                                    clients[i].state = STATE_IN_CHATROOM;
-                                    clients[i].room_id = room_id;
-                                    pthread_mutex_unlock(&chatrooms[room_id].lock);
-
-                                    print_log_lobby();
-                                    printf("사용자 %s - 채팅방 %d에 참여합니다.", user_name, room_id);
-                                    print_time();
-
-                                    char msg[MEDIUM_LARGE_BUFF_SIZE];
-                                    snprintf(msg, sizeof(msg), "채팅방 %s (%d)에 입장했습니다.\n", chatrooms[room_id].title, room_id);
-                                    send(fd, msg, strlen(msg), 0);
-
-                                    done = 1;
-                                }
-                                else
-                                {
-                                    pthread_mutex_unlock(&chatrooms[room_id].lock);
-                                    const char *msg = "해당 채팅방은 인원이 가득 찼습니다.\n";
-                                    send(fd, msg, strlen(msg), 0);
-                                }
-                            }
-                            else
-                            {
-                                const char *msg = "존재하지 않는 채팅방입니다.\n";
-                                send(fd, msg, strlen(msg), 0);
-                            }
-                        }
-                    }
+    // 그사이 이름이 도착했거나 같은 fd가 다른 접속에 재사용되었으면 무시
+    if (conn->serial != serial || !conn->handshaking || conn->reactor != r->id)
+        return;
+    log_lobby(LOG_INFO, "이름을 보내지 않아 연결 종료 (%d)", fd);
+    handshake_drop(fd);
+}
 
-                    else if (strcmp(menu, "3") == 0)
-                    { // 채팅방 개설 처리
-                        print_log_lobby();
-                        printf("사용자 %s - 메뉴3 선택", user_name);
-                        print_time();
-
-                        int done = 0;
-                        char *cname;
-                        while (!done)
-                        {
-                            if (room_count >= MAX_CHATROOMS)
-                            {
-                                const char *msg = "더 이상 채팅방을 개설할 수 없습니다.\n";
-                                send(fd, msg, strlen(msg), 0);
-                                send_menu(fd);
-                                done = 1;
-                            }
-
-                            const char *msg = "개설할 채팅방 이름을 입력하세요.\n";
-                            send(fd, msg, strlen(msg), 0);
-                            memset(buffer, 0, sizeof(buffer));
-
-                            int n = recv(fd, buffer, sizeof(buffer) - 1, 0);
-                            if (n <= 0)
-                            {
-                                print_log_lobby();
-                                printf("사용자 %s - 접속이 끊어졌습니다.", user_name);
-                                print_time();
-                                remove_client(i);
-                                i--;
-                                server_state();
-                                print_time();
-                                continue;
-                            }
-
-                            buffer[strcspn(buffer, "\r\n")] = 0;
-                            cname = trim(buffer);
-
-                            if (strlen(cname) == 0)
-                            {
-                                const char *msg = "채팅방 이름은 비워둘 수 없습니다.\n";
-                                send(fd, msg, strlen(msg), 0);
-                                send_menu(fd);
-                                continue;
-                            }
-                            done = 1;
-                        }
-                       
-                        for (int j = 0; j < MAX_CHATROOMS; j++)
-                        {
-                            if (chatrooms[j].title[0] == '\0')
-                            {
-                                pthread_mutex_lock(&chatrooms[j].lock);
-                                chatrooms[j].id = j;
-                                snprintf(chatrooms[j].title, MEDIUM_BUFF_SIZE, "%.31s", cname);
-                                chatrooms[j].user_count = 0;
-                                chatrooms[j].mode = CHAT_MODE;
-                                chatrooms[j].game_host_fd = -1;
-                                memset(chatrooms[j].game_answer, 0, sizeof(chatrooms[j].game_answer));
-                                pthread_mutex_unlock(&chatrooms[j].lock);
-
-                                pthread_t tid;
-                                if (pthread_create(&tid, NULL, chatroom_thread, (void *)&chatrooms[j]) != 0)
-                                {
-                                    perror("pthread_create");
-                                    pthread_mutex_lock(&chatrooms[j].lock);
-                                    chatrooms[j].title[0] = '\0'; // 방 비활성화 표시
-                                    chatrooms[j].user_count = 0;
-                                    chatrooms[j].mode = CHAT_MODE;
-                                    chatrooms[j].game_host_fd = -1;
-                                    pthread_mutex_unlock(&chatrooms[j].lock);
-                                    continue;
-                                }
-                                pthread_detach(tid);
-
-                                char msg[MEDIUM_BUFF_SIZE];
-                                snprintf(msg, sizeof(msg), "채팅방 %.31s이 개설되었습니다.", cname);
-
-                                send(fd, msg, strlen(msg), 0);
-                                print_log_lobby();
-                                printf("사용자 %s - 채팅방 %.31s 개설", user_name, cname);
-                                print_time();
-                                room_count++;
-                                break;
-                            }
-                        }
-
-                        send_menu(fd);
-                    }
-                    else if (strcmp(menu, "4") == 0)
-                    { // 접속 종료
-
-                        print_log_lobby();
-                        printf("사용자 %s - 메뉴4 선택", user_name);
-                        print_time();
-
-                        print_log_lobby();
-                        printf("사용자 %s - 접속을 헤제합니다.", user_name);
-                        print_time();
-                        remove_client(i);
-                        i--;
-                        server_state();
-                        print_time();
-                    }
-                    else
-                    {
-                        const char *msg = "잘못된 명령입니다.\n";
-                        send(fd, msg, strlen(msg), 0);
-                    }
-                }
-                else
-                { // 예외 상황: 채팅방 클라이언트가 로비 루프로 메시지 전송
-                    printf("<Warn!> 채팅방 클라이언트가 main_loop로 메시지 보냄 : %d", fd);
-                    print_time();
-                }
-            }
+void idle_expire(Reactor *r, Timer *t, unsigned long serial)
+{
+    Connection *conn = (Connection *)((char *)t - offsetof(Connection, idle_timer));
+    int fd = conn - conns;
+    if (conn->serial != serial || conn->reactor != r->id || conn_idle_timeout == 0)
+        return;
+
+    // 입력이 올 때마다 타이머를 옮기지 않고, 만료될 때 마지막 입력 시각을 보고 남은 시간만큼 다시 등록
+    time_t idle = time(NULL) - conn->last_input;
+    if (idle < conn_idle_timeout)
+    {
+        timer_set(r, t, (conn_idle_timeout - idle) * 1000L, idle_expire, serial);
+        return;
+    }
+
+    log_write(LOG_INFO, "[INFO] %ld초 동안 입력이 없어 연결 종료 (%d)", (long)idle, fd);
+    const char *msg = "[NOTICE] 입력이 없어 연결을 종료합니다.\n";
+    conn_send(fd, msg, strlen(msg));
+    close_client(fd);
+}
+
+void ping_expire(Reactor *r, Timer *t, unsigned long serial)
+{
+    Connection *conn = (Connection *)((char *)t - offsetof(Connection, ping_timer));
+    int fd = conn - conns;
+    if (conn->serial != serial || conn->reactor != r->id || !conn->heartbeat)
+        return;
+
+    // 응답이 없는 PING은 번호를 바꿔 다시 보내고, 연속으로 놓친 횟수가 한도에 닿으면 끊김으로 판단
+    if (conn->ping_wait != 0 && ++conn->ping_missed >= PING_MISS_LIMIT)
+    {
+        log_write(LOG_INFO, "[INFO] 하트비트 응답이 %d번 없어 연결 종료 (%d)", conn->ping_missed, fd);
+        atomic_fetch_add_explicit(&stats_thread()->ping_timeouts, 1, memory_order_relaxed);
+        close_client(fd);
+        return;
+    }
+
+    conn->ping_seq = conn->ping_seq + 1 ? conn->ping_seq + 1 : 1;
+    conn->ping_wait = conn->ping_seq;
+    conn->ping_sent_ns = now_ns();
+    if (conn->binary)
+        proto_reply(fd, RES_PING, conn->ping_wait, NULL);
+    else
+    {
+        char msg[SMALL_BUFF_SIZE];
+        int len = snprintf(msg, sizeof(msg), "[PING] %u\n", conn->ping_wait);
+        conn_send(fd, msg, len);
+    }
+    timer_set(r, t, ping_interval * 1000L, ping_expire, serial);
+}
+
+void handle_pong(int fd, uint32_t nonce)
+{
+    Connection *conn = &conns[fd];
+
+    // 번호 0은 하트비트 시작 요청 (응답하지 않는 기존 클라이언트에는 PING을 보내지 않음)
+    if (nonce == 0)
+    {
+        if (ping_interval > 0 && !conn->heartbeat)
+        {
+            conn->heartbeat = 1;
+            timer_set(&reactors[conn->reactor], &conn->ping_timer, ping_interval * 1000L, ping_expire, conn->serial);
         }
-        pthread_mutex_unlock(&client_lock);
+        return;
     }
-    return NULL;
+
+    // 늦게 도착한 이전 PING의 응답은 왕복 시간을 부풀리므로 무시
+    if (nonce != conn->ping_wait)
+        return;
+
+    uint64_t rtt = (now_ns() - conn->ping_sent_ns) / 1000;
+    if (rtt > UINT32_MAX)
+        rtt = UINT32_MAX;
+    // TCP의 SRTT와 같은 1/8 가중 이동 평균
+    if (conn->rtt_us == 0)
+        conn->rtt_us = rtt ? rtt : 1;
+    else
+        conn->rtt_us = conn->rtt_us - conn->rtt_us / 8 + rtt / 8;
+    if (rtt > conn->rtt_max_us)
+        conn->rtt_max_us = rtt;
+    conn->ping_wait = 0;
+    conn->ping_missed = 0;
 }
 
+void format_rtt(char *out, size_t size, uint32_t us)
+{
+    if (us == 0)
+        snprintf(out, size, "-");
+    else
+        snprintf(out, size, "%u.%ums", us / 1000, us % 1000 / 100);
+}
 
-// 채팅방의 개별 스레드 함수
-// 각 채팅방마다 독립적으로 클라이언트 메시지를 받고 처리함
-void *chatroom_thread(void *arg)
+void handle_conn_input(Reactor *r, int fd)
 {
-    ChatRoom *room = (ChatRoom *)arg;         // 인자로 받은 채팅방 정보
-    fd_set read_fds;                          // select()용 파일 디스크립터 집합
-    char buffer[MEDIUM_BUFF_SIZE];            // 메시지 수신 버퍼
+    // 엣지 트리거이므로 읽을 수 있는 데이터를 입력 버퍼로 옮긴 뒤 처리 (한도까지만 읽음)
+    int open = conn_read(fd);
 
-    while (1)
+    // 이름을 기다리는 연결은 로비에 등록된 뒤에야 이름과 함께 도착한 명령을 처리
+    if (conns[fd].handshaking && !handshake_input(r, fd, open))
+        return;
+
+    // 속도 제한으로 미룬 입력과 연결 종료는 rate_timer가 이어서 처리
+    if (conns[fd].throttled)
+        return;
+
+    // 다른 reactor로 넘어갔다면 남은 메시지와 연결 종료는 그쪽에서 처리
+    if (!process_frames(r, fd))
+        return;
+
+    if (!open && !conns[fd].throttled)
+        close_client(fd);
+    else if (open == 2 && !conns[fd].throttled)
     {
-        FD_ZERO(&read_fds);
-        int max_fd = -1;
+        // 소켓에 남겨 둔 입력은 다른 연결을 한 차례 처리한 뒤 이어서 읽음
+        epoll_rearm_fd(r->epfd, fd, CONN_EVENTS);
+    }
+}
 
-        // 채팅방 사용자들의 소켓을 read_fds에 추가
-        pthread_mutex_lock(&room->lock);
-        for (int i = 0; i < room->user_count; i++)
-        {
-            FD_SET(room->user_fds[i], &read_fds);  // select 대상에 추가
-            int client_idx = find_client_index(room->user_fds[i]);
+void rate_expire(Reactor *r, Timer *t, unsigned long serial)
+{
+    Connection *conn = (Connection *)((char *)t - offsetof(Connection, rate_timer));
+    int fd = conn - conns;
+    if (conn->serial != serial || conn->reactor != r->id || !conn->throttled)
+        return;
 
-            // 클라이언트 인덱스를 통해 사용자 이름 갱신
-            if (client_idx != -1)
-                room->user_names[i] = clients[client_idx].user_name;
-            else
-                room->user_names[i] = "Unknown";
+    // 미루는 동안 읽지 않고 남겨 둔 소켓 데이터까지 이어서 처리
+    conn->throttled = 0;
+    handle_conn_input(r, fd);
+}
+
+long bucket_wait(TokenBucket *b, int rate, uint64_t now)
+{
+    if (rate <= 0)
+        return 0;
+
+    double burst = (double)rate * RATE_BURST_SEC;
+    if (b->stamp_ns == 0)
+        b->tokens = burst;
+    else
+    {
+        b->tokens += (double)(now - b->stamp_ns) * rate / 1e9;
+        if (b->tokens > burst)
+            b->tokens = burst;
+    }
+    b->stamp_ns = now;
+
+    if (b->tokens >= 1)
+        return 0;
+    return (long)((1 - b->tokens) * 1000 / rate) + 1;
+}
+
+void bucket_take(TokenBucket *b, int rate, double cost)
+{
+    if (rate > 0)
+        b->tokens -= cost;
+}
+
+long room_rate_wait(ChatRoom *room, int fd)
+{
+    Connection *conn = &conns[fd];
+    uint64_t now = now_ns();
+    long wait = bucket_wait(&conn->line_bucket, rate_lines, now);
+    long w = bucket_wait(&conn->byte_bucket, rate_bytes, now);
+    if (w > wait)
+        wait = w;
+    w = bucket_wait(&room->rate, room_rate, now);
+    return w > wait ? w : wait;
+}
 
-            // select를 위한 최대 fd 추적
-            if (room->user_fds[i] > max_fd)
-                max_fd = room->user_fds[i];
+int rate_limited(int fd, long wait_ms)
+{
+    Connection *conn = &conns[fd];
+    int defer = rate_policy == RATE_DEFER;
+
+    // 안내는 몰아서 보내는 동안 한 번만
+    time_t now = time(NULL);
+    if (now - conn->rate_notice_at >= RATE_NOTICE_SEC)
+    {
+        conn->rate_notice_at = now;
+        if (conn->binary)
+            proto_reply(fd, RES_ERROR, PROTO_ERR_SLOW_DOWN, NULL);
+        else
+        {
+            const char *msg = defer ? "[NOTICE] slow down - 입력이 너무 빨라 잠시 뒤에 처리합니다.\n"
+                                    : "[NOTICE] slow down - 입력이 너무 빨라 초과한 메시지는 버립니다.\n";
+            conn_send(fd, msg, strlen(msg));
         }
-        pthread_mutex_unlock(&room->lock);
+        log_write(LOG_INFO, "[INFO] 입력 속도 제한 (%d)", fd);
+    }
+
+    if (!defer)
+    {
+        atomic_fetch_add_explicit(&stats_thread()->rate_dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    conn->throttled = 1;
+    timer_set(&reactors[conn->reactor], &conn->rate_timer, wait_ms, rate_expire, conn->serial);
+    atomic_fetch_add_explicit(&stats_thread()->rate_deferred, 1, memory_order_relaxed);
+    return 1;
+}
+
+int process_frames(Reactor *r, int fd)
+{
+    while (1)
+    {
+        if (conns[fd].reactor != r->id)
+            return 0;
 
-        // 유효한 fd가 없으면 잠깐 대기 후 반복
-        if (max_fd < 0)
+        // 처리 도중 메뉴 4로 연결이 닫혔을 수 있으므로 매번 다시 찾음
+        lock_mutex(&client_lock);
+        int i = find_client_index(fd);
+        if (i == -1)
         {
-            sleep(1);
-            continue;
+            pthread_mutex_unlock(&client_lock);
+            return 0;
         }
 
-        // select로 사용자 입력 대기 (논블로킹)
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 0;
-        int activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
-        if (activity < 0)
+        // 채팅방 메시지는 채팅방 락을 잡고 처리 (quit 하면 로비 메시지로 이어서 처리)
+        if (client_at(i)->state == STATE_IN_CHATROOM)
         {
-            perror("select");
+            ChatRoom *room = client_at(i)->room;
+            pthread_mutex_unlock(&client_lock);
+
+            if (process_room_frames(room, fd))
+                return 1;
             continue;
         }
 
-        // 사용자 입력 처리
-        pthread_mutex_lock(&room->lock);
-        for (int i = 0; i < room->user_count; i++)
+        // 토큰이 없으면 다음 명령이 도착해 있을 때만 미루거나 버림
+        long wait = bucket_wait(&conns[fd].cmd_bucket, rate_commands, now_ns());
+        if (wait > 0 && conn_frame_ready(fd) && rate_limited(fd, wait))
         {
-            int user_fd = room->user_fds[i];
+            pthread_mutex_unlock(&client_lock);
+            return 1;
+        }
 
-            // 해당 클라이언트가 데이터를 보냈다면
-            if (FD_ISSET(user_fd, &read_fds))
-            {
-                memset(buffer, 0, sizeof(buffer));
-                int n = recv(user_fd, buffer, sizeof(buffer) - 1, 0);
+        size_t len;
+        char *frame = conns[fd].binary ? conn_next_packet(fd, &len) : conn_next_frame(fd);
+        if (frame == NULL)
+        {
+            pthread_mutex_unlock(&client_lock);
+            return 1;
+        }
+        if (wait > 0)
+        {
+            pthread_mutex_unlock(&client_lock);
+            continue;
+        }
+        bucket_take(&conns[fd].cmd_bucket, rate_commands, 1);
 
-                // recv 에러
-                if (n < 0)
-                {
-                    perror("recv");
-                    continue;
-                }
+        if (conns[fd].binary)
+            handle_lobby_packet(i, frame, len);
+        else
+            handle_lobby_frame(i, trim(frame));
+        pthread_mutex_unlock(&client_lock);
+    }
+}
 
-                // 클라이언트 연결 종료 (EOF)
-                if (n == 0)
-                {
-                    print_log_room(room);
-                    printf("%s 연결 종료", room->user_names[i]);
-                    print_time();
+int process_room_frames(ChatRoom *room, int fd)
+{
+    char *frame;
+    size_t len;
+    int in_room = 1;
+    int binary = conns[fd].binary;
+
+    lock_mutex(&room->lock);
+    int i = get_user_index(room, fd);
+    while (i != -1 && in_room)
+    {
+        // 한 사용자가 몰아서 보내도 채팅방 락을 오래 잡지 않도록 사용자별, 채팅방 전체 속도 제한
+        long wait = room_rate_wait(room, fd);
+        if (wait > 0 && conn_frame_ready(fd) && rate_limited(fd, wait))
+            break;
+
+        frame = binary ? conn_next_packet(fd, &len) : conn_next_frame(fd);
+        if (frame == NULL)
+            break;
+        if (wait > 0)
+            continue;
+        if (!binary)
+            len = strlen(frame);
+        bucket_take(&conns[fd].line_bucket, rate_lines, 1);
+        bucket_take(&conns[fd].byte_bucket, rate_bytes, len);
+        bucket_take(&room->rate, room_rate, 1);
 
-                    // 나머지 사용자에게 알림 메시지 전송
-                    for (int j = 0; j < room->user_count; j++)
-                    {
-                        if (room->user_fds[j] != user_fd)
-                        {
-                            char msg[SMALL_BUFF_SIZE];
-                            snprintf(msg, sizeof(msg), "[NOTICE] 사용자 %s님이 채팅방을 나갔습니다.\n", room->user_names[i]);
-                            send(room->user_fds[j], msg, strlen(msg), 0);
-                        }
-                    }
+        in_room = binary ? handle_room_packet(room, i, frame, len) : handle_room_message(room, i, frame);
+    }
 
-                    // 클라이언트 소켓 종료 및 제거
-                    close(user_fd);
-                    remove_user(room, i);
-                    i--;
+    pthread_mutex_unlock(&room->lock);
+    return i == -1 || in_room;
+}
 
-                    server_state();
-                    print_time();
-                }
-                else
-                {
-                    // 줄바꿈 제거
-                    buffer[strcspn(buffer, "\r\n")] = 0;
+void close_client(int fd)
+{
+    lock_mutex(&client_lock);
+    int i = find_client_index(fd);
+    if (i == -1)
+    {
+        pthread_mutex_unlock(&client_lock);
+        return;
+    }
 
-                    // 로그 출력
-                    print_log_room(room);
-                    printf("%s의 메시지 : %s", room->user_names[i], buffer);
-                    print_time();
+    if (client_at(i)->state != STATE_IN_CHATROOM)
+    {
+        log_lobby(LOG_INFO, "사용자 %s - 접속이 끊어졌습니다.", client_at(i)->user_name);
+        session_save(client_at(i), 0, 0, 0);
+        remove_client(i);
+        log_state();
+        pthread_mutex_unlock(&client_lock);
+        return;
+    }
 
-                    // "quit" 명령어 처리: 채팅방 나가기
-                    if (strcmp(buffer, "quit") == 0)
-                    {
-                        print_log_room(room);
-                        printf("%s가 채팅방에서 나감", room->user_names[i]);
-                        print_time();
-
-                        // 다른 사용자에게 알림 전송
-                        for (int j = 0; j < room->user_count; j++)
-                        {
-                            if (room->user_fds[j] != user_fd)
-                            {
-                                char msg[SMALL_BUFF_SIZE];
-                                snprintf(msg, sizeof(msg), "[NOTICE] %s님이 채팅방에서 나갔습니다.\n", room->user_names[i]);
-                                send(room->user_fds[j], msg, strlen(msg), 0);
-                            }
-                        }
-
-                        remove_user(room, i);
-                        i--;
-
-                        // 해당 사용자에게 메뉴 전송 (로비로 돌아감)
-                        send_menu(user_fd);
-                        continue;
-                    }
+    // 채팅방 락 -> client_lock 순서를 지키기 위해 client_lock을 먼저 놓음
+    ChatRoom *room = client_at(i)->room;
+    pthread_mutex_unlock(&client_lock);
 
-                    // "info" 명령어 처리: 채팅방 정보 제공
-                    if (strcmp(buffer, "info") == 0)
-                    {
-                        send_chatroom_info(room, i);
-                        print_log_room(room);
-                        printf("%s 채팅방 정보 조회.", room->user_names[i]);
-                        print_time();
-                        continue;
-                    }
+    lock_mutex(&room->lock);
+    int idx = get_user_index(room, fd);
+    uint64_t room_id = room->id;
 
-                    // "game" 명령어 처리: 숫자 야구 게임 시작 요청
-                    if (strcmp(buffer, "game") == 0 && room->mode == CHAT_MODE)
+    // 끊긴 것을 알아채기 전에 큐에 쌓였거나 죽은 소켓에 보내던 메시지는 재접속할 때 다시 보냄
+    lock_mutex(&conns[fd].out_lock);
+    uint64_t seq = conns[fd].sent_seq;
+    pthread_mutex_unlock(&conns[fd].out_lock);
+    if (idx != -1)
+    {
+        log_room(LOG_INFO, room, "%s 연결 종료", room->user_names[idx]);
+
+        // 나머지 사용자에게 알림 메시지 전송
+        char msg[MEDIUM_LARGE_BUFF_SIZE];
+        if (session_grace > 0)
+            snprintf(msg, sizeof(msg), "[NOTICE] 사용자 %s님의 연결이 끊겼습니다. (%d초 동안 재접속 대기)\n", room->user_names[idx], session_grace);
+        else
+            snprintf(msg, sizeof(msg), "[NOTICE] 사용자 %s님이 채팅방을 나갔습니다.\n", room->user_names[idx]);
+        broadcast_to_room(room, msg, fd);
+
+        remove_user(room, idx);
+    }
+    pthread_mutex_unlock(&room->lock);
+
+    // 클라이언트 소켓 종료 및 제거 (재접속하면 끊길 때의 채팅방과 메시지 번호부터 이어받음)
+    lock_mutex(&client_lock);
+    i = find_client_index(fd);
+    if (i != -1)
+    {
+        session_save(client_at(i), idx != -1, room_id, seq);
+        remove_client(i);
+    }
+    log_state();
+    pthread_mutex_unlock(&client_lock);
+}
+
+void handle_lobby_frame(int i, char *input)
+{
+    // 클라이언트의 현재 상태에 따라 입력을 해석
+    switch (client_at(i)->state)
+    {
+    case STATE_AWAIT_NAME:
+        handle_name_input(i, input);
+        break;
+    case STATE_AWAIT_ROOM_ID:
+        handle_room_id_input(i, input);
+        break;
+    case STATE_AWAIT_ROOM_TITLE:
+        handle_room_title_input(i, input);
+        break;
+    default:
+        handle_lobby_message(i, input);
+        break;
+    }
+}
+
+void handle_lobby_message(int i, const char *menu)
+{
+    ClientInfo *client = client_at(i);
+    int fd = client->fd;
+    char *user_name = client->user_name;
+
+    if (strlen(menu) == 0)
+    {
+        const char *msg = " 메뉴를 비워둘 수 없습니다.\n";
+        conn_send(fd, msg, strlen(msg));
+        send_menu(fd);
+        return;
+    }
+
+    if (strcmp(menu, "0") == 0)
+    { // 메뉴 재전송
+        send_menu(fd);
+    }
+    else if (strcmp(menu, "1") == 0)
+    { // 사용자 이름 변경 처리
+        log_lobby(LOG_INFO, "사용자 %s - 메뉴1 선택", user_name);
+
+        const char *msg = "새로운 이름을 입력하세요.\n";
+        conn_send(fd, msg, strlen(msg));
+        client->state = STATE_AWAIT_NAME;
+    }
+    else if (strcmp(menu, "2") == 0)
+    { // 채팅방 입장 처리
+        log_lobby(LOG_INFO, "사용자 %s - 메뉴2 선택", user_name);
+
+        send_room_list(fd);
+        client->state = STATE_AWAIT_ROOM_ID;
+    }
+    else if (strcmp(menu, "3") == 0)
+    { // 채팅방 개설 처리
+        log_lobby(LOG_INFO, "사용자 %s - 메뉴3 선택", user_name);
+
+        if (room_count >= MAX_CHATROOMS)
+        {
+            const char *msg = "더 이상 채팅방을 개설할 수 없습니다.\n";
+            conn_send(fd, msg, strlen(msg));
+            send_menu(fd);
+            return;
+        }
+
+        const char *msg = "개설할 채팅방 이름을 입력하세요.\n";
+        conn_send(fd, msg, strlen(msg));
+        client->state = STATE_AWAIT_ROOM_TITLE;
+    }
+    else if (strcmp(menu, "4") == 0)
+    { // 접속 종료
+
+        log_lobby(LOG_INFO, "사용자 %s - 메뉴4 선택", user_name);
+
+        log_lobby(LOG_INFO, "사용자 %s - 접속을 헤제합니다.", user_name);
+        remove_client(i);
+        log_state();
+    }
+    else
+    {
+        const char *msg = "잘못된 명령입니다.\n";
+        conn_send(fd, msg, strlen(msg));
+    }
+}
+
+void handle_lobby_packet(int i, const char *packet, size_t len)
+{
+    ClientInfo *client = client_at(i);
+    int fd = client->fd;
+    const char *p = packet + 1, *end = packet + len;
+    char text[MEDIUM_BUFF_SIZE];
+    char *arg;
+    uint64_t room_id;
+    int err;
+
+    // 바이너리 모드는 입력 대기 상태 없이 요청 하나에 필요한 값이 모두 들어 있음
+    switch ((unsigned char)packet[0])
+    {
+    case REQ_NAME: // 사용자 이름 변경
+        if (!proto_get_str(&p, end, text, sizeof(text)) || *(arg = trim(text)) == '\0')
+            break;
+        snprintf(client->user_name, sizeof(client->user_name), "%.31s", arg);
+        log_lobby(LOG_INFO, "사용자 %.31s로 변경", client->user_name);
+        proto_reply(fd, RES_WELCOME, i, client->user_name);
+        return;
+    case REQ_LIST: // 채팅방 목록
+        send_room_list(fd);
+        return;
+    case REQ_JOIN: // 채팅방 입장
+        if (proto_get_varint(&p, end, &room_id) != 1)
+            break;
+        err = join_room(i, room_id, -1);
+        if (err != 0)
+            proto_reply(fd, RES_ERROR, err, NULL);
+        return;
+    case REQ_CREATE: // 채팅방 개설
+        if (!proto_get_str(&p, end, text, sizeof(text)) || *(arg = trim(text)) == '\0')
+            break;
+        arg[strnlen(arg, 31)] = '\0';
+        if (open_room(i, arg, &room_id))
+            proto_reply(fd, RES_CREATED, room_id, NULL);
+        else
+            proto_reply(fd, RES_ERROR, PROTO_ERR_TOO_MANY_ROOMS, NULL);
+        return;
+    case REQ_BYE: // 접속 종료
+        log_lobby(LOG_INFO, "사용자 %s - 접속을 헤제합니다.", client->user_name);
+        remove_client(i);
+        log_state();
+        return;
+    }
+
+    proto_reply(fd, RES_ERROR, PROTO_ERR_BAD_REQUEST, NULL);
+}
+
+void handle_name_input(int i, const char *name)
+{
+    ClientInfo *client = client_at(i);
+    int fd = client->fd;
+
+    if (strlen(name) == 0)
+    {
+        const char *msg = "이름은 비워둘 수 없습니다. 다시 입력해주세요.\n";
+        conn_send(fd, msg, strlen(msg));
+        return;
+    }
+
+    // 이름 저장
+    snprintf(client->user_name, sizeof(client->user_name), "%.31s", name);
+    conn_send(fd, "이름이 성공적으로 변경되었습니다.\n", strlen("이름이 성공적으로 변경되었습니다.\n"));
+    log_lobby(LOG_INFO, "사용자 %.31s로 변경", client->user_name);
+
+    client->state = STATE_LOBBY;
+    send_menu(fd);
+}
+
+void handle_room_id_input(int i, const char *rnum)
+{
+    ClientInfo *client = client_at(i);
+    int fd = client->fd;
+
+    if (strlen(rnum) == 0)
+    {
+        const char *msg = "입장할 채팅방 번호를 입력하세요.\n";
+        conn_send(fd, msg, strlen(msg));
+        return;
+    }
+
+    if (strcasecmp(rnum, "b") == 0)
+    {
+        client->state = STATE_LOBBY;
+        send_menu(fd);
+        return;
+    }
+
+    uint64_t room_id;
+
+    if (!parse_valid_id(rnum, &room_id))
+    {
+        const char *msg = "유효한 숫자를 입력해주세요.\n";
+        conn_send(fd, msg, strlen(msg));
+        return;
+    }
+
+    int err = join_room(i, room_id, -1);
+    if (err == PROTO_ERR_NO_ROOM)
+    {
+        const char *msg = "존재하지 않는 채팅방입니다.\n";
+        conn_send(fd, msg, strlen(msg));
+    }
+    else if (err == PROTO_ERR_ROOM_FULL)
+    {
+        const char *msg = "해당 채팅방은 인원이 가득 찼습니다.\n";
+        conn_send(fd, msg, strlen(msg));
+    }
+}
+
+void handle_room_title_input(int i, const char *cname)
+{
+    ClientInfo *client = client_at(i);
+    int fd = client->fd;
+
+    if (strlen(cname) == 0)
+    {
+        const char *msg = "채팅방 이름은 비워둘 수 없습니다.\n";
+        conn_send(fd, msg, strlen(msg));
+        return;
+    }
+
+    client->state = STATE_LOBBY;
+
+    char title[MEDIUM_BUFF_SIZE];
+    snprintf(title, sizeof(title), "%.31s", cname);
+
+    // 이름 입력 중 다른 사용자가 남은 자리를 채웠을 수 있음
+    uint64_t room_id;
+    if (!open_room(i, title, &room_id))
+    {
+        const char *msg = "더 이상 채팅방을 개설할 수 없습니다.\n";
+        conn_send(fd, msg, strlen(msg));
+        send_menu(fd);
+        return;
+    }
+
+    char msg[MEDIUM_LARGE_BUFF_SIZE];
+    snprintf(msg, sizeof(msg), "채팅방 %s (%" PRIu64 ")이 개설되었습니다.\n", title, room_id);
+
+    conn_send(fd, msg, strlen(msg));
+    send_menu(fd);
+}
+
+int open_room(int i, const char *title, uint64_t *room_id)
+{
+    // 락 순서를 지키기 위해 채팅방 목록을 잡는 동안 client_lock을 놓음
+    pthread_mutex_unlock(&client_lock);
+    lock_mutex(&room_registry_lock);
+    ChatRoom *room = create_room(title, 0);
+    if (room != NULL)
+    {
+        *room_id = room->id;
+        store_create(room);
+    }
+    pthread_mutex_unlock(&room_registry_lock);
+    lock_mutex(&client_lock);
+
+    if (room == NULL)
+        return 0;
+    log_lobby(LOG_INFO, "사용자 %s - 채팅방 %s (%" PRIu64 ") 개설", client_at(i)->user_name, title, *room_id);
+    return 1;
+}
+
+int join_room(int i, uint64_t room_id, int64_t resume_seq)
+{
+    ClientInfo *client = client_at(i);
+    int fd = client->fd;
+
+    // 채팅방 메시지는 room->lock을 잡은 채 client_lock을 요청하므로,
+    // 교착을 피하기 위해 client_lock을 놓고 채팅방 락을 잡음
+    pthread_mutex_unlock(&client_lock);
+
+    // 목록 락을 잡은 채 입장시켜 검색과 입장 사이에 채팅방이 회수되지 않도록 함
+    lock_mutex(&room_registry_lock);
+    ChatRoom *room = find_room(room_id);
+    int joined = 0;
+    if (room != NULL)
+    {
+        lock_mutex(&room->lock);
+        joined = room->user_count < MAX_ROOM_USERS;
+        if (joined)
+        {
+            // 슬롯 주소는 접속이 끊길 때까지 바뀌지 않으므로 이름을 포인터로 참조
+            room->user_fds[room->user_count] = fd;
+            room->user_names[room->user_count] = client->user_name;
+            room->user_count++;
+
+            // 이후 메시지보다 먼저 도착하도록 채팅방 락을 잡은 채 입장 안내와 최근 메시지를 한 번에 전송
+            // (바이너리 모드는 RES_JOINED가 입장 안내를 대신함)
+            if (!room->history_loaded)
+                store_load(room);
+            announce_join(room, fd);
+
+            // 입장 전 메시지는 받은 것으로 치고, 재접속이면 놓친 메시지를 다시 보내는 만큼 번호가 올라감
+            lock_mutex(&conns[fd].out_lock);
+            conns[fd].sent_seq = resume_seq >= 0 && (uint64_t)resume_seq < room->seq ? (uint64_t)resume_seq : room->seq;
+            pthread_mutex_unlock(&conns[fd].out_lock);
+
+            if (resume_seq >= 0)
+            {
+                char msg[MEDIUM_BUFF_SIZE];
+                snprintf(msg, sizeof(msg), "[NOTICE] 사용자 %s님이 다시 연결되었습니다.\n", client->user_name);
+                broadcast_to_room(room, msg, fd);
+                history_resume(room, fd, resume_seq);
+            }
+            else
+            {
+                char entered[MEDIUM_LARGE_BUFF_SIZE] = "";
+                if (!conns[fd].binary)
+                    snprintf(entered, sizeof(entered), "채팅방 %s (%" PRIu64 ")에 입장했습니다.\n", room->title, room->id);
+                Payload *header = NULL;
+                if (room->history_loading)
+                {
+                    // 아직 메모리에 없으므로 디스크의 로그에서 바로 전송
+                    if (entered[0] != '\0')
+                        conn_send(fd, entered, strlen(entered));
+                    store_catchup(room, fd, room_history_size, 0);
+                }
+                else if (room->history_count > 0)
+                    header = payload_printf("%s===== [HISTORY] 최근 메시지 %d개 =====\n", entered, room->history_count);
+                else if (entered[0] != '\0')
+                    header = payload_new(entered, strlen(entered));
+                if (header != NULL)
+                {
+                    history_send(room, fd, header, room->history_count);
+                    payload_unref(header);
+                }
+            }
+        }
+        pthread_mutex_unlock(&room->lock);
+    }
+    pthread_mutex_unlock(&room_registry_lock);
+
+    lock_mutex(&client_lock);
+
+    if (room == NULL)
+        return PROTO_ERR_NO_ROOM;
+    if (!joined)
+        return PROTO_ERR_ROOM_FULL;
+
+    client->state = STATE_IN_CHATROOM;
+    client->room = room;
+
+    log_lobby(LOG_INFO, "사용자 %s - 채팅방 %" PRIu64 "에 참여합니다.", client->user_name, room->id);
+
+    // 채팅방을 담당하는 reactor가 다르면 연결을 그쪽으로 넘김
+    if (room->reactor != conns[fd].reactor)
+        reactor_handoff(fd, &reactors[room->reactor]);
+    return 0;
+}
+
+void announce_join(ChatRoom *room, int fd)
+{
+    // 다른 바이너리 모드 사용자에게 새 사용자 번호와 이름을 알림 (텍스트 모드는 기존처럼 알리지 않음)
+    const char *name = room->user_names[get_user_index(room, fd)];
+    Payload *member = NULL;
+    for (int k = 0; k < room->user_count; k++)
+    {
+        int target_fd = room->user_fds[k];
+        if (target_fd == fd || !conns[target_fd].binary)
+            continue;
+        if (member == NULL && (member = proto_pack(RES_MEMBER, client_slot_of[fd], name, strlen(name), 0)) == NULL)
+            break;
+        conn_write_parts(target_fd, &member, 1);
+    }
+    payload_unref(member);
+
+    if (!conns[fd].binary)
+        return;
+
+    // 입장한 사용자에게는 채팅방 정보와 이후 RES_MSG의 사용자 번호를 해석할 목록을 전송
+    TextBuf tb;
+    proto_begin(&tb, RES_JOINED);
+    proto_append_varint(&tb, room->id);
+    proto_append_str(&tb, room->title);
+    proto_append_varint(&tb, room->user_count);
+    for (int k = 0; k < room->user_count; k++)
+    {
+        proto_append_varint(&tb, client_slot_of[room->user_fds[k]]);
+        proto_append_str(&tb, room->user_names[k]);
+    }
+    proto_append_varint(&tb, room->seq);
+    Payload *joined = proto_finish(&tb);
+    if (joined != NULL)
+    {
+        conn_write_parts(fd, &joined, 1);
+        payload_unref(joined);
+    }
+}
+
+
+int handle_room_message(ChatRoom *room, int i, char *buffer)
+{
+    atomic_fetch_add_explicit(&room->msgs_in, 1, memory_order_relaxed);
+
+    // 로그 출력
+    log_room(LOG_DEBUG, room, "%s의 메시지 : %s", room->user_names[i], buffer);
+
+    // "quit" 명령어 처리: 채팅방 나가기
+    if (strcmp(buffer, "quit") == 0)
+        return room_command(room, i, REQ_LEAVE, 0);
+
+    // "info" 명령어 처리: 채팅방 정보 제공
+    if (strcmp(buffer, "info") == 0)
+        return room_command(room, i, REQ_INFO, 0);
+
+    // "history [n]" 명령어 처리: 최근 메시지 다시 받기 (개수를 생략하면 메모리에 있는 전부)
+    if (strncmp(buffer, "history", 7) == 0 && (buffer[7] == '\0' || buffer[7] == ' '))
+    {
+        int n = 0;
+        char *arg = trim(buffer + 7);
+        if (strlen(arg) > 0 && (!parse_valid_int(arg, &n) || n <= 0))
+        {
+            const char *msg = "[NOTICE] 사용법: history [개수]\n";
+            conn_send(room->user_fds[i], msg, strlen(msg));
+            return 1;
+        }
+        return room_command(room, i, REQ_HISTORY, n);
+    }
+
+    // "game" 명령어 처리: 숫자 야구 게임 시작 요청
+    if (strcmp(buffer, "game") == 0 && room->mode == CHAT_MODE)
+        return room_command(room, i, REQ_GAME, 0);
+
+    // "poll" 명령어 처리: 투표 시작 요청
+    if (strcmp(buffer, "poll") == 0 && room->mode == CHAT_MODE)
+        return room_command(room, i, REQ_POLL, 0);
+
+    return handle_room_input(room, i, buffer);
+}
+
+int handle_room_packet(ChatRoom *room, int i, const char *packet, size_t len)
+{
+    const char *p = packet + 1, *end = packet + len;
+    int op = (unsigned char)packet[0];
+    char text[MAX_FRAME_SIZE + 1];
+    uint64_t n;
+
+    atomic_fetch_add_explicit(&room->msgs_in, 1, memory_order_relaxed);
+
+    // 명령은 요청 코드로 바로 구분하므로 문자열 비교 없이 처리
+    switch (op)
+    {
+    case REQ_SAY:
+        if (!proto_get_str(&p, end, text, sizeof(text)))
+            break;
+
+        // 텍스트 모드 사용자와 메시지 로그는 줄 단위이므로 첫 줄만 사용
+        text[strcspn(text, "\r\n")] = '\0';
+        log_room(LOG_DEBUG, room, "%s의 메시지 : %s", room->user_names[i], text);
+        return handle_room_input(room, i, text);
+    case REQ_HISTORY:
+        if (proto_get_varint(&p, end, &n) != 1 || n > INT_MAX)
+            break;
+        return room_command(room, i, op, (int)n);
+    case REQ_GAME:
+    case REQ_POLL:
+        if (room->mode != CHAT_MODE)
+            break;
+        return room_command(room, i, op, 0);
+    case REQ_LEAVE:
+    case REQ_INFO:
+        return room_command(room, i, op, 0);
+    }
+
+    proto_reply(room->user_fds[i], RES_ERROR, PROTO_ERR_BAD_REQUEST, NULL);
+    return 1;
+}
+
+int room_command(ChatRoom *room, int i, int op, int arg)
+{
+    int user_fd = room->user_fds[i];
+
+    // 채팅방 나가기
+    if (op == REQ_LEAVE)
+    {
+        log_room(LOG_INFO, room, "%s가 채팅방에서 나감", room->user_names[i]);
+
+        // 다른 사용자에게 알림 전송
+        char msg[MEDIUM_BUFF_SIZE];
+        snprintf(msg, sizeof(msg), "[NOTICE] %s님이 채팅방에서 나갔습니다.\n", room->user_names[i]);
+        broadcast_to_room(room, msg, user_fd);
+
+        // 해당 사용자에게 메뉴 전송 (로비로 돌아감)
+        send_menu(user_fd);
+
+        // 연결은 같은 reactor에 남아 이후 입력은 로비 메시지로 처리됨
+        remove_user(room, i);
+        return 0;
+    }
+
+    // 채팅방 정보 제공
+    if (op == REQ_INFO)
+    {
+        send_chatroom_info(room, i);
+        log_room(LOG_INFO, room, "%s 채팅방 정보 조회.", room->user_names[i]);
+        return 1;
+    }
+
+    // 최근 메시지 다시 받기
+    if (op == REQ_HISTORY)
+    {
+        int n = arg > 0 ? arg : room->history_count;
+
+        // 메모리에 있는 것보다 많이 요청하거나 아직 불러오는 중이면 디스크의 로그에서 바로 전송
+        if ((n > room->history_count || room->history_loading) && store_dir != NULL)
+        {
+            if (!store_catchup(room, user_fd, n, 0))
+            {
+                const char *msg = "[NOTICE] 이전 기록 요청을 처리하는 중입니다.\n";
+                conn_send(user_fd, msg, strlen(msg));
+            }
+            return 1;
+        }
+
+        if (room->history_count == 0)
+        {
+            const char *msg = "[NOTICE] 기록된 메시지가 없습니다.\n";
+            conn_send(user_fd, msg, strlen(msg));
+            return 1;
+        }
+
+        if (n > room->history_count)
+            n = room->history_count;
+        Payload *header = payload_printf("===== [HISTORY] 최근 메시지 %d개 =====\n", n);
+        if (header != NULL)
+        {
+            history_send(room, user_fd, header, n);
+            payload_unref(header);
+        }
+        return 1;
+    }
+
+    // 숫자 야구 게임 시작 요청
+    if (op == REQ_GAME)
+    {
+        room->mode = GAME_MODE;
+        room->game_host_fd = user_fd;
+        strncpy(room->game_host_name, room->user_names[i], SMALL_BUFF_SIZE - 1);
+        room->game_host_name[SMALL_BUFF_SIZE - 1] = '\0';
+        memset(room->game_answer, 0, sizeof(room->game_answer));
+        room->game_active_at = time(NULL);
+        if (game_timeout > 0)
+            timer_set(&reactors[room->reactor], &room->game_timer, game_timeout * 1000L, game_expire, room->id);
+        const char *msg = "[GAME] 호스트는 3자리 숫자를 입력하세요 (중복 없음):\n";
+        conn_send(user_fd, msg, strlen(msg));
+        log_game(LOG_INFO, room, "숫자 야구 게임 호스트: %s", room->game_host_name);
+        return 1;
+    }
+
+    // 투표 시작 요청
+    if (op == REQ_POLL)
+    {
+        log_poll(LOG_INFO, room, "사용자 %s - 투표 시작 요청", room->user_names[i]);
+        start_poll(room, user_fd, room->user_names[i]);
+
+        const char *msg = "[POLL] 호스트는 항목개수를 입력하세요 (1 ~ 10)\n";
+        conn_send(user_fd, msg, strlen(msg));
+        return 1;
+    }
+    return 1;
+}
+
+int handle_room_input(ChatRoom *room, int i, char *buffer)
+{
+    int user_fd = room->user_fds[i];
+
+    // 숫자 야구 게임 로직
+    if (room->mode == GAME_MODE)
+    {
+        room->game_active_at = time(NULL);
+
+        // 호스트가 정답 입력 전
+        if (user_fd == room->game_host_fd && strlen(room->game_answer) == 0)
+        {
+            buffer[strcspn(buffer, "\r\n")] = '\0';
+            if (is_valid_number(buffer))
+            {
+                strncpy(room->game_answer, buffer, 3);
+                room->game_answer[3] = '\0';
+
+                log_game(LOG_INFO, room, "숫자 야구 정답: %s", room->game_answer);
+
+                char msg[MEDIUM_LARGE_BUFF_SIZE];
+                snprintf(msg, sizeof(msg), "====== 숫자 야구 게임이 시작되었습니다! ======\n===== HOST : %s =====\n", room->game_host_name);
+                broadcast_to_room(room, msg, -1);
+            }
+            else
+            {
+                const char *msg = "[GAME] 유효하지 않은 숫자입니다. 다시 입력하세요.\n";
+                conn_send(user_fd, msg, strlen(msg));
+            }
+        }
+        // 참가자가 추측 입력
+        else if (user_fd != room->game_host_fd && strlen(room->game_answer) == 3)
+        {
+            if (!is_valid_number(buffer))
+            {
+                const char *msg = "[GAME] 3자리 숫자를 입력하세요. (중복 없음)\n";
+                conn_send(user_fd, msg, strlen(msg));
+                return 1;
+            }
+
+            int s, b;
+            evaluate_guess(buffer, room->game_answer, &s, &b);
+
+            char msg[MEDIUM_LARGE_BUFF_SIZE];
+            snprintf(msg, sizeof(msg), "[%s] %s의 결과: %d 스트라이크, %d 볼\n", room->user_names[i], buffer, s, b);
+            broadcast_to_room(room, msg, -1);
+
+            log_game(LOG_INFO, room, "%s -> %s의 결과: %d 스트라이크, %d 볼", room->user_names[i], buffer, s, b);
+
+            if (s == 3)
+            {
+                snprintf(msg, sizeof(msg), "[GAME] %s님이 정답을 맞췄습니다! 게임 종료.\n", room->user_names[i]);
+                broadcast_to_room(room, msg, -1);
+                room->mode = CHAT_MODE;
+                memset(room->game_answer, 0, sizeof(room->game_answer));
+                timer_cancel(&room->game_timer);
+                log_game(LOG_INFO, room, "%s님 정답 게임 종료.", room->user_names[i]);
+            }
+        }
+        return 1;
+    }
+
+    // 투표 진행 중 처리
+    if (room->mode == POLL_MODE)
+    {
+        // 1단계: 항목 개수 입력
+        if (user_fd == room->game_host_fd && room->poll_mode_stage == 0)
+        {
+            buffer[strcspn(buffer, "\r\n")] = 0;
+            int poll_count;
+            if (parse_valid_int(buffer, &poll_count) && poll_count > 0 && poll_count <= MAX_POLL)
+            {
+                room->poll_count = poll_count;
+                room->poll_index = 0;
+                room->poll_mode_stage = 1;
+
+                const char *msg = "[POLL] 항목 1을 입력하세요.\n";
+                conn_send(user_fd, msg, strlen(msg));
+            }
+            else
+            {
+                const char *msg = "[POLL] 유효한 숫자를 입력하세요 (1~10)\n";
+                conn_send(user_fd, msg, strlen(msg));
+            }
+            return 1;
+        }
+
+        // 2단계: 항목 내용 입력
+        if (user_fd == room->game_host_fd && room->poll_mode_stage == 1)
+        {
+            buffer[strcspn(buffer, "\r\n")] = 0;
+            room->poll_list[room->poll_index] = poll_arena_strdup(room, buffer);
+            room->poll_votes[room->poll_index] = 0;
+            room->poll_index++;
+
+            if (room->poll_index < room->poll_count)
+            {
+                char msg[SMALL_BUFF_SIZE];
+                snprintf(msg, sizeof(msg), "[POLL] 항목 %d을 입력하세요\n", room->poll_index + 1);
+                conn_send(user_fd, msg, strlen(msg));
+            }
+            else
+            {
+                room->poll_mode_stage = 2;
+
+                // 항목 입력에 쓴 시간과 관계없이 투표 시간을 새로 줌
+                if (poll_timeout > 0)
+                {
+                    room->poll_deadline = time(NULL) + poll_timeout;
+                    timer_set(&reactors[room->reactor], &room->poll_timer, poll_timeout * 1000L, poll_expire, room->id);
+                }
+
+                log_poll(LOG_INFO, room, "투표 시작");
+
+                // 항목 목록 전체 사용자에게 전송
+                char list[LARGE_BUFF_SIZE] = "===== [POLL_LIST] =====\n";
+                for (int i = 0; i < room->poll_count; i++)
+                {
+                    char line[MEDIUM_BUFF_SIZE];
+                    snprintf(line, sizeof(line), "%d. %s\n", i + 1, room->poll_list[i]);
+                    if (strlen(list) + strlen(line) < sizeof(list))
                     {
-                        room->mode = GAME_MODE;
-                        room->game_host_fd = user_fd;
-                        strncpy(room->game_host_name, room->user_names[i], SMALL_BUFF_SIZE - 1);
-                        room->game_host_name[SMALL_BUFF_SIZE - 1] = '\0';
-                        memset(room->game_answer, 0, sizeof(room->game_answer));
-                        const char *msg = "[GAME] 호스트는 3자리 숫자를 입력하세요 (중복 없음):\n";
-                        send(user_fd, msg, strlen(msg), 0);
-                        print_log_game(room);
-                        printf("숫자 야구 게임 호스트: %s", room->game_host_name);
-                        print_time();
-                        continue;
+                        strcat(list, line);
                     }
+                }
+
+                broadcast_to_room(room, list, -1);
+                for (int i = 0; i < room->user_count; i++)
+                    room->vote_received[i] = -1;
+            }
+            return 1;
+        }
+
+        // 3단계: 사용자 투표 입력
+        if (room->poll_mode_stage == 2)
+        {
+            int user_idx = get_user_index(room, user_fd);
+            if (user_idx == -1 || room->vote_received[user_idx] != -1)
+                return 1;
+
+            int vote = atoi(buffer) - 1;
+            if (vote < 0 || vote >= room->poll_count)
+            {
+                const char *msg = "[POLL] 올바른 번호를 입력하세요\n";
+                conn_send(user_fd, msg, strlen(msg));
+                return 1;
+            }
+
+            room->poll_votes[vote]++;
+            room->vote_received[user_idx] = vote;
+
+            const char *msg = "선택 완료!\n";
+            conn_send(user_fd, msg, strlen(msg));
+
+            // 모든 사용자 투표 완료 확인
+            char list[LARGE_BUFF_SIZE];
+            if (tally_poll(room, list, sizeof(list)))
+            {
+                broadcast_to_room(room, list, -1);
+                log_poll(LOG_INFO, room, "모든 사용자가 투표를 완료했습니다. 투표 종료");
+
+                room->mode = CHAT_MODE;
+                reset_poll_state(room);
+            }
+            return 1;
+        }
+    }
+
+    // 일반 메시지 전송 처리
+    if (room->user_count == 1)
+    {
+        // 혼자 있을 경우 알림 (나중에 들어온 사용자가 볼 수 있도록 기록은 남김)
+        const char *msg = "[NOTICE] 현재 채팅방에 혼자 있습니다.\n";
+        log_room(LOG_DEBUG, room, "사용자 %s - 혼자여서 메시지를 전달 안 합니다.", room->user_names[i]);
+
+        Payload *frame = payload_printf("[%s] %s\n", room->user_names[i], buffer);
+        if (frame == NULL)
+        {
+            conn_send(user_fd, msg, strlen(msg));
+            return 1;
+        }
+        uint64_t seq = ++room->seq;
+        frame->seq = seq;
+
+        // 보낸 사람도 이 번호까지 받은 것이 되도록 번호를 붙여 보냄 (재접속 때 자기 메시지를 다시 받지 않음)
+        // 바이너리 모드는 다른 사용자가 있을 때처럼 RES_MSG로 돌려주고, 텍스트 모드는 알림에 번호를 붙임
+        if (conns[user_fd].binary)
+        {
+            Payload *wire = proto_pack_msg(client_slot_of[user_fd], buffer, seq);
+            if (wire != NULL)
+            {
+                conn_write_parts(user_fd, &wire, 1);
+                payload_unref(wire);
+            }
+            conn_send(user_fd, msg, strlen(msg));
+        }
+        else
+        {
+            Payload *notice = payload_new(msg, strlen(msg));
+            if (notice != NULL)
+            {
+                notice->seq = seq;
+                conn_write_parts(user_fd, &notice, 1);
+                payload_unref(notice);
+            }
+        }
+        store_append(room, frame);
+        history_push(room, frame);
+    }
+    else if (room->user_count > 1)
+    {
+        // 보낸 사람 접두어까지 붙인 메시지를 한 번만 만들어 다른 수신자들과 최근 메시지 기록이 공유
+        Payload *body = payload_printf("%s\n", buffer);
+        Payload *frame = payload_printf("[%s] %s\n", room->user_names[i], buffer);
+        if (body == NULL || frame == NULL)
+        {
+            payload_unref(body);
+            payload_unref(frame);
+            return 1;
+        }
+
+        // 다수 사용자에게 브로드캐스트 (본인에게는 [ME] 접두어)
+        // 바이너리 모드 수신자는 사용자 번호와 본문, 메시지 번호만 담은 메시지를 공유 (처음 필요할 때 한 번만 만듦)
+        uint64_t seq = ++room->seq;
+        body->seq = seq;
+        frame->seq = seq;
+        Payload *wire = NULL;
+        uint64_t start = now_ns();
+        out_batching = coalesce_ms > 0;
+        for (int j = 0; j < room->user_count; j++)
+        {
+            int target_fd = room->user_fds[j];
+            if (conns[target_fd].binary)
+            {
+                if (wire == NULL && (wire = proto_pack_msg(client_slot_of[user_fd], buffer, seq)) == NULL)
+                    continue;
+                conn_write_parts(target_fd, &wire, 1);
+            }
+            else if (target_fd == user_fd)
+            {
+                Payload *parts[2] = {me_prefix, body};
+                conn_send_parts(target_fd, parts, 2);
+            }
+            else
+            {
+                conn_send_parts(target_fd, &frame, 1);
+            }
+        }
+        out_batching = 0;
+        record_fanout(now_ns() - start);
+        atomic_fetch_add_explicit(&room->msgs_out, room->user_count, memory_order_relaxed);
+
+        payload_unref(wire);
+        payload_unref(body);
+        store_append(room, frame);
+        history_push(room, frame);
+    }
+    else
+    {
+        // 발생하면 안 되는 비정상 상태
+        log_room(LOG_WARN, room, "<WARN!> 비정상 상태...");
+        room->user_count = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// 로그 출력 함수
+void init_logging()
+{
+    if (log_path != NULL)
+    {
+        log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (log_fd < 0)
+        {
+            perror("open");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // 기록 스레드는 이 eventfd에서 블로킹하며 대기
+    log_wake_fd = eventfd(0, 0);
+    if (log_wake_fd < 0)
+    {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pthread_create(&log_tid, NULL, log_writer_thread, NULL) != 0)
+    {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void *log_writer_thread(void *arg)
+{
+    // 시그널 핸들러가 이 스레드를 기다리므로 시그널은 다른 스레드에서 받음
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    char *batch = malloc(LOG_BATCH_SIZE);
+    if (batch == NULL)
+    {
+        perror("malloc");
+        return NULL;
+    }
+
+    while (1)
+    {
+        size_t total = 0;
+
+        // 모든 스레드의 로그 버퍼에서 쌓인 줄을 한 묶음으로 모음
+        for (LogRing *ring = atomic_load(&log_rings); ring != NULL; ring = ring->next)
+        {
+            unsigned long dropped = atomic_exchange(&ring->dropped, 0);
+            if (dropped > 0 && LOG_BATCH_SIZE - total > MEDIUM_BUFF_SIZE)
+                total += snprintf(batch + total, MEDIUM_BUFF_SIZE, "[WARN] 로그 버퍼가 가득 차 %lu줄을 기록하지 못했습니다.\n", dropped);
+
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            size_t head = atomic_load(&ring->head);
+            size_t n = head - tail;
+            if (n > LOG_BATCH_SIZE - total)
+                n = LOG_BATCH_SIZE - total;
+            if (n == 0)
+                continue;
+
+            size_t off = tail & (LOG_RING_SIZE - 1);
+            size_t first = n < LOG_RING_SIZE - off ? n : LOG_RING_SIZE - off;
+            memcpy(batch + total, ring->buf + off, first);
+            memcpy(batch + total + first, ring->buf, n - first);
+            total += n;
+            atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+        }
+
+        if (total > 0)
+        {
+            // 터미널이나 디스크가 느려도 여기서만 기다리고 채팅 스레드는 기다리지 않음
+            size_t written = 0;
+            while (written < total)
+            {
+                ssize_t w = write(log_fd, batch + written, total - written);
+                if (w < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    break;
+                }
+                written += w;
+            }
+
+            // 묶음이 덜 찼으면 잠시 더 모아서 쓰기 횟수를 줄임
+            if (total < LOG_BATCH_SIZE / 2 && !atomic_load(&log_stopping))
+                usleep(LOG_BATCH_DELAY_US);
+            continue;
+        }
+
+        if (atomic_load(&log_stopping))
+            break;
+
+        // 대기 표시 후 다시 확인해야 그 사이에 추가된 로그를 놓치지 않음
+        atomic_store(&log_sleeping, 1);
+        int pending = 0;
+        for (LogRing *ring = atomic_load(&log_rings); ring != NULL; ring = ring->next)
+        {
+            if (atomic_load(&ring->head) != atomic_load(&ring->tail) || atomic_load(&ring->dropped) > 0)
+                pending = 1;
+        }
+        if (pending || atomic_load(&log_stopping))
+        {
+            atomic_store(&log_sleeping, 0);
+            continue;
+        }
+
+        uint64_t count;
+        if (read(log_wake_fd, &count, sizeof(count)) < 0 && errno != EINTR)
+            break;
+    }
+
+    free(batch);
+    return NULL;
+}
+
+void log_shutdown()
+{
+    atomic_store(&log_stopping, 1);
+
+    uint64_t one = 1;
+    if (write(log_wake_fd, &one, sizeof(one)) < 0)
+        perror("write");
+    pthread_join(log_tid, NULL);
+}
+
+LogRing *log_thread_ring()
+{
+    if (log_ring != NULL)
+        return log_ring;
+
+    LogRing *ring = calloc(1, sizeof(LogRing));
+    if (ring == NULL)
+        return NULL;
+
+    // 목록에는 추가만 하므로 CAS로 앞에 끼워 넣음
+    ring->next = atomic_load(&log_rings);
+    while (!atomic_compare_exchange_weak(&log_rings, &ring->next, ring))
+        ;
+    log_ring = ring;
+    return ring;
+}
+
+void log_vwrite(LogLevel level, const char *kind, const char *tag, const char *fmt, va_list ap)
+{
+    if (level > log_level)
+        return;
+
+    LogRing *ring = log_thread_ring();
+    if (ring == NULL)
+        return;
+
+    char line[LOG_LINE_SIZE];
+    size_t len = 0;
+    if (tag != NULL)
+        len = snprintf(line, sizeof(line), "[%s%s] ", kind, tag);
+
+    int n = vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+    if (n > 0)
+        len = len + n < sizeof(line) ? len + n : sizeof(line) - 1;
+
+    // 시각 문자열은 초가 바뀔 때만 다시 만듦
+    time_t now = time(NULL);
+    if (now != ring->stamp_sec)
+    {
+        struct tm t;
+        localtime_r(&now, &t);
+        ring->stamp_len = snprintf(ring->stamp, sizeof(ring->stamp), "    (%d-%02d-%02d %02d:%02d:%02d)\n",
+                                   t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+        ring->stamp_sec = now;
+    }
+    if (len + ring->stamp_len > sizeof(line))
+        len = sizeof(line) - ring->stamp_len;
+    memcpy(line + len, ring->stamp, ring->stamp_len);
+    len += ring->stamp_len;
+
+    // 버퍼가 가득 차면 기다리지 않고 버린 줄 수만 기록
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (LOG_RING_SIZE - (head - tail) < len)
+    {
+        atomic_fetch_add(&ring->dropped, 1);
+        return;
+    }
+
+    size_t off = head & (LOG_RING_SIZE - 1);
+    size_t first = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+    memcpy(ring->buf + off, line, first);
+    memcpy(ring->buf, line + first, len - first);
+    atomic_store(&ring->head, head + len);
+
+    // 기록 스레드가 잠들어 있을 때만 깨움 (깨어 있는 동안에는 시스템 콜 없음)
+    if (atomic_exchange(&log_sleeping, 0))
+    {
+        uint64_t one = 1;
+        if (write(log_wake_fd, &one, sizeof(one)) < 0)
+            perror("write");
+    }
+}
+
+void log_write(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, "", NULL, fmt, ap);
+    va_end(ap);
+}
+
+void log_lobby(LogLevel level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, "", "LOBBY", fmt, ap);
+    va_end(ap);
+}
+
+void log_room(LogLevel level, ChatRoom *room, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, "", room->title, fmt, ap);
+    va_end(ap);
+}
+
+void log_game(LogLevel level, ChatRoom *room, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, "GAME-", room->title, fmt, ap);
+    va_end(ap);
+}
+
+void log_poll(LogLevel level, ChatRoom *room, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, "POLL-", room->title, fmt, ap);
+    va_end(ap);
+}
+
+void log_state()
+{
+    log_write(LOG_INFO, "[INFO] All chatters (%d/%d)", client_count, max_clients);
+}
+
+ThreadStats *stats_thread()
+{
+    if (thread_stats != NULL)
+        return thread_stats;
+
+    // 지표는 잃어버리면 안 되므로 할당 실패 시 종료
+    ThreadStats *stats = calloc(1, sizeof(ThreadStats));
+    if (stats == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    stats->next = atomic_load(&all_stats);
+    while (!atomic_compare_exchange_weak(&all_stats, &stats->next, stats))
+        ;
+    thread_stats = stats;
+    return stats;
+}
+
+void lock_mutex(pthread_mutex_t *mutex)
+{
+    // 바로 잡히면 시각을 재지 않음
+    if (pthread_mutex_trylock(mutex) == 0)
+        return;
+
+    uint64_t start = now_ns();
+    pthread_mutex_lock(mutex);
+
+    ThreadStats *stats = stats_thread();
+    atomic_fetch_add_explicit(&stats->lock_waits, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->lock_wait_ns, now_ns() - start, memory_order_relaxed);
+}
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void record_fanout(uint64_t elapsed_ns)
+{
+    ThreadStats *stats = stats_thread();
+
+    int b = 0;
+    while (b < FANOUT_BUCKETS && elapsed_ns > fanout_bounds_ns[b])
+        b++;
+    atomic_fetch_add_explicit(&stats->fanout_buckets[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->fanout_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->fanout_ns, elapsed_ns, memory_order_relaxed);
+}
+
+void init_metrics()
+{
+    if (metrics_port == 0)
+        return;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // 운영용 지표이므로 로컬에서만 접속 가능
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(metrics_port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        perror("bind");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // 지표 응답은 채팅 reactor와 별도 스레드에서 처리
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, metrics_thread, (void *)(intptr_t)fd) != 0)
+    {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(tid);
+
+    log_write(LOG_INFO, "[INFO] 지표 조회 포트 127.0.0.1:%d", metrics_port);
+}
+
+void *metrics_thread(void *arg)
+{
+    int listen_fd = (int)(intptr_t)arg;
+    struct timeval timeout = {0, 200000}; // 요청 읽기 최대 대기 시간 (0.2초)
+
+    while (1)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno != EINTR)
+                perror("accept");
+            continue;
+        }
+
+        // HTTP 요청이 오면 읽어 버리고, 아무것도 보내지 않아도 잠시 후 응답
+        char request[LARGE_BUFF_SIZE];
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (recv(fd, request, sizeof(request), 0) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            close(fd);
+            continue;
+        }
+
+        size_t len;
+        char *body = render_metrics(&len);
+        if (body != NULL)
+        {
+            char header[MEDIUM_LARGE_BUFF_SIZE];
+            int hlen = snprintf(header, sizeof(header),
+                                "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: %zu\r\n\r\n",
+                                len);
+            struct iovec iov[2] = {{header, hlen}, {body, len}};
+            if (writev(fd, iov, 2) < 0)
+                perror("writev");
+            free(body);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+void text_appendf(TextBuf *tb, const char *fmt, ...)
+{
+    while (tb->data != NULL)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(tb->data + tb->len, tb->cap - tb->len, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return;
+        if ((size_t)n < tb->cap - tb->len)
+        {
+            tb->len += n;
+            return;
+        }
+
+        char *data = realloc(tb->data, tb->cap * 2);
+        if (data == NULL)
+        {
+            free(tb->data);
+            tb->data = NULL;
+            return;
+        }
+        tb->data = data;
+        tb->cap *= 2;
+    }
+}
+
+void text_append(TextBuf *tb, const char *data, size_t len)
+{
+    while (tb->data != NULL && tb->cap - tb->len < len)
+    {
+        char *grown = realloc(tb->data, tb->cap * 2);
+        if (grown == NULL)
+        {
+            free(tb->data);
+            tb->data = NULL;
+            return;
+        }
+        tb->data = grown;
+        tb->cap *= 2;
+    }
+    if (tb->data == NULL)
+        return;
+    memcpy(tb->data + tb->len, data, len);
+    tb->len += len;
+}
+
+void text_append_label(TextBuf *tb, const char *value)
+{
+    for (const char *p = value; *p != '\0'; p++)
+    {
+        if (*p == '\\' || *p == '"')
+            text_appendf(tb, "\\%c", *p);
+        else if (*p == '\n')
+            text_appendf(tb, "\\n");
+        else
+            text_appendf(tb, "%c", *p);
+    }
+}
+
+char *render_metrics(size_t *len)
+{
+    TextBuf tb = {malloc(LARGE_BUFF_SIZE * 4), 0, LARGE_BUFF_SIZE * 4};
+
+    // 스레드별 지표 합산
+    unsigned long msgs_in = 0, msgs_out = 0, bytes_out = 0, accepts = 0;
+    unsigned long lock_waits = 0, lock_wait_ns = 0, fanout_count = 0, fanout_ns = 0, ping_timeouts = 0;
+    unsigned long rate_deferred = 0, rate_dropped = 0, send_calls = 0, coalesce_flushes = 0;
+    unsigned long buckets[FANOUT_BUCKETS + 1] = {0};
+    for (ThreadStats *st = atomic_load(&all_stats); st != NULL; st = st->next)
+    {
+        msgs_in += atomic_load_explicit(&st->msgs_in, memory_order_relaxed);
+        msgs_out += atomic_load_explicit(&st->msgs_out, memory_order_relaxed);
+        bytes_out += atomic_load_explicit(&st->bytes_out, memory_order_relaxed);
+        accepts += atomic_load_explicit(&st->accepts, memory_order_relaxed);
+        lock_waits += atomic_load_explicit(&st->lock_waits, memory_order_relaxed);
+        lock_wait_ns += atomic_load_explicit(&st->lock_wait_ns, memory_order_relaxed);
+        fanout_count += atomic_load_explicit(&st->fanout_count, memory_order_relaxed);
+        fanout_ns += atomic_load_explicit(&st->fanout_ns, memory_order_relaxed);
+        ping_timeouts += atomic_load_explicit(&st->ping_timeouts, memory_order_relaxed);
+        rate_deferred += atomic_load_explicit(&st->rate_deferred, memory_order_relaxed);
+        rate_dropped += atomic_load_explicit(&st->rate_dropped, memory_order_relaxed);
+        send_calls += atomic_load_explicit(&st->send_calls, memory_order_relaxed);
+        coalesce_flushes += atomic_load_explicit(&st->coalesce_flushes, memory_order_relaxed);
+        for (int b = 0; b <= FANOUT_BUCKETS; b++)
+            buckets[b] += atomic_load_explicit(&st->fanout_buckets[b], memory_order_relaxed);
+    }
+
+    text_appendf(&tb, "# HELP chat_messages_in_total Lines received from clients.\n");
+    text_appendf(&tb, "# TYPE chat_messages_in_total counter\nchat_messages_in_total %lu\n", msgs_in);
+    text_appendf(&tb, "# HELP chat_messages_out_total Messages queued to clients.\n");
+    text_appendf(&tb, "# TYPE chat_messages_out_total counter\nchat_messages_out_total %lu\n", msgs_out);
+    text_appendf(&tb, "# HELP chat_bytes_out_total Bytes queued to clients.\n");
+    text_appendf(&tb, "# TYPE chat_bytes_out_total counter\nchat_bytes_out_total %lu\n", bytes_out);
+    text_appendf(&tb, "# HELP chat_send_calls_total Socket write system calls to clients.\n");
+    text_appendf(&tb, "# TYPE chat_send_calls_total counter\nchat_send_calls_total %lu\n", send_calls);
+    text_appendf(&tb, "# HELP chat_coalesce_flushes_total Connections flushed at the end of a coalescing window.\n");
+    text_appendf(&tb, "# TYPE chat_coalesce_flushes_total counter\nchat_coalesce_flushes_total %lu\n", coalesce_flushes);
+    text_appendf(&tb, "# HELP chat_accepts_total Accepted connections.\n");
+    text_appendf(&tb, "# TYPE chat_accepts_total counter\nchat_accepts_total %lu\n", accepts);
+    text_appendf(&tb, "# HELP chat_lock_waits_total Lock acquisitions that had to wait.\n");
+    text_appendf(&tb, "# TYPE chat_lock_waits_total counter\nchat_lock_waits_total %lu\n", lock_waits);
+    text_appendf(&tb, "# HELP chat_lock_wait_seconds_total Time spent waiting for locks.\n");
+    text_appendf(&tb, "# TYPE chat_lock_wait_seconds_total counter\nchat_lock_wait_seconds_total %.9f\n", lock_wait_ns / 1e9);
+    text_appendf(&tb, "# HELP chat_heartbeat_timeouts_total Connections closed after missing heartbeats.\n");
+    text_appendf(&tb, "# TYPE chat_heartbeat_timeouts_total counter\nchat_heartbeat_timeouts_total %lu\n", ping_timeouts);
+    text_appendf(&tb, "# HELP chat_rate_deferred_total Times a client's input was deferred by rate limiting.\n");
+    text_appendf(&tb, "# TYPE chat_rate_deferred_total counter\nchat_rate_deferred_total %lu\n", rate_deferred);
+    text_appendf(&tb, "# HELP chat_rate_dropped_total Messages dropped by rate limiting.\n");
+    text_appendf(&tb, "# TYPE chat_rate_dropped_total counter\nchat_rate_dropped_total %lu\n", rate_dropped);
+
+    text_appendf(&tb, "# HELP chat_fanout_seconds Time to queue one broadcast to every room member.\n");
+    text_appendf(&tb, "# TYPE chat_fanout_seconds histogram\n");
+    unsigned long cumulative = 0;
+    for (int b = 0; b < FANOUT_BUCKETS; b++)
+    {
+        cumulative += buckets[b];
+        text_appendf(&tb, "chat_fanout_seconds_bucket{le=\"%g\"} %lu\n", fanout_bounds_ns[b] / 1e9, cumulative);
+    }
+    text_appendf(&tb, "chat_fanout_seconds_bucket{le=\"+Inf\"} %lu\n", cumulative + buckets[FANOUT_BUCKETS]);
+    text_appendf(&tb, "chat_fanout_seconds_sum %.9f\nchat_fanout_seconds_count %lu\n", fanout_ns / 1e9, fanout_count);
+
+    // 메모리 풀 (등급별로 할당해 둔 블록과 그중 공용 저장소에 쉬고 있는 블록)
+    text_appendf(&tb, "# HELP chat_pool_blocks Pool blocks allocated from the system, by size class.\n");
+    text_appendf(&tb, "# TYPE chat_pool_blocks gauge\n");
+    for (int c = 0; c < POOL_CLASSES; c++)
+        text_appendf(&tb, "chat_pool_blocks{size=\"%d\"} %ld\n", 1 << (c + POOL_MIN_SHIFT), atomic_load_explicit(&pool_depots[c].blocks, memory_order_relaxed));
+    text_appendf(&tb, "# HELP chat_pool_depot_blocks Free pool blocks held in the shared depot, by size class.\n");
+    text_appendf(&tb, "# TYPE chat_pool_depot_blocks gauge\n");
+    for (int c = 0; c < POOL_CLASSES; c++)
+    {
+        pthread_mutex_lock(&pool_depots[c].lock);
+        int depot_count = pool_depots[c].free.count;
+        pthread_mutex_unlock(&pool_depots[c].lock);
+        text_appendf(&tb, "chat_pool_depot_blocks{size=\"%d\"} %d\n", 1 << (c + POOL_MIN_SHIFT), depot_count);
+    }
+
+    // 접속자와 연결별 송신 큐 (비어 있지 않은 큐만 개별 출력)
+    size_t queued_total = 0, queued_max = 0;
+    lock_mutex(&client_lock);
+    text_appendf(&tb, "# HELP chat_clients Connected clients.\n");
+    text_appendf(&tb, "# TYPE chat_clients gauge\nchat_clients %d\n", client_count);
+    text_appendf(&tb, "# HELP chat_conn_out_queue_bytes Bytes waiting in a connection's send queue.\n");
+    text_appendf(&tb, "# TYPE chat_conn_out_queue_bytes gauge\n");
+    for (int i = 0; i < client_chunk_count * CLIENT_CHUNK; i++)
+    {
+        ClientInfo *client = client_at(i);
+        if (client->fd == -1)
+            continue;
+
+        // 지표용이므로 송신 큐 락 없이 읽음
+        size_t queued = conns[client->fd].out_bytes;
+        queued_total += queued;
+        if (queued > queued_max)
+            queued_max = queued;
+        if (queued == 0)
+            continue;
+
+        text_appendf(&tb, "chat_conn_out_queue_bytes{fd=\"%d\",user=\"", client->fd);
+        text_append_label(&tb, client->user_name);
+        text_appendf(&tb, "\"} %zu\n", queued);
+    }
+
+    // 하트비트로 잰 연결별 왕복 시간 (측정된 연결만)
+    const char *rtt_names[2] = {"chat_conn_rtt_seconds", "chat_conn_rtt_max_seconds"};
+    const char *rtt_helps[2] = {"Heartbeat round-trip time of a connection (moving average).",
+                                "Largest heartbeat round-trip time measured on a connection."};
+    for (int k = 0; k < 2; k++)
+    {
+        text_appendf(&tb, "# HELP %s %s\n", rtt_names[k], rtt_helps[k]);
+        text_appendf(&tb, "# TYPE %s gauge\n", rtt_names[k]);
+        for (int i = 0; i < client_chunk_count * CLIENT_CHUNK; i++)
+        {
+            ClientInfo *client = client_at(i);
+            if (client->fd == -1 || conns[client->fd].rtt_us == 0)
+                continue;
+
+            uint32_t us = k == 0 ? conns[client->fd].rtt_us : conns[client->fd].rtt_max_us;
+            text_appendf(&tb, "%s{fd=\"%d\",user=\"", rtt_names[k], client->fd);
+            text_append_label(&tb, client->user_name);
+            text_appendf(&tb, "\"} %.6f\n", us / 1e6);
+        }
+    }
+    pthread_mutex_unlock(&client_lock);
+    text_appendf(&tb, "# HELP chat_out_queue_bytes Bytes waiting in all send queues.\n");
+    text_appendf(&tb, "# TYPE chat_out_queue_bytes gauge\nchat_out_queue_bytes %zu\n", queued_total);
+    text_appendf(&tb, "# HELP chat_out_queue_bytes_max Bytes waiting in the largest send queue.\n");
+    text_appendf(&tb, "# TYPE chat_out_queue_bytes_max gauge\nchat_out_queue_bytes_max %zu\n", queued_max);
+
+    // 채팅방별 지표
+    lock_mutex(&room_registry_lock);
+    text_appendf(&tb, "# HELP chat_rooms Open rooms.\n");
+    text_appendf(&tb, "# TYPE chat_rooms gauge\nchat_rooms %d\n", room_count);
+    // 같은 이름의 지표는 한데 모여 있어야 하므로 지표별로 채팅방을 한 번씩 순회
+    const char *names[3] = {"chat_room_users", "chat_room_messages_in_total", "chat_room_messages_out_total"};
+    const char *types[3] = {"gauge", "counter", "counter"};
+    const char *helps[3] = {"Users in a room.", "Lines received in a room.", "Messages queued to a room's members."};
+    for (int k = 0; k < 3; k++)
+    {
+        text_appendf(&tb, "# HELP %s %s\n", names[k], helps[k]);
+        text_appendf(&tb, "# TYPE %s %s\n", names[k], types[k]);
+        for (int i = 0; i < room_chunk_count * ROOM_CHUNK; i++)
+        {
+            ChatRoom *room = room_at(i);
+            if (!room->active)
+                continue;
+
+            unsigned long value;
+            if (k == 0)
+                value = room->user_count;
+            else if (k == 1)
+                value = atomic_load_explicit(&room->msgs_in, memory_order_relaxed);
+            else
+                value = atomic_load_explicit(&room->msgs_out, memory_order_relaxed);
+
+            text_appendf(&tb, "%s{room=\"%" PRIu64 "\",title=\"", names[k], room->id);
+            text_append_label(&tb, room->title);
+            text_appendf(&tb, "\"} %lu\n", value);
+        }
+    }
+    pthread_mutex_unlock(&room_registry_lock);
+
+    *len = tb.len;
+    return tb.data;
+}
+
+void send_menu(int client_fd)
+{
+    // 바이너리 모드는 메뉴 없이 요청 코드로 조작
+    if (conns[client_fd].binary)
+        return;
+
+    const char *menu_text =
+        "\n=== MENU ===\n"
+        "1: 사용자 이름 설정\n"
+        "2: 채팅방 입장\n"
+        "3: 채팅방 개설\n"
+        "4: 접속 종료\n"
+        "0: 메뉴 재표시\n";
+
+    conn_send(client_fd, menu_text, strlen(menu_text));
+}
+
+
+void send_room_list(int client_fd)
+{
+    char buffer[LARGE_BUFF_SIZE];
+
+    // 바이너리 모드는 글자 수 제한 없이 모든 채팅방을 번호, 인원, 이름으로 전송
+    if (conns[client_fd].binary)
+    {
+        TextBuf tb;
+        proto_begin(&tb, RES_ROOMS);
+        pthread_mutex_unlock(&client_lock);
+        lock_mutex(&room_registry_lock);
+        proto_append_varint(&tb, room_count);
+        for (int i = 0; i < room_chunk_count * ROOM_CHUNK; i++)
+        {
+            ChatRoom *room = room_at(i);
+            if (!room->active)
+                continue;
+            proto_append_varint(&tb, room->id);
+            proto_append_varint(&tb, room->user_count);
+            proto_append_str(&tb, room->title);
+        }
+        pthread_mutex_unlock(&room_registry_lock);
+        lock_mutex(&client_lock);
+
+        Payload *rooms = proto_finish(&tb);
+        if (rooms != NULL)
+        {
+            conn_write_parts(client_fd, &rooms, 1);
+            payload_unref(rooms);
+        }
+        return;
+    }
+
+    pthread_mutex_unlock(&client_lock);
+    lock_mutex(&room_registry_lock);
+    if (room_count <= 0)
+    {
+        pthread_mutex_unlock(&room_registry_lock);
+        lock_mutex(&client_lock);
+        const char *msg = "개설된 채팅방이 없습니다.\n";
+        conn_send(client_fd, msg, strlen(msg));
+        return;
+    }
+
+    int offset = snprintf(buffer, sizeof(buffer), "\n채팅방 번호 입력 (되돌아가기: b)\n\n=== ChatRoom info ===\n");
+
+    for (int i = 0; i < room_chunk_count * ROOM_CHUNK; i++)
+    {
+        ChatRoom *room = room_at(i);
+        if (!room->active)
+            continue;
+
+        char line[MEDIUM_BUFF_SIZE];
+        int len = snprintf(line, sizeof(line), "%" PRIu64 ": %s (%d/%d)\n",
+                           room->id, room->title,
+                           room->user_count, MAX_ROOM_USERS);
+
+        if (offset + len < sizeof(buffer))
+        {
+            memcpy(buffer + offset, line, len);
+            offset += len;
+            buffer[offset] = '\0'; // 안전하게 null-terminate
+        }
+        else
+        {
+            break; // 더 이상 공간이 없으면 중단
+        }
+    }
+    pthread_mutex_unlock(&room_registry_lock);
+    lock_mutex(&client_lock);
+    conn_send(client_fd, buffer, offset);
+}
+
+void send_chatroom_info(ChatRoom *room, int idx)
+{
+    char status[SMALL_BUFF_SIZE];
+
+    if (room->mode == CHAT_MODE)
+        strcpy(status, "Chat");
+    else if (room->mode == GAME_MODE)
+        strcpy(status, "Game");
+    else if (room->mode == POLL_MODE)
+        strcpy(status, "Poll");
+    else
+        strcpy(status, "????");
+
+    char info[LARGE_BUFF_SIZE];
+    snprintf(info, sizeof(info), "<<<<< %s >>>>>\n", room->title);
+
+    char line[MEDIUM_BUFF_SIZE];
+    snprintf(line, sizeof(line), "참여인원: %d\n", room->user_count);
+
+    if (strlen(info) + strlen(line) < sizeof(info))
+    {
+        strcat(info, line);
+    }
+
+
+    snprintf(line, sizeof(line), "모드: %s\n", status);
+    if (strlen(info) + strlen(line) < sizeof(info))
+    {
+        strcat(info, line);
+    }
+
+    // 하트비트로 잰 참여자별 왕복 시간 (응답하지 않는 클라이언트는 "-")
+    for (int i = 0; i < room->user_count; i++)
+    {
+        Connection *conn = &conns[room->user_fds[i]];
+        char rtt[16], rtt_max[16];
+        format_rtt(rtt, sizeof(rtt), conn->rtt_us);
+        format_rtt(rtt_max, sizeof(rtt_max), conn->rtt_max_us);
+        if (conn->rtt_us == 0)
+            snprintf(line, sizeof(line), "지연: %s -\n", room->user_names[i]);
+        else
+            snprintf(line, sizeof(line), "지연: %s %s (최대 %s)\n", room->user_names[i], rtt, rtt_max);
+        if (strlen(info) + strlen(line) < sizeof(info))
+        {
+            strcat(info, line);
+        }
+    }
+
+    conn_send(room->user_fds[idx], info, strlen(info));
+}
+
+int find_client_index(int fd)
+{
+    if (fd < 0 || fd >= max_conns)
+        return -1;
+    return client_slot_of[fd];
+}
+
+ClientInfo *client_at(int slot)
+{
+    return &client_chunks[slot / CLIENT_CHUNK][slot % CLIENT_CHUNK];
+}
+
+int alloc_client(int fd)
+{
+    if (client_count >= max_clients)
+        return -1;
+
+    // 빈 슬롯이 없으면 슬롯 묶음을 하나 더 할당해 빈 슬롯 목록에 연결
+    if (client_free == -1)
+    {
+        ClientInfo **chunks = realloc(client_chunks, sizeof(ClientInfo *) * (client_chunk_count + 1));
+        if (chunks == NULL)
+            return -1;
+        client_chunks = chunks;
+
+        ClientInfo *chunk = calloc(CLIENT_CHUNK, sizeof(ClientInfo));
+        if (chunk == NULL)
+            return -1;
+        client_chunks[client_chunk_count] = chunk;
+
+        int base = client_chunk_count * CLIENT_CHUNK;
+        for (int k = 0; k < CLIENT_CHUNK; k++)
+        {
+            chunk[k].fd = -1;
+            chunk[k].next_free = k + 1 < CLIENT_CHUNK ? base + k + 1 : -1;
+        }
+        client_free = base;
+        client_chunk_count++;
+    }
+
+    int slot = client_free;
+    ClientInfo *client = client_at(slot);
+    client_free = client->next_free;
+
+    client->fd = fd;
+    client->user_name[0] = '\0';
+    client->state = STATE_LOBBY;
+    client->room = NULL;
+    client->next_free = -1;
+    client->token = 0;
+    client_slot_of[fd] = slot;
+    client_count++;
+    return slot;
+}
+
+uint64_t session_new_token()
+{
+    if (session_grace == 0)
+        return 0;
+
+    // 다른 사용자의 세션을 추측해 가로채지 못하도록 커널 난수 사용 (실패하면 시각과 주소로 대체)
+    uint64_t token = 0;
+    if (getrandom(&token, sizeof(token), GRND_NONBLOCK) != sizeof(token))
+        token = now_ns() ^ ((uint64_t)(uintptr_t)&token << 17) ^ (uint64_t)rand() << 32;
+    return token != 0 ? token : 1;
+}
+
+void session_save(ClientInfo *client, int in_room, uint64_t room_id, uint64_t seq)
+{
+    if (session_grace == 0 || client->token == 0)
+        return;
+
+    Session *session = malloc(sizeof(Session));
+    if (session == NULL)
+        return;
+    session->token = client->token;
+    snprintf(session->user_name, sizeof(session->user_name), "%s", client->user_name);
+    session->in_room = in_room;
+    session->room_id = room_id;
+    session->seq = seq;
+    session->expires = time(NULL) + session_grace;
+
+    lock_mutex(&session_lock);
+    // 재접속을 기다리는 세션도 최대 접속 수까지만 보관
+    if (session_count >= max_clients)
+    {
+        pthread_mutex_unlock(&session_lock);
+        free(session);
+        return;
+    }
+    Session **bucket = &session_buckets[session->token % SESSION_BUCKETS];
+    session->next = *bucket;
+    *bucket = session;
+    session_count++;
+    pthread_mutex_unlock(&session_lock);
+}
+
+int session_take(const char *token, Session *out)
+{
+    char *end;
+    errno = 0;
+    uint64_t value = strtoull(token, &end, 16);
+    if (errno != 0 || end == token || *end != '\0' || value == 0)
+        return 0;
+
+    // 한 토큰으로는 한 번만 재접속할 수 있도록 찾으면 목록에서 뺌
+    int found = 0;
+    lock_mutex(&session_lock);
+    Session **link = &session_buckets[value % SESSION_BUCKETS];
+    while (*link != NULL)
+    {
+        Session *session = *link;
+        if (session->token == value)
+        {
+            *link = session->next;
+            session_count--;
+            found = session->expires > time(NULL);
+            *out = *session;
+            free(session);
+            break;
+        }
+        link = &session->next;
+    }
+    pthread_mutex_unlock(&session_lock);
+    return found;
+}
+
+void session_sweep()
+{
+    if (session_grace == 0)
+        return;
+
+    time_t now = time(NULL);
+    lock_mutex(&session_lock);
+    for (int b = 0; b < SESSION_BUCKETS && session_count > 0; b++)
+    {
+        Session **link = &session_buckets[b];
+        while (*link != NULL)
+        {
+            Session *session = *link;
+            if (session->expires > now)
+            {
+                link = &session->next;
+                continue;
+            }
+            log_lobby(LOG_INFO, "사용자 %s - 재접속 대기 시간이 지나 세션을 정리합니다.", session->user_name);
+            *link = session->next;
+            session_count--;
+            free(session);
+        }
+    }
+    pthread_mutex_unlock(&session_lock);
+}
+
+void send_session(int fd, uint64_t token)
+{
+    if (token == 0)
+        return;
+
+    char hex[SESSION_TOKEN_LEN + 1];
+    snprintf(hex, sizeof(hex), "%016" PRIx64, token);
+    if (conns[fd].binary)
+    {
+        proto_reply(fd, RES_SESSION, -1, hex);
+        return;
+    }
+
+    char msg[MEDIUM_LARGE_BUFF_SIZE];
+    snprintf(msg, sizeof(msg), "[SESSION] 재접속 토큰 %s (연결이 끊기면 %d초 안에 이름 대신 \"RESUME %s\"를 보내 이어서 접속)\n",
+             hex, session_grace, hex);
+    conn_send(fd, msg, strlen(msg));
+}
+
+int get_user_index(ChatRoom *room, int fd)
+{
+    for (int i = 0; i < room->user_count; i++)
+    {
+        if (room->user_fds[i] == fd)
+            return i;
+    }
+    return -1;
+}
+
+ChatRoom *room_at(int slot)
+{
+    return &room_chunks[slot / ROOM_CHUNK][slot % ROOM_CHUNK];
+}
+
+ChatRoom *create_room(const char *title, int persistent)
+{
+    if (room_count >= MAX_CHATROOMS)
+        return NULL;
+
+    // 빈 슬롯이 없으면 슬롯 묶음을 하나 더 할당 (락은 이때 한 번만 초기화)
+    if (room_free == -1)
+    {
+        ChatRoom **chunks = realloc(room_chunks, sizeof(ChatRoom *) * (room_chunk_count + 1));
+        if (chunks == NULL)
+            return NULL;
+        room_chunks = chunks;
+
+        ChatRoom *chunk = calloc(ROOM_CHUNK, sizeof(ChatRoom));
+        if (chunk == NULL)
+            return NULL;
+        room_chunks[room_chunk_count] = chunk;
+
+        int base = room_chunk_count * ROOM_CHUNK;
+        for (int k = 0; k < ROOM_CHUNK; k++)
+        {
+            pthread_mutex_init(&chunk[k].lock, NULL);
+            chunk[k].slot = base + k;
+            chunk[k].next_free = k + 1 < ROOM_CHUNK ? base + k + 1 : -1;
+        }
+        room_free = base;
+        room_chunk_count++;
+    }
+
+    // 해시 버킷이 채팅방 수보다 적으면 두 배로 늘려 다시 배치
+    if ((size_t)room_count >= room_bucket_count)
+    {
+        size_t new_count = room_bucket_count ? room_bucket_count * 2 : ROOM_CHUNK;
+        ChatRoom **buckets = calloc(new_count, sizeof(ChatRoom *));
+        if (buckets == NULL)
+            return NULL;
+
+        for (size_t b = 0; b < room_bucket_count; b++)
+        {
+            ChatRoom *room = room_buckets[b];
+            while (room != NULL)
+            {
+                ChatRoom *next = room->hash_next;
+                room->hash_next = buckets[room->id % new_count];
+                buckets[room->id % new_count] = room;
+                room = next;
+            }
+        }
+        free(room_buckets);
+        room_buckets = buckets;
+        room_bucket_count = new_count;
+    }
+
+    int slot = room_free;
+    ChatRoom *room = room_at(slot);
+    room_free = room->next_free;
+
+    lock_mutex(&room->lock);
+    room->id = next_room_id++;
+    snprintf(room->title, sizeof(room->title), "%s", title);
+    room->user_count = 0;
+    room->mode = CHAT_MODE;
+    room->game_host_fd = -1;
+    memset(room->game_answer, 0, sizeof(room->game_answer));
+    reset_poll_state(room);
+    room->reactor = room->id % reactor_count; // 채팅방을 reactor에 고르게 분배
+    room->active = 1;
+    room->persistent = persistent;
+    room->idle_since = time(NULL);
+    room->next_free = -1;
+    room->history_loaded = 1; // 새 채팅방은 불러올 기록이 없음
+    room->history_loading = 0;
+    room->seq = 0;
+    atomic_store(&room->msgs_in, 0);
+    atomic_store(&room->msgs_out, 0);
+    pthread_mutex_unlock(&room->lock);
+
+    room->hash_next = room_buckets[room->id % room_bucket_count];
+    room_buckets[room->id % room_bucket_count] = room;
+    room_count++;
+    return room;
+}
+
+ChatRoom *find_room(uint64_t id)
+{
+    if (room_bucket_count == 0)
+        return NULL;
+
+    for (ChatRoom *room = room_buckets[id % room_bucket_count]; room != NULL; room = room->hash_next)
+    {
+        if (room->id == id)
+            return room;
+    }
+    return NULL;
+}
+
+void release_room(ChatRoom *room)
+{
+    ChatRoom **link = &room_buckets[room->id % room_bucket_count];
+    while (*link != room)
+        link = &(*link)->hash_next;
+    *link = room->hash_next;
+
+    // 투표 항목, 최근 메시지, 타이머 등 채팅방이 가진 자원 해제
+    reset_poll_state(room);
+    timer_cancel(&room->game_timer);
+    history_clear(room);
+    store_drop(room->id);
+    room->mode = CHAT_MODE;
+    room->title[0] = '\0';
+    room->active = 0;
+    room->hash_next = NULL;
+
+    room->next_free = room_free;
+    room_free = room->slot;
+    room_count--;
+}
+
+void sweep_idle_rooms()
+{
+    uint64_t expirations;
+    if (read(room_sweep_fd, &expirations, sizeof(expirations)) < 0)
+        return;
+
+    if (room_idle_timeout == 0)
+        return;
+
+    time_t now = time(NULL);
+
+    lock_mutex(&room_registry_lock);
+    for (int i = 0; i < room_chunk_count * ROOM_CHUNK; i++)
+    {
+        ChatRoom *room = room_at(i);
+        if (!room->active || room->persistent)
+            continue;
+
+        // 락이 잡혀 있는 채팅방은 사용 중이므로 기다리지 않고 건너뜀
+        if (pthread_mutex_trylock(&room->lock) != 0)
+            continue;
+
+        if (room->user_count == 0 && now - room->idle_since >= room_idle_timeout)
+        {
+            log_lobby(LOG_INFO, "빈 채팅방 %s (%" PRIu64 ") 회수", room->title, room->id);
+            release_room(room);
+        }
+        pthread_mutex_unlock(&room->lock);
+    }
+    pthread_mutex_unlock(&room_registry_lock);
+}
+
+void history_push(ChatRoom *room, Payload *frame)
+{
+    if (room_history_size == 0)
+    {
+        payload_unref(frame);
+        return;
+    }
+
+    // 가득 차면 가장 오래된 메시지 자리에 덮어씀
+    payload_unref(room->history[room->history_head]);
+    room->history[room->history_head] = frame;
+    room->history_head = (room->history_head + 1) % room_history_size;
+    if (room->history_count < room_history_size)
+        room->history_count++;
+}
+
+void history_merge(ChatRoom *room, Payload **frames, int count)
+{
+    // 불러오는 동안 쌓인 메시지를 오래된 것부터 잠시 빼 둠
+    Payload *recent[ROOM_HISTORY_MAX];
+    int kept = room->history_count;
+    for (int k = 0; k < kept; k++)
+    {
+        int at = (room->history_head - kept + k + room_history_size) % room_history_size;
+        recent[k] = room->history[at];
+        room->history[at] = NULL;
+    }
+    room->history_head = 0;
+    room->history_count = 0;
+
+    for (int k = 0; k < count; k++)
+        history_push(room, frames[k]);
+    for (int k = 0; k < kept; k++)
+        history_push(room, recent[k]);
+}
+
+void history_send(ChatRoom *room, int fd, Payload *header, int n)
+{
+    Payload *parts[MAX_IOV];
+    int count = 0;
+
+    if (header != NULL)
+        parts[count++] = header;
+
+    // 오래된 것부터 순서대로 (송신 큐에는 복사 없이 참조만 들어감)
+    if (n > room->history_count)
+        n = room->history_count;
+    for (int k = n; k > 0; k--)
+        parts[count++] = room->history[(room->history_head - k + room_history_size) % room_history_size];
+
+    conn_send_parts(fd, parts, count);
+}
+
+void history_resume(ChatRoom *room, int fd, uint64_t seq)
+{
+    // 끊긴 뒤 쌓인 메시지 수 (번호는 채팅방마다 1씩 늘어나므로 차이가 곧 놓친 개수)
+    int gap = seq < room->seq ? (int)(room->seq - seq < INT_MAX ? room->seq - seq : INT_MAX) : 0;
+
+    char entered[MEDIUM_LARGE_BUFF_SIZE] = "";
+    if (!conns[fd].binary)
+        snprintf(entered, sizeof(entered), "채팅방 %s (%" PRIu64 ")에 다시 입장했습니다.\n", room->title, room->id);
+
+    // 메모리에 남은 것보다 많이 놓쳤으면 디스크의 로그에서 바로 전송
+    if (gap > room->history_count && store_dir != NULL)
+    {
+        conn_send(fd, entered, strlen(entered));
+        store_catchup(room, fd, gap, conns[fd].binary);
+        return;
+    }
+
+    Payload *header;
+    if (gap == 0)
+        header = payload_printf("%s[NOTICE] 놓친 메시지가 없습니다.\n", entered);
+    else if (gap > room->history_count)
+        header = payload_printf("%s[NOTICE] 놓친 메시지 %d개 중 최근 %d개만 남아 있습니다.\n===== [RESUME] 놓친 메시지 %d개 =====\n",
+                                entered, gap, room->history_count, room->history_count);
+    else
+        header = payload_printf("%s===== [RESUME] 놓친 메시지 %d개 =====\n", entered, gap);
+    if (header != NULL)
+    {
+        if (conns[fd].binary)
+            history_replay(room, fd, header, gap);
+        else
+            history_send(room, fd, header, gap);
+        payload_unref(header);
+    }
+}
+
+void history_replay(ChatRoom *room, int fd, Payload *header, int n)
+{
+    Payload *parts[MAX_IOV];
+    int count = 0;
+
+    Payload *text = proto_pack(RES_TEXT, -1, header->data, header->len, 0);
+    if (text != NULL)
+        parts[count++] = text;
+
+    // 기록은 메시지 번호마다 하나씩 쌓이므로 k번째로 최근 메시지의 번호는 room->seq - k + 1
+    if (n > room->history_count)
+        n = room->history_count;
+    for (int k = n; k > 0; k--)
+    {
+        Payload *frame = room->history[(room->history_head - k + room_history_size) % room_history_size];
+        uint64_t seq = room->seq - k + 1;
+        Payload *replay = proto_pack(RES_REPLAY, (int64_t)seq, frame->data, frame->len, 0);
+        if (replay == NULL)
+            continue;
+        replay->seq = seq;
+        parts[count++] = replay;
+    }
+
+    conn_write_parts(fd, parts, count);
+    for (int k = 0; k < count; k++)
+        payload_unref(parts[k]);
+}
+
+void history_clear(ChatRoom *room)
+{
+    for (int k = 0; k < ROOM_HISTORY_MAX; k++)
+    {
+        payload_unref(room->history[k]);
+        room->history[k] = NULL;
+    }
+    room->history_head = 0;
+    room->history_count = 0;
+}
+
+void init_store()
+{
+    if (mkdir(store_dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror("mkdir");
+        exit(EXIT_FAILURE);
+    }
+
+    store_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (store_wake_fd < 0 || pthread_create(&store_tid, NULL, store_thread, NULL) != 0)
+    {
+        perror("init_store");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int store_restore()
+{
+    DIR *dir = opendir(store_dir);
+    if (dir == NULL)
+        return 0;
+
+    // 채팅방 목록이 번호 순서대로 보이도록 번호를 모아 정렬한 뒤 만듦
+    uint64_t *ids = NULL;
+    int count = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        uint64_t id;
+        if (strncmp(ent->d_name, "room-", 5) != 0 || !parse_valid_id(ent->d_name + 5, &id))
+            continue;
+
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            uint64_t *grown = realloc(ids, sizeof(uint64_t) * cap);
+            if (grown == NULL)
+                break;
+            ids = grown;
+        }
+        ids[count++] = id;
+    }
+    closedir(dir);
+    qsort(ids, count, sizeof(uint64_t), cmp_u64);
+
+    // 채팅방 정보 파일만 읽고 메시지 로그는 처음 입장할 때 불러오므로 로그 크기와 무관하게 빠름
+    int restored = 0;
+    for (int k = 0; k < count; k++)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/meta", store_dir, ids[k]);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+
+        // 정보 파일: 첫 줄은 기본 채팅방 여부, 둘째 줄은 제목
+        int persistent = 0;
+        char title[MEDIUM_BUFF_SIZE] = "";
+        if (fscanf(fp, "%d\n", &persistent) != 1 || fgets(title, sizeof(title), fp) == NULL)
+        {
+            fclose(fp);
+            log_write(LOG_WARN, "[STORE] 채팅방 정보를 읽을 수 없습니다: %s", path);
+            continue;
+        }
+        fclose(fp);
+        title[strcspn(title, "\n")] = '\0';
+
+        next_room_id = ids[k];
+        ChatRoom *room = create_room(title, persistent);
+        if (room == NULL)
+            break;
+        room->history_loaded = 0;
+        restored++;
+    }
+
+    // 이후 새로 만드는 채팅방은 저장된 번호와 겹치지 않게 함
+    if (count > 0)
+        next_room_id = ids[count - 1] + 1;
+    free(ids);
+    return restored;
+}
+
+void store_create(ChatRoom *room)
+{
+    if (store_dir == NULL)
+        return;
+
+    StoreOp *op = calloc(1, sizeof(StoreOp));
+    if (op == NULL)
+        return;
+    op->kind = STORE_CREATE;
+    op->room_id = room->id;
+    op->persistent = room->persistent;
+    op->payload = payload_new(room->title, strlen(room->title));
+    store_enqueue(op);
+}
+
+void store_append(ChatRoom *room, Payload *frame)
+{
+    if (store_dir == NULL)
+        return;
+
+    StoreOp *op = malloc(sizeof(StoreOp));
+    if (op == NULL)
+        return;
+    op->kind = STORE_APPEND;
+    op->room_id = room->id;
+    op->payload = payload_ref(frame);
+    store_enqueue(op);
+}
+
+void store_drop(uint64_t room_id)
+{
+    if (store_dir == NULL)
+        return;
+
+    StoreOp *op = calloc(1, sizeof(StoreOp));
+    if (op == NULL)
+        return;
+    op->kind = STORE_DROP;
+    op->room_id = room_id;
+    store_enqueue(op);
+}
+
+void store_enqueue(StoreOp *op)
+{
+    // 목록이 비어 있을 때만 깨우면 저장 스레드가 처리하는 동안 쌓인 요청은 시스템 콜 없이 추가됨
+    pthread_mutex_lock(&store_lock);
+    int was_empty = store_queue == NULL;
+    op->next = store_queue;
+    store_queue = op;
+    pthread_mutex_unlock(&store_lock);
+
+    if (was_empty)
+    {
+        uint64_t one = 1;
+        if (write(store_wake_fd, &one, sizeof(one)) < 0)
+            perror("write");
+    }
+}
+
+void *store_thread(void *arg)
+{
+    // 시그널 핸들러가 이 스레드를 기다리므로 시그널은 다른 스레드에서 받음
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    while (1)
+    {
+        uint64_t wakeups;
+        if (read(store_wake_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EINTR)
+        {
+            perror("read");
+            return NULL;
+        }
+
+        // 잠시 기다려 그동안 들어온 요청까지 한 번의 fsync로 묶음 (그룹 커밋)
+        if (!atomic_load(&store_stopping))
+            usleep(STORE_COMMIT_DELAY_US);
+
+        pthread_mutex_lock(&store_lock);
+        StoreOp *ops = store_queue;
+        store_queue = NULL;
+        pthread_mutex_unlock(&store_lock);
+
+        // 최근 요청이 앞에 있으므로 뒤집어서 들어온 순서대로 처리
+        StoreOp *ordered = NULL;
+        while (ops != NULL)
+        {
+            StoreOp *next = ops->next;
+            ops->next = ordered;
+            ordered = ops;
+            ops = next;
+        }
+        store_apply(ordered);
+
+        if (atomic_load(&store_stopping))
+        {
+            pthread_mutex_lock(&store_lock);
+            int empty = store_queue == NULL;
+            pthread_mutex_unlock(&store_lock);
+            if (empty)
+                return NULL;
+        }
+    }
+}
+
+void store_shutdown()
+{
+    if (store_dir == NULL || store_wake_fd < 0)
+        return;
+
+    atomic_store(&store_stopping, 1);
+
+    uint64_t one = 1;
+    if (write(store_wake_fd, &one, sizeof(one)) < 0)
+        perror("write");
+    pthread_join(store_tid, NULL);
+}
+
+void store_apply(StoreOp *ops)
+{
+    char path[PATH_MAX];
+    StoreFile *dirty = NULL;
+
+    // 같은 채팅방에 이어지는 메시지는 모아서 writev 한 번으로 기록
+    struct iovec iov[MAX_IOV];
+    int iov_count = 0;
+    size_t iov_bytes = 0;
+    StoreFile *pending = NULL;
+
+    for (StoreOp *op = ops; op != NULL; op = op->next)
+    {
+        if (op->kind == STORE_APPEND)
+        {
+            StoreFile *f = store_file(op->room_id);
+            if (f == NULL)
+                continue;
+
+            if (pending != NULL && (pending != f || iov_count == MAX_IOV))
+            {
+                store_write(pending, iov, iov_count, &dirty);
+                pending = NULL;
+                iov_count = 0;
+                iov_bytes = 0;
+            }
+            if (f->fd < 0 && store_open_segment(f) < 0)
+                continue;
+
+            // 세그먼트가 가득 차면 모아 둔 것을 기록하고 다음 세그먼트로 넘어감
+            if (f->size + iov_bytes > 0 && f->size + iov_bytes + op->payload->len > STORE_SEGMENT_SIZE)
+            {
+                if (pending != NULL)
+                    store_write(pending, iov, iov_count, &dirty);
+                pending = NULL;
+                iov_count = 0;
+                iov_bytes = 0;
+                store_roll(f);
+                if (f->fd < 0)
+                    continue;
+            }
+
+            iov[iov_count].iov_base = op->payload->data;
+            iov[iov_count].iov_len = op->payload->len;
+            iov_count++;
+            iov_bytes += op->payload->len;
+            pending = f;
+            continue;
+        }
+
+        // 다른 요청보다 앞서 들어온 메시지를 먼저 기록
+        if (pending != NULL)
+        {
+            store_write(pending, iov, iov_count, &dirty);
+            pending = NULL;
+            iov_count = 0;
+            iov_bytes = 0;
+        }
+
+        if (op->kind == STORE_CREATE)
+        {
+            snprintf(path, sizeof(path), "%s/room-%" PRIu64, store_dir, op->room_id);
+            if (mkdir(path, 0755) < 0 && errno != EEXIST)
+            {
+                log_write(LOG_ERROR, "[STORE] %s 생성 실패: %s", path, strerror(errno));
+                continue;
+            }
+
+            snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/meta", store_dir, op->room_id);
+            FILE *fp = fopen(path, "w");
+            if (fp == NULL)
+            {
+                log_write(LOG_ERROR, "[STORE] %s 생성 실패: %s", path, strerror(errno));
+                continue;
+            }
+            fprintf(fp, "%d\n%.*s\n", op->persistent, (int)op->payload->len, op->payload->data);
+            fflush(fp);
+            fsync(fileno(fp));
+            fclose(fp);
+        }
+        else if (op->kind == STORE_DROP)
+        {
+            StoreFile *f = store_file(op->room_id);
+            if (f != NULL && f->fd >= 0)
+            {
+                close(f->fd);
+                f->fd = -1;
+                store_open_count--;
+            }
+            if (f != NULL)
+            {
+                f->segment = -1;
+                f->size = 0;
+            }
+
+            long *segments = NULL;
+            int count = store_list_segments(op->room_id, &segments);
+            for (int k = 0; k < count; k++)
+            {
+                snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/%08ld.log", store_dir, op->room_id, segments[k]);
+                unlink(path);
+            }
+            free(segments);
+
+            snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/meta", store_dir, op->room_id);
+            unlink(path);
+            snprintf(path, sizeof(path), "%s/room-%" PRIu64, store_dir, op->room_id);
+            rmdir(path);
+        }
+        else if (op->kind == STORE_CATCHUP)
+        {
+            // 앞서 들어온 메시지가 세그먼트에 모두 기록된 상태이므로 파일만 보면 됨
+            store_read_catchup(op);
+        }
+        else if (op->kind == STORE_LOAD)
+        {
+            store_read_history(op);
+        }
+    }
+    if (pending != NULL)
+        store_write(pending, iov, iov_count, &dirty);
+
+    // 묶음에서 기록한 세그먼트마다 fsync 한 번
+    for (StoreFile *f = dirty; f != NULL; f = f->dirty_next)
+    {
+        if (f->fd >= 0 && fdatasync(f->fd) < 0)
+            log_write(LOG_ERROR, "[STORE] 채팅방 %" PRIu64 " fsync 실패: %s", f->room_id, strerror(errno));
+        f->dirty = 0;
+    }
+
+    // 기록이 끝났으므로 요청과 메시지 참조 해제 (결과를 넘길 요청은 reactor가 해제)
+    while (ops != NULL)
+    {
+        StoreOp *next = ops->next;
+        if (ops->kind == STORE_LOAD || ops->kind == STORE_CATCHUP)
+        {
+            store_complete(ops);
+        }
+        else
+        {
+            payload_unref(ops->payload);
+            free(ops);
+        }
+        ops = next;
+    }
+
+    // 열린 파일이 너무 많으면 모두 닫음 (다음에 기록할 때 다시 열림)
+    if (store_open_count > STORE_MAX_OPEN)
+    {
+        for (int b = 0; b < STORE_BUCKETS; b++)
+        {
+            for (StoreFile *f = store_files[b]; f != NULL; f = f->next)
+            {
+                if (f->fd >= 0)
+                    close(f->fd);
+                f->fd = -1;
+            }
+        }
+        store_open_count = 0;
+    }
+}
+
+void store_write(StoreFile *f, struct iovec *iov, int count, StoreFile **dirty)
+{
+    ssize_t n = writev(f->fd, iov, count);
+    if (n < 0)
+    {
+        log_write(LOG_ERROR, "[STORE] 채팅방 %" PRIu64 " 로그 기록 실패: %s", f->room_id, strerror(errno));
+        return;
+    }
+    f->size += n;
+
+    if (!f->dirty)
+    {
+        f->dirty = 1;
+        f->dirty_next = *dirty;
+        *dirty = f;
+    }
+}
+
+StoreFile *store_file(uint64_t room_id)
+{
+    StoreFile **bucket = &store_files[room_id % STORE_BUCKETS];
+    for (StoreFile *f = *bucket; f != NULL; f = f->next)
+    {
+        if (f->room_id == room_id)
+            return f;
+    }
+
+    StoreFile *f = calloc(1, sizeof(StoreFile));
+    if (f == NULL)
+        return NULL;
+    f->room_id = room_id;
+    f->fd = -1;
+    f->segment = -1;
+    f->next = *bucket;
+    *bucket = f;
+    return f;
+}
+
+int store_open_segment(StoreFile *f)
+{
+    char path[PATH_MAX];
+
+    // 이어서 쓸 세그먼트는 처음 한 번만 디렉터리에서 찾음
+    if (f->segment < 0)
+    {
+        long *segments = NULL;
+        int count = store_list_segments(f->room_id, &segments);
+        f->segment = count > 0 ? segments[count - 1] : 0;
+        free(segments);
+    }
+
+    snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/%08ld.log", store_dir, f->room_id, f->segment);
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        log_write(LOG_ERROR, "[STORE] %s 열기 실패: %s", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    off_t size = st.st_size;
+
+    // 기록 도중 종료되어 마지막 줄이 잘렸으면 완성된 줄까지만 남김
+    char tail[LARGE_BUFF_SIZE];
+    while (size > 0)
+    {
+        off_t from = size > (off_t)sizeof(tail) ? size - (off_t)sizeof(tail) : 0;
+        ssize_t n = pread(fd, tail, size - from, from);
+        if (n <= 0)
+            break;
+        while (n > 0 && tail[n - 1] != '\n')
+            n--;
+        if (n > 0)
+        {
+            size = from + n;
+            break;
+        }
+        size = from;
+    }
+    if (size != st.st_size)
+    {
+        log_write(LOG_WARN, "[STORE] %s 끝의 잘린 줄 %lld바이트 제거", path, (long long)(st.st_size - size));
+        if (ftruncate(fd, size) < 0)
+            perror("ftruncate");
+    }
+
+    f->fd = fd;
+    f->size = size;
+    store_open_count++;
+    return 0;
+}
+
+void store_roll(StoreFile *f)
+{
+    char path[PATH_MAX];
+
+    fdatasync(f->fd);
+    close(f->fd);
+    f->fd = -1;
+    store_open_count--;
+
+    f->segment++;
+    snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/%08ld.log", store_dir, f->room_id, f->segment);
+    f->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (f->fd < 0)
+    {
+        log_write(LOG_ERROR, "[STORE] %s 생성 실패: %s", path, strerror(errno));
+        return;
+    }
+    f->size = 0;
+    store_open_count++;
+
+    // 새 세그먼트의 디렉터리 항목도 디스크에 남도록 디렉터리를 fsync
+    snprintf(path, sizeof(path), "%s/room-%" PRIu64, store_dir, f->room_id);
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    // 보관 개수를 넘은 가장 오래된 세그먼트 삭제
+    if (f->segment >= STORE_KEEP_SEGMENTS)
+    {
+        snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/%08ld.log", store_dir, f->room_id, f->segment - STORE_KEEP_SEGMENTS);
+        unlink(path);
+    }
+}
+
+int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int store_list_segments(uint64_t room_id, long **segments)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/room-%" PRIu64, store_dir, room_id);
+
+    *segments = NULL;
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+
+    int count = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        char *end;
+        long segment = strtol(ent->d_name, &end, 10);
+        if (!isdigit((unsigned char)ent->d_name[0]) || strcmp(end, ".log") != 0)
+            continue;
+
+        if (count == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            long *grown = realloc(*segments, sizeof(long) * cap);
+            if (grown == NULL)
+                break;
+            *segments = grown;
+        }
+        (*segments)[count++] = segment;
+    }
+    closedir(dir);
+
+    qsort(*segments, count, sizeof(long), cmp_long);
+    return count;
+}
+
+int store_tail_ranges(uint64_t room_id, int n, StoreRange *ranges, int *range_count)
+{
+    int found = 0;
+    *range_count = 0;
+
+    // 최신 세그먼트부터 거슬러 올라가며 n줄이 시작하는 위치를 찾음 (보관 개수만큼만 살펴봄)
+    long *segments = NULL;
+    int count = store_list_segments(room_id, &segments);
+    for (int k = count - 1; k >= 0 && found < n && *range_count < STORE_KEEP_SEGMENTS; k--)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/room-%" PRIu64 "/%08ld.log", store_dir, room_id, segments[k]);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        // 필요한 끝부분의 페이지만 실제로 읽히므로 세그먼트 크기와 무관하게 빠름
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            continue;
+        }
+
+        // 기록 도중 잘린 마지막 줄은 건너뜀
+        off_t end = st.st_size;
+        while (end > 0 && map[end - 1] != '\n')
+            end--;
+
+        off_t start = end;
+        while (start > 0 && found < n)
+        {
+            char *nl = memrchr(map, '\n', start - 1);
+            start = nl != NULL ? nl - map + 1 : 0;
+            found++;
+        }
+        munmap(map, st.st_size);
+
+        if (start == end)
+        {
+            close(fd);
+            continue;
+        }
+
+        // 오래된 구간이 앞에 오도록 앞으로 끼워 넣음
+        memmove(ranges + 1, ranges, sizeof(StoreRange) * *range_count);
+        ranges[0].fd = fd;
+        ranges[0].off = start;
+        ranges[0].len = end - start;
+        (*range_count)++;
+    }
+    free(segments);
+    return found;
+}
+
+void store_load(ChatRoom *room)
+{
+    room->history_loaded = 1;
+    if (store_dir == NULL || room_history_size == 0)
+        return;
+
+    StoreOp *op = calloc(1, sizeof(StoreOp));
+    if (op == NULL)
+        return;
+    op->kind = STORE_LOAD;
+    op->room_id = room->id;
+    op->count = room_history_size;
+    op->reactor = room->reactor;
+    room->history_loading = 1;
+    store_enqueue(op);
+}
+
+void store_read_history(StoreOp *op)
+{
+    StoreRange ranges[STORE_KEEP_SEGMENTS];
+    int range_count;
+    store_tail_ranges(op->room_id, op->count, ranges, &range_count);
+    op->frames = store_read_lines(ranges, range_count, -1, &op->frame_count);
+}
+
+void store_complete(StoreOp *op)
+{
+    Reactor *r = &reactors[op->reactor];
+
+    pthread_mutex_lock(&r->handoff_lock);
+    op->next = r->store_done;
+    r->store_done = op;
+    pthread_mutex_unlock(&r->handoff_lock);
+
+    uint64_t one = 1;
+    if (write(r->notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("write");
+}
+
+void store_deliver(Reactor *r, StoreOp *op)
+{
+    if (op->kind == STORE_CATCHUP)
+    {
+        // 연결은 소유한 reactor에서만 닫히므로, 그쪽에서 처리해야 연결 정리와 겹치지 않음
+        Connection *conn = &conns[op->fd];
+        if (conn->serial == op->serial && conn->reactor != r->id)
+        {
+            op->reactor = conn->reactor;
+            store_complete(op);
+            return;
+        }
+        store_send_catchup(op);
+    }
+    else
+    {
+        store_finish_load(op);
+    }
+
+    // 보내지 못하고 남은 것 정리
+    for (int k = 0; k < op->range_count; k++)
+    {
+        if (op->ranges[k].fd >= 0)
+            close(op->ranges[k].fd);
+    }
+    for (int k = 0; k < op->frame_count; k++)
+        payload_unref(op->frames[k]);
+    free(op->frames);
+    payload_unref(op->payload);
+    free(op);
+}
+
+void store_finish_load(StoreOp *op)
+{
+    // 그사이 채팅방이 회수되었으면 버림 (슬롯은 재사용되므로 번호로 다시 찾음)
+    lock_mutex(&room_registry_lock);
+    ChatRoom *room = find_room(op->room_id);
+    if (room != NULL)
+    {
+        lock_mutex(&room->lock);
+        history_merge(room, op->frames, op->frame_count);
+        op->frame_count = 0;
+        room->history_loading = 0;
+        log_room(LOG_INFO, room, "저장된 최근 메시지 %d개를 불러왔습니다.", room->history_count);
+        pthread_mutex_unlock(&room->lock);
+    }
+    pthread_mutex_unlock(&room_registry_lock);
+}
+
+int store_catchup(ChatRoom *room, int fd, int n, int replay)
+{
+    Connection *conn = &conns[fd];
+    lock_mutex(&conn->out_lock);
+    int busy = conn->catchup_hold;
+    pthread_mutex_unlock(&conn->out_lock);
+    if (busy)
+        return 0;
+
+    StoreOp *op = calloc(1, sizeof(StoreOp));
+    if (op == NULL)
+        return 1;
+
+    // 지난 메시지보다 새 메시지가 먼저 도착하지 않도록 큐에 넣을 때까지 붙잡아 둠
+    // (채팅방 락 안에서 걸므로 이 뒤의 브로드캐스트는 모두 held 목록으로 감)
+    lock_mutex(&conn->out_lock);
+    conn->catchup_hold = 1;
+    pthread_mutex_unlock(&conn->out_lock);
+
+    op->kind = STORE_CATCHUP;
+    op->room_id = room->id;
+    op->fd = fd;
+    op->serial = conns[fd].serial;
+    op->count = n;
+    op->last_seq = replay ? (int64_t)room->seq : -1;
+    store_enqueue(op);
+    return 1;
+}
+
+void store_read_catchup(StoreOp *op)
+{
+    int found = store_tail_ranges(op->room_id, op->count, op->ranges, &op->range_count);
+
+    // 바이너리 모드 재접속은 번호를 확인하고 이어 갈 수 있도록 파일 내용을 메시지 단위로 나눠 보냄
+    if (op->last_seq >= 0 && found > 0)
+    {
+        op->frames = store_read_lines(op->ranges, op->range_count, op->last_seq - found + 1, &op->frame_count);
+        op->range_count = 0;
+    }
+
+    if (found > 0)
+        op->payload = payload_printf("===== [HISTORY] 최근 메시지 %d개 =====\n", found);
+    else
+        op->payload = payload_printf("[NOTICE] 기록된 메시지가 없습니다.\n");
+
+    // 디스크 읽기는 여기서 미리 시작해 두어 reactor의 sendfile이 페이지 캐시에서 읽도록 함
+    for (int k = 0; k < op->range_count; k++)
+        posix_fadvise(op->ranges[k].fd, op->ranges[k].off, op->ranges[k].len, POSIX_FADV_WILLNEED);
+
+    // 송신 큐에는 연결을 소유한 reactor가 넣음 (그사이 넘어가면 그 reactor가 다시 넘김)
+    op->reactor = conns[op->fd].reactor;
+}
+
+void store_send_catchup(StoreOp *op)
+{
+    // 그사이 연결이 끊겼거나 fd가 다른 연결에 재사용되었으면 보내지 않음 (붙잡아 둔 메시지는 연결 정리 때 해제됨)
+    Connection *conn = &conns[op->fd];
+    if (conn->serial != op->serial)
+        return;
+
+    // 바이너리 모드는 파일 구간까지 하나의 RES_TEXT 문자열이 되도록 전체 길이를 머리에 기록
+    if (op->payload != NULL && conn->binary)
+    {
+        size_t file_bytes = 0;
+        for (int k = 0; k < op->range_count; k++)
+            file_bytes += op->ranges[k].len;
+        Payload *wrapped = proto_pack(RES_TEXT, -1, op->payload->data, op->payload->len, file_bytes);
+        payload_unref(op->payload);
+        op->payload = wrapped;
+    }
+
+    lock_mutex(&conn->out_lock);
+    conn->catchup_hold = 0;
+    if (!conn->closing && !conn->lagging && op->payload != NULL)
+    {
+        conn_enqueue(conn, op->payload, 0);
+        op->payload = NULL;
+        for (int k = 0; k < op->range_count; k++)
+        {
+            conn_enqueue_file(conn, op->ranges[k].fd, op->ranges[k].off, op->ranges[k].len);
+            op->ranges[k].fd = -1;
+        }
+        for (int k = 0; k < op->frame_count; k++)
+        {
+            conn_enqueue(conn, op->frames[k], 0);
+            op->frames[k] = NULL;
+        }
+    }
+
+    // 기다리는 동안 모아 둔 새 메시지를 지난 메시지 뒤에 이어 붙임
+    if (conn->held_head != NULL)
+    {
+        if (conn->out_tail != NULL)
+            conn->out_tail->next = conn->held_head;
+        else
+            conn->out_head = conn->held_head;
+        conn->out_tail = conn->held_tail;
+        conn->held_head = NULL;
+        conn->held_tail = NULL;
+    }
+    pthread_mutex_unlock(&conn->out_lock);
+
+    // 송신 큐가 비어 있었다면 EPOLLOUT이 오지 않으므로 여기서 보내기 시작
+    conn_flush(op->fd);
+}
+
+Payload **store_read_lines(StoreRange *ranges, int range_count, int64_t first_seq, int *count)
+{
+    Payload **lines = NULL;
+    int cap = 0;
+    *count = 0;
+
+    for (int k = 0; k < range_count; k++)
+    {
+        off_t base = ranges[k].off & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+        size_t map_len = ranges[k].off - base + ranges[k].len;
+        char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, ranges[k].fd, base);
+        close(ranges[k].fd);
+        if (map == MAP_FAILED)
+            continue;
+
+        char *line = map + (ranges[k].off - base);
+        char *end = map + map_len;
+        while (line < end)
+        {
+            char *nl = memchr(line, '\n', end - line);
+            size_t len = (nl != NULL ? nl + 1 : end) - line;
+            line += len;
+
+            if (*count == cap)
+            {
+                int new_cap = cap ? cap * 2 : 64;
+                Payload **grown = realloc(lines, sizeof(Payload *) * new_cap);
+                if (grown == NULL)
+                    break;
+                lines = grown;
+                cap = new_cap;
+            }
+            Payload *payload;
+            if (first_seq >= 0)
+            {
+                payload = proto_pack(RES_REPLAY, first_seq + *count, line - len, len, 0);
+                if (payload != NULL)
+                    payload->seq = first_seq + *count;
+            }
+            else
+            {
+                payload = payload_new(line - len, len);
+            }
+            if (payload == NULL)
+                break;
+            lines[(*count)++] = payload;
+        }
+        munmap(map, map_len);
+    }
+    return lines;
+}
+
+void init_connections()
+{
+    struct rlimit rl;
+
+    // 접속자 수는 fd 한도로만 제한되도록 소프트 한도를 하드 한도까지 올림
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur == RLIM_INFINITY)
+        max_conns = 65536;
+    else
+        max_conns = (int)rl.rlim_cur;
+
+    conns = calloc(max_conns, sizeof(Connection));
+    client_slot_of = malloc(sizeof(int) * max_conns);
+    if (conns == NULL || client_slot_of == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int fd = 0; fd < max_conns; fd++)
+        client_slot_of[fd] = -1;
+
+    // 리스닝 소켓과 epoll, 채팅방 로그 파일 등이 쓰는 fd를 제외한 나머지를 클라이언트에 사용
+    int reserved = 64 + (store_dir != NULL ? STORE_MAX_OPEN : 0);
+    max_clients = max_conns > reserved ? max_conns - reserved : max_conns;
+}
+
+int conn_recv(int fd, int flags)
+{
+    Connection *conn = &conns[fd];
+
+    // 이미 처리한 프레임은 앞으로 당겨 공간 확보
+    if (conn->in_off > 0)
+    {
+        memmove(conn->in_buf, conn->in_buf + conn->in_off, conn->in_len - conn->in_off);
+        conn->in_len -= conn->in_off;
+        conn->in_off = 0;
+    }
+
+    // 여유 공간이 부족하면 두 배로 확장
+    if (conn->in_cap - conn->in_len < INPUT_BUFF_INIT)
+    {
+        size_t new_cap = conn->in_cap ? conn->in_cap * 2 : INPUT_BUFF_INIT * 2;
+        char *new_buf = pool_realloc(conn->in_buf, new_cap);
+        if (new_buf == NULL)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+        conn->in_buf = new_buf;
+        conn->in_cap = new_cap;
+    }
+
+    // 마지막 바이트는 프레임 종료 문자 자리로 남겨 둠
+    int n = recv(fd, conn->in_buf + conn->in_len, conn->in_cap - conn->in_len - 1, flags);
+    if (n > 0)
+        conn->in_len += n;
+    return n;
+}
+
+int conn_read(int fd)
+{
+    while (1)
+    {
+        // 한 연결이 빠르게 보내도 입력 버퍼가 한없이 커지거나 같은 reactor의 다른 연결이 밀리지 않도록 일정량만 읽음
+        if (conns[fd].in_len - conns[fd].in_off >= INPUT_BACKLOG_BYTES)
+            return 2;
+
+        int n = conn_recv(fd, MSG_DONTWAIT);
+        if (n > 0)
+            continue;
+        if (n == 0)
+            return 0;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 1;
+
+        // 그 밖의 에러(ECONNRESET 등)는 연결 종료로 취급
+        log_write(LOG_DEBUG, "[INFO] recv 실패로 연결 종료 (%d): %s", fd, strerror(errno));
+        return 0;
+    }
+}
+
+char *conn_next_frame(int fd)
+{
+    Connection *conn = &conns[fd];
+
+    while (conn->in_off < conn->in_len)
+    {
+        char *start = conn->in_buf + conn->in_off;
+        size_t avail = conn->in_len - conn->in_off;
+        char *nl = memchr(start, '\n', avail);
+
+        // 잘린 긴 줄의 나머지는 개행까지 버림
+        if (conn->in_skip)
+        {
+            conn->in_off += nl ? (size_t)(nl - start) + 1 : avail;
+            conn->in_skip = (nl == NULL);
+            continue;
+        }
+
+        size_t len;
+        if (nl != NULL)
+        {
+            len = nl - start;
+            conn->in_off += len + 1;
+        }
+        else if (avail >= MAX_FRAME_SIZE)
+        {
+            // 개행 없이 최대 길이를 넘으면 앞부분만 처리하고 나머지는 버림
+            len = avail;
+            conn->in_off = conn->in_len;
+            conn->in_skip = 1;
+        }
+        else
+        {
+            return NULL;
+        }
+
+        if (len > MAX_FRAME_SIZE)
+            len = MAX_FRAME_SIZE;
+        start[len] = '\0';
+
+        // CRLF 입력 허용
+        if (len > 0 && start[len - 1] == '\r')
+            start[len - 1] = '\0';
+
+        // 하트비트 응답은 로비/채팅방 상태와 관계없이 여기서 처리
+        // 하트비트를 켠 연결의 "/pong 번호"와 이름 바로 다음 줄의 시작 요청 "/pong 0"만 가로채고 나머지는 일반 입력으로 넘김
+        // (시작 요청은 -p 0이어도 삼켜서 클라이언트가 보낸 요청이 로비 명령으로 처리되지 않게 함)
+        conn->lines_in++;
+        if (strncmp(start, "/pong ", 6) == 0 && start[6] != '\0' && strspn(start + 6, "0123456789") == strlen(start + 6))
+        {
+            uint32_t nonce = (uint32_t)strtoul(start + 6, NULL, 10);
+            if (conn->heartbeat || (nonce == 0 && conn->lines_in == 2))
+            {
+                handle_pong(fd, nonce);
+                continue;
+            }
+        }
+
+        conn->last_input = time(NULL);
+        atomic_fetch_add_explicit(&stats_thread()->msgs_in, 1, memory_order_relaxed);
+        return start;
+    }
+    return NULL;
+}
+
+char *conn_next_packet(int fd, size_t *len)
+{
+    Connection *conn = &conns[fd];
+
+    for (;;)
+    {
+        const char *start = conn->in_buf + conn->in_off;
+        const char *end = conn->in_buf + conn->in_len;
+        const char *p = start;
+        uint64_t body_len;
+
+        int r = proto_get_varint(&p, end, &body_len);
+        if (r == 0)
+            return NULL;
+
+        // 줄 단위와 달리 길이가 잘못되면 다음 메시지의 시작을 알 수 없으므로 연결을 끊음
+        if (r < 0 || body_len == 0 || body_len > MAX_FRAME_SIZE)
+        {
+            log_write(LOG_WARN, "[INFO] 잘못된 바이너리 메시지로 연결 종료 (%d)", fd);
+            conn->in_off = conn->in_len;
+            lock_mutex(&conn->out_lock);
+            conn->closing = 1;
+            conn_clear_queue(conn);
+            pthread_mutex_unlock(&conn->out_lock);
+            shutdown(fd, SHUT_RDWR);
+            return NULL;
+        }
+        if ((size_t)(end - p) < body_len)
+            return NULL;
+
+        conn->in_off += (p - start) + body_len;
+
+        // 하트비트 응답은 로비/채팅방 상태와 관계없이 여기서 처리
+        if ((uint8_t)p[0] == REQ_PONG)
+        {
+            const char *q = p + 1;
+            uint64_t nonce = 0;
+            proto_get_varint(&q, p + body_len, &nonce);
+            handle_pong(fd, (uint32_t)nonce);
+            continue;
+        }
+
+        conn->last_input = time(NULL);
+        *len = body_len;
+        atomic_fetch_add_explicit(&stats_thread()->msgs_in, 1, memory_order_relaxed);
+        return (char *)p;
+    }
+}
+
+int conn_frame_ready(int fd)
+{
+    Connection *conn = &conns[fd];
+    const char *start = conn->in_buf + conn->in_off;
+    size_t avail = conn->in_len - conn->in_off;
+    if (avail == 0)
+        return 0;
+
+    if (!conn->binary)
+        return conn->in_skip || avail >= MAX_FRAME_SIZE || memchr(start, '\n', avail) != NULL;
+
+    // 길이가 잘못된 메시지도 꺼내야 연결이 끊기므로 있는 것으로 봄
+    const char *p = start;
+    uint64_t body_len;
+    int r = proto_get_varint(&p, start + avail, &body_len);
+    return r < 0 || (r > 0 && (size_t)(start + avail - p) >= body_len);
+}
+
+int conn_handshake(int fd, char *name, size_t size, int64_t *resume_seq)
+{
+    Connection *conn = &conns[fd];
+
+    if (!conn->binary)
+    {
+        if (conn->in_len == conn->in_off)
+            return 0;
+
+        // 텍스트 모드: 첫 줄이 사용자 이름 ("RESUME 토큰 [마지막 메시지 번호]"이면 재접속)
+        if (conn->in_buf[conn->in_off] != PROTO_MAGIC[0])
+        {
+            char *frame = conn_next_frame(fd);
+            if (frame == NULL)
+                return 0;
+            if (strncmp(frame, "RESUME ", 7) == 0)
+            {
+                char *end;
+                char *token = trim(frame + 7);
+                char *arg = strchr(token, ' ');
+                if (arg != NULL)
+                {
+                    *arg++ = '\0';
+                    long long seq = strtoll(arg, &end, 10);
+                    if (end != arg && seq >= 0)
+                        *resume_seq = seq;
+                }
+                snprintf(name, size, "%s", token);
+                return 2;
+            }
+            snprintf(name, size, "%s", frame);
+            return 1;
+        }
+
+        if (conn->in_len - conn->in_off < PROTO_MAGIC_LEN)
+            return 0;
+        if (memcmp(conn->in_buf + conn->in_off, PROTO_MAGIC, PROTO_MAGIC_LEN) != 0)
+            return -1;
+        conn->in_off += PROTO_MAGIC_LEN;
+        conn->binary = 1;
+    }
+
+    // 바이너리 모드: 매직 다음 메시지는 REQ_HELLO {이름} 또는 REQ_RESUME {마지막 메시지 번호, 토큰}
+    size_t len;
+    char *packet = conn_next_packet(fd, &len);
+    if (packet == NULL)
+        return conn->closing ? -1 : 0;
+
+    const char *p = packet + 1;
+    if ((unsigned char)packet[0] == REQ_RESUME)
+    {
+        uint64_t seq;
+        if (proto_get_varint(&p, packet + len, &seq) != 1 || seq > INT64_MAX || !proto_get_str(&p, packet + len, name, size))
+            return -1;
+        *resume_seq = (int64_t)seq;
+        return 2;
+    }
+    if ((unsigned char)packet[0] != REQ_HELLO || !proto_get_str(&p, packet + len, name, size))
+        return -1;
+    return 1;
+}
+
+void conn_open(int fd)
+{
+    Connection *conn = &conns[fd];
+    memset(conn, 0, sizeof(*conn));
+    pthread_mutex_init(&conn->out_lock, NULL);
+    conn->serial = atomic_fetch_add(&conn_serial_next, 1) + 1;
+}
+
+void conn_reset(int fd)
+{
+    Connection *conn = &conns[fd];
+
+    // 내장된 타이머가 휠에 남지 않도록 초기화 전에 취소
+    timer_cancel(&conn->hs_timer);
+    timer_cancel(&conn->idle_timer);
+    timer_cancel(&conn->ping_timer);
+    timer_cancel(&conn->rate_timer);
+
+    lock_mutex(&conn->out_lock);
+    conn_clear_queue(conn);
+    pthread_mutex_unlock(&conn->out_lock);
+    pthread_mutex_destroy(&conn->out_lock);
+
+    pool_free(conn->in_buf);
+    memset(conn, 0, sizeof(*conn));
+}
+
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void *pool_alloc(size_t size)
+{
+    size_t cls = 0;
+    while (cls < POOL_CLASSES && ((size_t)1 << (cls + POOL_MIN_SHIFT)) < size)
+        cls++;
+
+    PoolBlock *block;
+    if (cls == POOL_CLASSES)
+    {
+        block = malloc(sizeof(PoolBlock) + size);
+        if (block == NULL)
+            return NULL;
+        block->cls = cls;
+        return block + 1;
+    }
+
+    PoolList *cache = &pool_cache[cls];
+    if (cache->head == NULL)
+        pool_refill(cls);
+    block = cache->head;
+    if (block != NULL)
+    {
+        cache->head = block->next;
+        cache->count--;
+        return block + 1;
+    }
+
+    block = malloc(sizeof(PoolBlock) + ((size_t)1 << (cls + POOL_MIN_SHIFT)));
+    if (block == NULL)
+        return NULL;
+    block->cls = cls;
+    atomic_fetch_add_explicit(&pool_depots[cls].blocks, 1, memory_order_relaxed);
+    return block + 1;
+}
+
+void pool_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    PoolBlock *block = (PoolBlock *)ptr - 1;
+    if (block->cls == POOL_CLASSES)
+    {
+        free(block);
+        return;
+    }
+
+    // 다른 스레드가 할당한 블록도 반환한 스레드의 캐시에 넣고, 넘치면 공용 저장소로 보냄
+    PoolList *cache = &pool_cache[block->cls];
+    block->next = cache->head;
+    cache->head = block;
+    if (++cache->count > POOL_CACHE_MAX)
+        pool_spill(block->cls);
+}
+
+void *pool_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        return pool_alloc(size);
+
+    PoolBlock *block = (PoolBlock *)ptr - 1;
+    if (block->cls < POOL_CLASSES && size <= ((size_t)1 << (block->cls + POOL_MIN_SHIFT)))
+        return ptr;
+
+    // 등급보다 큰 블록은 malloc 블록이므로 realloc으로 키움
+    if (block->cls == POOL_CLASSES)
+    {
+        PoolBlock *grown = realloc(block, sizeof(PoolBlock) + size);
+        return grown != NULL ? grown + 1 : NULL;
+    }
+
+    void *moved = pool_alloc(size);
+    if (moved == NULL)
+        return NULL;
+    memcpy(moved, ptr, (size_t)1 << (block->cls + POOL_MIN_SHIFT));
+    pool_free(ptr);
+    return moved;
+}
+
+void pool_refill(size_t cls)
+{
+    PoolDepot *depot = &pool_depots[cls];
+    PoolList *cache = &pool_cache[cls];
+
+    pthread_mutex_lock(&depot->lock);
+    while (depot->free.head != NULL && cache->count < POOL_BATCH)
+    {
+        PoolBlock *block = depot->free.head;
+        depot->free.head = block->next;
+        depot->free.count--;
+        block->next = cache->head;
+        cache->head = block;
+        cache->count++;
+    }
+    pthread_mutex_unlock(&depot->lock);
+}
+
+void pool_spill(size_t cls)
+{
+    PoolDepot *depot = &pool_depots[cls];
+    PoolList *cache = &pool_cache[cls];
+    int limit = POOL_DEPOT_BYTES >> (cls + POOL_MIN_SHIFT);
+
+    // 공용 저장소가 가득 차면 시스템에 반환해 오래 켜 두어도 쌓아 두는 양이 일정하게 유지됨
+    PoolBlock *excess = NULL;
+    pthread_mutex_lock(&depot->lock);
+    for (int k = 0; k < POOL_BATCH && cache->head != NULL; k++)
+    {
+        PoolBlock *block = cache->head;
+        cache->head = block->next;
+        cache->count--;
+        if (depot->free.count < limit)
+        {
+            block->next = depot->free.head;
+            depot->free.head = block;
+            depot->free.count++;
+        }
+        else
+        {
+            block->next = excess;
+            excess = block;
+        }
+    }
+    pthread_mutex_unlock(&depot->lock);
+
+    while (excess != NULL)
+    {
+        PoolBlock *next = excess->next;
+        free(excess);
+        atomic_fetch_sub_explicit(&depot->blocks, 1, memory_order_relaxed);
+        excess = next;
+    }
+}
+
+char *poll_arena_strdup(ChatRoom *room, const char *str)
+{
+    size_t len = strnlen(str, MEDIUM_BUFF_SIZE - 1);
+    if (room->poll_arena_used + len + 1 > sizeof(room->poll_arena))
+        len = 0;
+
+    char *copy = room->poll_arena + room->poll_arena_used;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    room->poll_arena_used += len + 1;
+    return copy;
+}
+
+Payload *payload_new(const char *data, size_t len)
+{
+    Payload *payload = pool_alloc(sizeof(Payload) + len);
+    if (payload == NULL)
+        return NULL;
+    atomic_init(&payload->refcnt, 1);
+    payload->seq = 0;
+    payload->len = len;
+    memcpy(payload->data, data, len);
+    return payload;
+}
+
+Payload *payload_printf(const char *fmt, ...)
+{
+    char buffer[MAX_FRAME_SIZE + MEDIUM_BUFF_SIZE];
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+
+    if (len < 0)
+        return NULL;
+    if ((size_t)len >= sizeof(buffer))
+        len = sizeof(buffer) - 1;
+    return payload_new(buffer, len);
+}
+
+Payload *payload_ref(Payload *payload)
+{
+    atomic_fetch_add_explicit(&payload->refcnt, 1, memory_order_relaxed);
+    return payload;
+}
+
+void payload_unref(Payload *payload)
+{
+    if (payload != NULL && atomic_fetch_sub_explicit(&payload->refcnt, 1, memory_order_acq_rel) == 1)
+        pool_free(payload);
+}
+
+Payload *proto_pack(int op, int64_t id, const char *str, size_t len, size_t extra)
+{
+    Payload *payload = pool_alloc(sizeof(Payload) + PROTO_HEAD_MAX + len);
+    if (payload == NULL)
+        return NULL;
+    atomic_init(&payload->refcnt, 1);
+    payload->seq = 0;
+    payload->len = proto_build(payload->data, op, id, str, len, extra);
+    return payload;
+}
+
+void proto_reply(int fd, int op, int64_t id, const char *str)
+{
+    Payload *payload = proto_pack(op, id, str, str != NULL ? strlen(str) : 0, 0);
+    if (payload != NULL)
+    {
+        conn_write_parts(fd, &payload, 1);
+        payload_unref(payload);
+    }
+}
+
+Payload *proto_pack_msg(int64_t uid, const char *str, uint64_t seq)
+{
+    TextBuf tb;
+    proto_begin(&tb, RES_MSG);
+    proto_append_varint(&tb, uid);
+    proto_append_str(&tb, str);
+    proto_append_varint(&tb, seq);
+    Payload *payload = proto_finish(&tb);
+    if (payload != NULL)
+        payload->seq = seq;
+    return payload;
+}
+
+void proto_begin(TextBuf *tb, int op)
+{
+    tb->data = malloc(MEDIUM_BUFF_SIZE);
+    tb->len = 0;
+    tb->cap = MEDIUM_BUFF_SIZE;
+    char code = (char)op;
+    text_append(tb, &code, 1);
+}
+
+void proto_append_varint(TextBuf *tb, uint64_t v)
+{
+    char buf[PROTO_MAX_VARINT];
+    text_append(tb, buf, proto_put_varint(buf, v));
+}
+
+void proto_append_str(TextBuf *tb, const char *str)
+{
+    size_t len = strlen(str);
+    proto_append_varint(tb, len);
+    text_append(tb, str, len);
+}
+
+Payload *proto_finish(TextBuf *tb)
+{
+    if (tb->data == NULL)
+        return NULL;
+
+    char head[PROTO_MAX_VARINT];
+    size_t n = proto_put_varint(head, tb->len);
+    Payload *payload = pool_alloc(sizeof(Payload) + n + tb->len);
+    if (payload != NULL)
+    {
+        atomic_init(&payload->refcnt, 1);
+        payload->seq = 0;
+        payload->len = n + tb->len;
+        memcpy(payload->data, head, n);
+        memcpy(payload->data + n, tb->data, tb->len);
+    }
+    free(tb->data);
+    tb->data = NULL;
+    return payload;
+}
+
+void conn_send(int fd, const char *data, size_t len)
+{
+    if (fd < 0 || fd >= max_conns || len == 0)
+        return;
+
+    // 바이너리 모드는 같은 문구를 RES_TEXT로 감싸서 전송
+    if (conns[fd].binary)
+    {
+        Payload *text = proto_pack(RES_TEXT, -1, data, len, 0);
+        if (text != NULL)
+        {
+            conn_write_parts(fd, &text, 1);
+            payload_unref(text);
+        }
+        return;
+    }
+
+    Connection *conn = &conns[fd];
+    lock_mutex(&conn->out_lock);
+
+    // 종료 예정이거나 지연 상태인 연결에는 더 이상 쌓지 않음
+    if (conn->closing || conn->lagging)
+    {
+        pthread_mutex_unlock(&conn->out_lock);
+        return;
+    }
+
+    ThreadStats *stats = stats_thread();
+    atomic_fetch_add_explicit(&stats->msgs_out, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytes_out, len, memory_order_relaxed);
+
+    // 큐가 비어 있으면 바로 전송 시도하고 남은 부분만 큐에 넣음
+    if (conn->out_head == NULL && !conn->catchup_hold)
+    {
+        ssize_t n = send(fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        atomic_fetch_add_explicit(&stats->send_calls, 1, memory_order_relaxed);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                // 끊긴 연결: 수신 측에서 EOF/에러를 보고 정리함
+                conn->closing = 1;
+                pthread_mutex_unlock(&conn->out_lock);
+                return;
+            }
+            n = 0;
+        }
+        data += n;
+        len -= n;
+        if (len == 0)
+        {
+            pthread_mutex_unlock(&conn->out_lock);
+            return;
+        }
+    }
+    else if (conn->out_bytes + len > out_queue_limit && !conn_make_room(conn, fd, len))
+    {
+        pthread_mutex_unlock(&conn->out_lock);
+        return;
+    }
+
+    Payload *payload = payload_new(data, len);
+    if (payload != NULL)
+        conn_enqueue(conn, payload, 0);
+
+    pthread_mutex_unlock(&conn->out_lock);
+}
+
+void conn_send_parts(int fd, Payload **parts, int count)
+{
+    if (fd < 0 || fd >= max_conns || count <= 0 || count > MAX_IOV)
+        return;
+    if (!conns[fd].binary)
+    {
+        conn_write_parts(fd, parts, count);
+        return;
+    }
+
+    // 바이너리 모드: 첫 조각을 RES_TEXT 머리와 합치고 나머지 조각은 그대로 이어 보냄 (문자열 길이에 모두 포함)
+    size_t rest = 0;
+    for (int k = 1; k < count; k++)
+        rest += parts[k]->len;
+    Payload *head = proto_pack(RES_TEXT, -1, parts[0]->data, parts[0]->len, rest);
+    if (head == NULL)
+        return;
+
+    Payload *wrapped[MAX_IOV];
+    wrapped[0] = head;
+    for (int k = 1; k < count; k++)
+        wrapped[k] = parts[k];
+    conn_write_parts(fd, wrapped, count);
+    payload_unref(head);
+}
+
+void conn_write_parts(int fd, Payload **parts, int count)
+{
+    if (fd < 0 || fd >= max_conns || count <= 0 || count > MAX_IOV)
+        return;
+
+    Connection *conn = &conns[fd];
+    size_t total = 0;
+    for (int k = 0; k < count; k++)
+        total += parts[k]->len;
+
+    lock_mutex(&conn->out_lock);
+
+    if (conn->closing || conn->lagging)
+    {
+        pthread_mutex_unlock(&conn->out_lock);
+        return;
+    }
+
+    ThreadStats *stats = stats_thread();
+    atomic_fetch_add_explicit(&stats->msgs_out, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytes_out, total, memory_order_relaxed);
+
+    // 큐가 비어 있으면 조각들을 한 번의 sendmsg로 바로 전송 시도 (모아 보내는 중이면 큐에 넣고 창이 끝날 때 전송)
+    size_t sent = 0;
+    if (conn->out_head == NULL && !out_batching && !conn->catchup_hold)
+    {
+        struct iovec iov[MAX_IOV];
+        for (int k = 0; k < count; k++)
+        {
+            iov[k].iov_base = parts[k]->data;
+            iov[k].iov_len = parts[k]->len;
+        }
+
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = count;
+
+        ssize_t n = sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        atomic_fetch_add_explicit(&stats->send_calls, 1, memory_order_relaxed);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                conn->closing = 1;
+                pthread_mutex_unlock(&conn->out_lock);
+                return;
+            }
+            n = 0;
+        }
+        sent = n;
+        if (sent == total)
+        {
+            for (int k = 0; k < count; k++)
+                conn_mark_sent(conn, parts[k]);
+            pthread_mutex_unlock(&conn->out_lock);
+            return;
+        }
+    }
+    else if (conn->out_bytes + total > out_queue_limit && !conn_make_room(conn, fd, total))
+    {
+        pthread_mutex_unlock(&conn->out_lock);
+        return;
+    }
+
+    // 전송하지 못한 조각은 복사 없이 참조만 큐에 넣음 (첫 조각 뒤는 같은 메시지의 나머지로 표시)
+    for (int k = 0; k < count; k++)
+    {
+        if (sent >= parts[k]->len)
+        {
+            sent -= parts[k]->len;
+            conn_mark_sent(conn, parts[k]);
+            continue;
+        }
+        OutChunk *chunk = conn_enqueue(conn, payload_ref(parts[k]), sent);
+        if (chunk != NULL)
+            chunk->cont = k > 0;
+        sent = 0;
+    }
+
+    // 모아 보내는 중: 충분히 쌓였으면 바로 보내고, 아니면 처음 쌓일 때 한 번만 목록에 넣음
+    int flush_now = out_batching && conn->out_bytes >= coalesce_bytes;
+    int schedule = out_batching && !flush_now && !conn->flush_pending;
+    if (schedule)
+        conn->flush_pending = 1;
+    pthread_mutex_unlock(&conn->out_lock);
+
+    if (flush_now)
+        conn_flush(fd);
+    else if (schedule)
+        coalesce_add(fd);
+}
+
+void conn_mark_sent(Connection *conn, Payload *payload)
+{
+    // 지난 메시지를 다시 보내는 경우(history)에는 번호가 뒤로 가지 않도록 큰 쪽만 남김
+    if (payload->seq > conn->sent_seq)
+        conn->sent_seq = payload->seq;
+}
+
+OutChunk *conn_enqueue(Connection *conn, Payload *payload, size_t off)
+{
+    OutChunk *chunk = pool_alloc(sizeof(OutChunk));
+    if (chunk == NULL)
+    {
+        payload_unref(payload);
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->payload = payload;
+    chunk->off = off;
+    chunk->file_fd = -1;
+    chunk->cont = 0;
+
+    // 디스크의 지난 메시지를 기다리는 중이면 따로 모아 두었다가 그 뒤에 붙임
+    if (conn->catchup_hold)
+    {
+        if (conn->held_tail != NULL)
+            conn->held_tail->next = chunk;
+        else
+            conn->held_head = chunk;
+        conn->held_tail = chunk;
+    }
+    else
+    {
+        if (conn->out_tail != NULL)
+            conn->out_tail->next = chunk;
+        else
+            conn->out_head = chunk;
+        conn->out_tail = chunk;
+    }
+    conn->out_bytes += payload->len - off;
+    return chunk;
+}
+
+int conn_make_room(Connection *conn, int fd, size_t len)
+{
+    if (overflow_policy == OVERFLOW_DISCONNECT)
+    {
+        // 읽기 측이 EOF를 받아 평소 종료 경로로 정리하도록 함
+        conn->closing = 1;
+        conn_clear_queue(conn);
+        shutdown(fd, SHUT_RDWR);
+        log_write(LOG_WARN, "[INFO] 송신 큐 초과로 연결 종료 (%d)", fd);
+        return 0;
+    }
+
+    if (overflow_policy == OVERFLOW_LAG)
+    {
+        // 큐가 모두 빠질 때까지 새 메시지는 버림
+        conn->lagging = 1;
+        return 0;
+    }
+
+    // OVERFLOW_DROP_OLDEST: 전송을 시작한 맨 앞 메시지는 남기고 오래된 것부터 메시지 단위로 버림
+    // (조각 일부만 버리면 바이너리 모드는 길이가 어긋나고 텍스트 모드는 접두어만 남음)
+    OutChunk **link = &conn->out_head;
+    if (*link != NULL && ((*link)->off > 0 || (*link)->cont))
+    {
+        link = &(*link)->next;
+        while (*link != NULL && (*link)->cont)
+            link = &(*link)->next;
+    }
+
+    while (*link != NULL && conn->out_bytes + len > out_queue_limit)
+    {
+        do
+        {
+            OutChunk *victim = *link;
+            *link = victim->next;
+            if (victim->payload != NULL)
+                conn->out_bytes -= victim->payload->len - victim->off;
+            chunk_free(victim);
+        } while (*link != NULL && (*link)->cont);
+    }
+
+    // 꼬리 포인터 재계산
+    conn->out_tail = NULL;
+    for (OutChunk *c = conn->out_head; c != NULL; c = c->next)
+        conn->out_tail = c;
+
+    return conn->out_bytes + len <= out_queue_limit;
+}
+
+void conn_flush(int fd)
+{
+    if (fd < 0 || fd >= max_conns)
+        return;
+
+    Connection *conn = &conns[fd];
+    int rearm = 0;
+    lock_mutex(&conn->out_lock);
+
+    while (conn->out_head != NULL)
+    {
+        // 파일 조각은 사용자 공간으로 복사하지 않고 파일에서 소켓으로 바로 전송
+        // (디스크를 기다리면 같은 reactor의 모든 연결이 멈추므로 한 번에 SENDFILE_CHUNK까지만 보내고 차례를 넘김)
+        OutChunk *head = conn->out_head;
+        if (head->payload == NULL && rearm)
+            break;
+        if (head->payload == NULL)
+        {
+            ssize_t n = conn_send_file(fd, head);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    conn->closing = 1;
+                    conn_clear_queue(conn);
+                }
+                break;
+            }
+
+            // 바이너리 모드는 미리 알린 길이만큼 보내지 못하면 이후 메시지를 해석할 수 없으므로 연결을 끊음
+            if (n == 0 && head->file_len > 0 && conn->binary)
+            {
+                conn->closing = 1;
+                conn_clear_queue(conn);
+                shutdown(fd, SHUT_RDWR);
+                break;
+            }
+
+            // 다 보냈거나 파일이 예상보다 짧으면 다음 조각으로
+            if (head->file_len == 0 || n == 0)
+            {
+                conn->out_head = head->next;
+                if (conn->out_head == NULL)
+                    conn->out_tail = NULL;
+                chunk_free(head);
+            }
+            rearm = n > 0;
+            continue;
+        }
+
+        struct iovec iov[MAX_IOV];
+        int iov_count = 0;
+        for (OutChunk *c = conn->out_head; c != NULL && c->payload != NULL && iov_count < MAX_IOV; c = c->next)
+        {
+            iov[iov_count].iov_base = c->payload->data + c->off;
+            iov[iov_count].iov_len = c->payload->len - c->off;
+            iov_count++;
+        }
+
+        ssize_t n = writev(fd, iov, iov_count);
+        atomic_fetch_add_explicit(&stats_thread()->send_calls, 1, memory_order_relaxed);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                conn->closing = 1;
+                conn_clear_queue(conn);
+            }
+            break;
+        }
 
-                    // 숫자 야구 게임 로직
-                    if (room->mode == GAME_MODE)
-                    {
-                        // 호스트가 정답 입력 전
-                        if (user_fd == room->game_host_fd && strlen(room->game_answer) == 0)
-                        {
-                            buffer[strcspn(buffer, "\r\n")] = '\0';
-                            if (is_valid_number(buffer))
-                            {
-                                strncpy(room->game_answer, buffer, 3);
-                                room->game_answer[3] = '\0';
-
-                                print_log_game(room);
-                                printf("숫자 야구 정답: %s", room->game_answer);
-                                print_time();
-
-                                char msg[MEDIUM_LARGE_BUFF_SIZE];
-                                snprintf(msg, sizeof(msg), "====== 숫자 야구 게임이 시작되었습니다! ======\n===== HOST : %s =====\n", room->game_host_name);
-                                broadcast_to_room(room, msg, -1);
-                            }
-                            else
-                            {
-                                const char *msg = "[GAME] 유효하지 않은 숫자입니다. 다시 입력하세요.\n";
-                                send(user_fd, msg, strlen(msg), 0);
-                            }
-                        }
-                        // 참가자가 추측 입력
-                        else if (user_fd != room->game_host_fd && strlen(room->game_answer) == 3)
-                        {
-                            if (!is_valid_number(buffer))
-                            {
-                                const char *msg = "[GAME] 3자리 숫자를 입력하세요. (중복 없음)\n";
-                                send(user_fd, msg, strlen(msg), 0);
-                                continue;
-                            }
-
-                            int s, b;
-                            evaluate_guess(buffer, room->game_answer, &s, &b);
-
-                            char msg[MEDIUM_LARGE_BUFF_SIZE];
-                            snprintf(msg, sizeof(msg), "[%s] %s의 결과: %d 스트라이크, %d 볼\n", room->user_names[i], buffer, s, b);
-                            broadcast_to_room(room, msg, -1);
-
-                            print_log_game(room);
-                            printf("%s -> %s의 결과: %d 스트라이크, %d 볼", room->user_names[i], buffer, s, b);
-                            print_time();
-
-                            if (s == 3)
-                            {
-                                snprintf(msg, sizeof(msg), "[GAME] %s님이 정답을 맞췄습니다! 게임 종료.\n", room->user_names[i]);
-                                broadcast_to_room(room, msg, -1);
-                                room->mode = CHAT_MODE;
-                                memset(room->game_answer, 0, sizeof(room->game_answer));
-                                print_log_game(room);
-                                printf("%s님 정답 게임 종료.", room->user_names[i]);
-                                print_time();
-                            }
-                        }
-                        continue;
-                    }
+        // 전송된 만큼 앞에서부터 조각 제거
+        conn->out_bytes -= n;
+        while (n > 0)
+        {
+            OutChunk *c = conn->out_head;
+            size_t remain = c->payload->len - c->off;
+            if ((size_t)n < remain)
+            {
+                c->off += n;
+                break;
+            }
+            n -= remain;
+            conn->out_head = c->next;
+            conn_mark_sent(conn, c->payload);
+            chunk_free(c);
+        }
+        if (conn->out_head == NULL)
+            conn->out_tail = NULL;
+    }
 
-                    // "poll" 명령어 처리: 투표 시작 요청
-                    if (strcmp(buffer, "poll") == 0 && room->mode == CHAT_MODE)
-                    {
-                        print_log_poll(room);
-                        printf("사용자 %s - 투표 시작 요청", room->user_names[i]);
-                        print_time();
-                        start_poll(room, user_fd, room->user_names[i]);
+    // 파일을 보내다 멈췄으면 소켓이 아직 쓸 수 있어도 EPOLLOUT이 다시 오도록 감시를 다시 걺
+    if (rearm && conn->out_head != NULL && !conn->closing)
+    {
+        int epfd = reactors[conn->reactor].epfd;
+        pthread_mutex_unlock(&conn->out_lock);
+        epoll_rearm_fd(epfd, fd, CONN_EVENTS);
+        return;
+    }
 
-                        const char *msg = "[POLL] 호스트는 항목개수를 입력하세요 (1 ~ 10)\n";
-                        send(user_fd, msg, strlen(msg), 0);
-                        continue;
-                    }
+    // 지연 상태가 풀리면 누락 사실을 알림
+    if (conn->out_head == NULL && conn->lagging && !conn->closing)
+    {
+        conn->lagging = 0;
+        pthread_mutex_unlock(&conn->out_lock);
+        const char *msg = "[NOTICE] 네트워크 지연으로 일부 메시지가 누락되었습니다.\n";
+        conn_send(fd, msg, strlen(msg));
+        return;
+    }
 
-                    // 투표 진행 중 처리
-                    if (room->mode == POLL_MODE)
-                    {
-                        // 1단계: 항목 개수 입력
-                        if (user_fd == room->game_host_fd && room->poll_mode_stage == 0)
-                        {
-                            buffer[strcspn(buffer, "\r\n")] = 0;
-                            int poll_count;
-                            if (parse_valid_int(buffer, &poll_count) && poll_count > 0 && poll_count <= MAX_POLL)
-                            {
-                                room->poll_count = poll_count;
-                                room->poll_index = 0;
-                                room->poll_mode_stage = 1;
-
-                                const char *msg = "[POLL] 항목 1을 입력하세요.\n";
-                                send(user_fd, msg, strlen(msg), 0);
-                            }
-                            else
-                            {
-                                const char *msg = "[POLL] 유효한 숫자를 입력하세요 (1~10)\n";
-                                send(user_fd, msg, strlen(msg), 0);
-                            }
-                            continue;
-                        }
-
-                        // 2단계: 항목 내용 입력
-                        if (user_fd == room->game_host_fd && room->poll_mode_stage == 1)
-                        {
-                            buffer[strcspn(buffer, "\r\n")] = 0;
-                            room->poll_list[room->poll_index] = malloc(strlen(buffer) + 1);
-                            strcpy(room->poll_list[room->poll_index], buffer);
-                            room->poll_votes[room->poll_index] = 0;
-                            room->poll_index++;
-
-                            if (room->poll_index < room->poll_count)
-                            {
-                                char msg[SMALL_BUFF_SIZE];
-                                snprintf(msg, sizeof(msg), "[POLL] 항목 %d을 입력하세요\n", room->poll_index + 1);
-                                send(user_fd, msg, strlen(msg), 0);
-                            }
-                            else
-                            {
-                                room->poll_mode_stage = 2;
-
-                                print_log_poll(room);
-                                printf("투표 시작");
-                                print_time();
-
-                                // 항목 목록 전체 사용자에게 전송
-                                char list[LARGE_BUFF_SIZE] = "===== [POLL_LIST] =====\n";
-                                for (int i = 0; i < room->poll_count; i++)
-                                {
-                                    char line[MEDIUM_BUFF_SIZE];
-                                    snprintf(line, sizeof(line), "%d. %s\n", i + 1, room->poll_list[i]);
-                                    if (strlen(list) + strlen(line) < sizeof(list))
-                                    {
-                                        strcat(list, line);
-                                    }
-                                }
-
-                                for (int i = 0; i < room->user_count; i++)
-                                {
-                                    send(room->user_fds[i], list, strlen(list), 0);
-                                    room->vote_received[i] = -1;
-                                }
-                            }
-                            continue;
-                        }
-
-                        // 3단계: 사용자 투표 입력
-                        if (room->poll_mode_stage == 2)
-                        {
-                            int user_idx = get_user_index(room, user_fd);
-                            if (user_idx == -1 || room->vote_received[user_idx] != -1)
-                                continue;
-
-                            int vote = atoi(buffer) - 1;
-                            if (vote < 0 || vote >= room->poll_count)
-                            {
-                                const char *msg = "[POLL] 올바른 번호를 입력하세요\n";
-                                send(user_fd, msg, strlen(msg), 0);
-                                continue;
-                            }
-
-                            room->poll_votes[vote]++;
-                            room->vote_received[user_idx] = vote;
-
-                            const char *msg = "선택 완료!\n";
-                            send(user_fd, msg, strlen(msg), 0);
-
-                            // 모든 사용자 투표 완료 확인
-                            int all_voted = 1;
-                            for (int i = 0; i < room->user_count; i++)
-                            {
-                                if (room->vote_received[i] == -1)
-                                {
-                                    all_voted = 0;
-                                    break;
-                                }
-                            }
-
-                            if (all_voted)
-                            {
-                                char list[LARGE_BUFF_SIZE] = "====== [POLL_RESULT] ======\n";
-                                for (int i = 0; i < room->poll_count; i++)
-                                {
-                                    char line[MEDIUM_BUFF_SIZE];
-                                    snprintf(line, sizeof(line), "%s : %d 표\n", room->poll_list[i], room->poll_votes[i]);
-                                    if (strlen(list) + strlen(line) < sizeof(list))
-                                    {
-                                        strcat(list, line);
-                                    }
-                                }
-                                broadcast_to_room(room, list, -1);
-                                print_log_poll(room);
-                                printf("모든 사용자가 투표를 완료했습니다. 투표 종료");
-                                print_time();
-
-                                room->mode = CHAT_MODE;
-                                reset_poll_state(room);
-                            }
-                            continue;
-                        }
-                    }
+    pthread_mutex_unlock(&conn->out_lock);
+}
 
-                    // 일반 메시지 전송 처리
-                    if (room->user_count == 1)
-                    {
-                        // 혼자 있을 경우 알림
-                        const char *msg = "[NOTICE] 현재 채팅방에 혼자 있습니다.\n";
-                        send(user_fd, msg, strlen(msg), 0);
-                        print_log_room(room);
-                        printf("사용자 %s - 혼자여서 메시지를 전달 안 합니다.", room->user_names[i]);
-                        print_time();
-                        continue;
-                    }
-                    else if (room->user_count > 1)
-                    {
-                        // 다수 사용자에게 브로드캐스트
-                        for (int j = 0; j < room->user_count; j++)
-                        {
-                            int target_fd = room->user_fds[j];
-                            char msg[LARGE_BUFF_SIZE];
-
-                            if (target_fd == user_fd)
-                                snprintf(msg, sizeof(msg), "[ME] %s\n", buffer);
-                            else
-                                snprintf(msg, sizeof(msg), "[%s] %s\n", room->user_names[i], buffer);
-
-                            send(target_fd, msg, strlen(msg), 0);
-                        }
-                    }
-                    else
-                    {
-                        // 발생하면 안 되는 비정상 상태
-                        print_log_room(room);
-                        printf("<WARN!> 비정상 상태...\n");
-                        print_time();
-                        room->user_count = 0;
-                        continue;
-                    }
-                }
-            }
+void conn_clear_queue(Connection *conn)
+{
+    OutChunk *lists[2] = {conn->out_head, conn->held_head};
+    for (int k = 0; k < 2; k++)
+    {
+        OutChunk *c = lists[k];
+        while (c != NULL)
+        {
+            OutChunk *next = c->next;
+            chunk_free(c);
+            c = next;
         }
-        pthread_mutex_unlock(&room->lock);
     }
-    return NULL;
+    conn->out_head = NULL;
+    conn->out_tail = NULL;
+    conn->held_head = NULL;
+    conn->held_tail = NULL;
+    conn->out_bytes = 0;
 }
 
-// 로그 출력 함수
-void print_log_lobby()
+void conn_enqueue_file(Connection *conn, int file_fd, off_t off, size_t len)
 {
-    printf("[LOBBY] ");
-    fflush(stdout);
+    OutChunk *chunk = pool_alloc(sizeof(OutChunk));
+    if (chunk == NULL)
+    {
+        close(file_fd);
+        return;
+    }
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->file_fd = file_fd;
+    chunk->file_off = off;
+    chunk->file_len = len;
+    chunk->cont = 1; // 앞의 안내 문구와 같은 메시지
+
+    if (conn->out_tail != NULL)
+        conn->out_tail->next = chunk;
+    else
+        conn->out_head = chunk;
+    conn->out_tail = chunk;
 }
 
-void print_log_room(ChatRoom *room)
+ssize_t conn_send_file(int fd, OutChunk *chunk)
 {
-    printf("[%s] ", room->title);
-    fflush(stdout);
+    size_t len = chunk->file_len < SENDFILE_CHUNK ? chunk->file_len : SENDFILE_CHUNK;
+
+    // 파일 내용은 커널 안에서만 옮겨지므로 SENDFILE_CHUNK당 시스템 콜 한 번
+    ssize_t n = sendfile(fd, chunk->file_fd, &chunk->file_off, len);
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+    {
+        // sendfile을 지원하지 않는 경우 버퍼로 복사해 전송
+        char buf[COPY_CHUNK];
+        ssize_t r = pread(chunk->file_fd, buf, len < sizeof(buf) ? len : sizeof(buf), chunk->file_off);
+        if (r <= 0)
+            return 0;
+        n = send(fd, buf, r, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0)
+            chunk->file_off += n;
+    }
+
+    if (n > 0)
+    {
+        chunk->file_len -= n;
+        chunk->off += n;
+    }
+    return n;
 }
 
-void print_log_game(ChatRoom *room)
+void chunk_free(OutChunk *chunk)
 {
-    printf("[GAME-%s] ", room->title);
-    fflush(stdout);
+    if (chunk->payload != NULL)
+        payload_unref(chunk->payload);
+    if (chunk->file_fd >= 0)
+        close(chunk->file_fd);
+    pool_free(chunk);
 }
 
-void print_log_poll(ChatRoom *room)
+void reactor_handoff(int fd, Reactor *target)
 {
-    printf("[POLL-%s] ", room->title);
-    fflush(stdout);
+    Reactor *source = &reactors[conns[fd].reactor];
+
+    // 소유 reactor를 먼저 바꿔 두면 이전 reactor는 남은 메시지를 처리하지 않음
+    conns[fd].reactor = target->id;
+    epoll_del_fd(source->epfd, fd);
+
+    // 입력 없는 연결 타이머도 대상 reactor의 휠로 옮김 (만료 처리는 소유 reactor에서만 함)
+    if (conn_idle_timeout > 0)
+    {
+        long left = conns[fd].last_input + conn_idle_timeout - time(NULL);
+        timer_set(target, &conns[fd].idle_timer, left > 0 ? left * 1000L : 0, idle_expire, conns[fd].serial);
+    }
+    if (conns[fd].heartbeat)
+        timer_set(target, &conns[fd].ping_timer, ping_interval * 1000L, ping_expire, conns[fd].serial);
+    if (conns[fd].throttled)
+        timer_set(target, &conns[fd].rate_timer, 0, rate_expire, conns[fd].serial);
+
+    pthread_mutex_lock(&target->handoff_lock);
+    if (target->handoff_count == target->handoff_cap)
+    {
+        int cap = target->handoff_cap ? target->handoff_cap * 2 : 16;
+        int *fds = realloc(target->handoff_fds, sizeof(int) * cap);
+        if (fds == NULL)
+        {
+            perror("realloc");
+            pthread_mutex_unlock(&target->handoff_lock);
+            epoll_add_fd(target->epfd, fd, CONN_EVENTS);
+            return;
+        }
+        target->handoff_fds = fds;
+        target->handoff_cap = cap;
+    }
+    target->handoff_fds[target->handoff_count++] = fd;
+    pthread_mutex_unlock(&target->handoff_lock);
+
+    // 이후 도착하는 입력은 대상 reactor의 epoll로 통지됨
+    epoll_add_fd(target->epfd, fd, CONN_EVENTS);
+
+    uint64_t one = 1;
+    if (write(target->notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("write");
 }
 
-void server_state()
+void handle_handoffs(Reactor *r)
 {
-    printf("[INFO] All chatters (%d/%d)", client_count, MAX_CLIENTS);
+    uint64_t count;
+    while (read(r->notify_fd, &count, sizeof(count)) > 0)
+        ;
+
+    // 목록을 통째로 가져와 락을 잡지 않은 채 처리
+    pthread_mutex_lock(&r->handoff_lock);
+    int *fds = r->handoff_fds;
+    int n = r->handoff_count;
+    r->handoff_fds = NULL;
+    r->handoff_count = 0;
+    r->handoff_cap = 0;
+    StoreOp *done = r->store_done;
+    r->store_done = NULL;
+    pthread_mutex_unlock(&r->handoff_lock);
+
+    // 저장 스레드가 넘긴 결과는 최근 것이 앞에 있으므로 뒤집어서 요청한 순서대로 반영
+    StoreOp *ordered = NULL;
+    while (done != NULL)
+    {
+        StoreOp *next = done->next;
+        done->next = ordered;
+        ordered = done;
+        done = next;
+    }
+    while (ordered != NULL)
+    {
+        StoreOp *next = ordered->next;
+        store_deliver(r, ordered);
+        ordered = next;
+    }
+
+    // 넘겨받기 전에 입력 버퍼에 쌓여 있던 메시지 처리
+    for (int k = 0; k < n; k++)
+    {
+        if (conns[fds[k]].reactor == r->id)
+            process_frames(r, fds[k]);
+    }
+    free(fds);
 }
 
-void print_time()
+void coalesce_add(int fd)
 {
-    time_t timer = time(NULL);
-    struct tm *t = localtime(&timer);
-    printf("    (%d-%02d-%02d %02d:%02d:%02d)\n", t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+    Reactor *r = &reactors[conns[fd].reactor];
+
+    pthread_mutex_lock(&r->flush_lock);
+    if (r->flush_count == r->flush_cap)
+    {
+        int cap = r->flush_cap ? r->flush_cap * 2 : 16;
+        int *fds = realloc(r->flush_fds, sizeof(int) * cap);
+        if (fds == NULL)
+        {
+            // 목록에 넣지 못하면 기다리지 않고 바로 전송
+            perror("realloc");
+            pthread_mutex_unlock(&r->flush_lock);
+            conn_flush(fd);
+            return;
+        }
+        r->flush_fds = fds;
+        r->flush_cap = cap;
+    }
+    r->flush_fds[r->flush_count++] = fd;
+
+    // 창의 첫 연결이 타이머를 걸고, 창이 끝날 때까지 들어온 연결은 함께 전송
+    if (r->flush_count == 1)
+    {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = coalesce_ms / 1000;
+        its.it_value.tv_nsec = (coalesce_ms % 1000) * 1000000L;
+        timerfd_settime(r->flush_fd, 0, &its, NULL);
+    }
+    pthread_mutex_unlock(&r->flush_lock);
 }
 
-void send_menu(int client_fd)
+void coalesce_run(Reactor *r)
 {
-    const char *menu_text =
-        "\n=== MENU ===\n"
-        "1: 사용자 이름 설정\n"
-        "2: 채팅방 입장\n"
-        "3: 채팅방 개설\n"
-        "4: 접속 종료\n"
-        "0: 메뉴 재표시\n";
+    uint64_t expirations;
+    while (read(r->flush_fd, &expirations, sizeof(expirations)) > 0)
+        ;
+
+    // 목록을 통째로 가져와 락을 잡지 않은 채 전송 (그사이 들어온 연결은 다음 창에 모임)
+    pthread_mutex_lock(&r->flush_lock);
+    int *fds = r->flush_fds;
+    int n = r->flush_count;
+    r->flush_fds = NULL;
+    r->flush_count = 0;
+    r->flush_cap = 0;
+    pthread_mutex_unlock(&r->flush_lock);
+
+    for (int k = 0; k < n; k++)
+    {
+        Connection *conn = &conns[fds[k]];
+        lock_mutex(&conn->out_lock);
+        conn->flush_pending = 0;
+        pthread_mutex_unlock(&conn->out_lock);
+        conn_flush(fds[k]);
+    }
+    atomic_fetch_add_explicit(&stats_thread()->coalesce_flushes, n, memory_order_relaxed);
+    free(fds);
+}
 
-    send(client_fd, menu_text, strlen(menu_text), 0);
+void wheel_init(TimerWheel *w)
+{
+    memset(w, 0, sizeof(*w));
+    pthread_mutex_init(&w->lock, NULL);
+    w->now = timer_ticks();
+    w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (w->fd < 0)
+    {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
 }
 
+uint64_t timer_ticks()
+{
+    return now_ns() / (TIMER_TICK_MS * 1000000ULL);
+}
 
-void send_room_list(int client_fd)
+void timer_set(Reactor *r, Timer *t, long ms, void (*fn)(Reactor *, Timer *, unsigned long), unsigned long arg)
 {
-    char buffer[LARGE_BUFF_SIZE];
+    timer_cancel(t);
 
-    if (room_count <= 0)
+    TimerWheel *w = &r->wheel;
+    uint64_t ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    lock_mutex(&w->lock);
+
+    // 비어 있던 휠은 현재 틱부터 다시 세고, 틱 timerfd를 켬
+    if (w->count == 0)
     {
-        const char *msg = "개설된 채팅방이 없습니다.\n";
-        send(client_fd, msg, strlen(msg), 0);
-        return;
+        w->now = timer_ticks();
+        struct itimerspec its;
+        its.it_value.tv_sec = TIMER_TICK_MS / 1000;
+        its.it_value.tv_nsec = (TIMER_TICK_MS % 1000) * 1000000L;
+        its.it_interval = its.it_value;
+        timerfd_settime(w->fd, 0, &its, NULL);
     }
 
-    int offset = snprintf(buffer, sizeof(buffer), "\n채팅방 번호 입력 (되돌아가기: b)\n\n=== ChatRoom info ===\n");
+    // 휠이 아직 처리하지 못한 틱이 있어도 만료 시각은 현재 시각 기준 (최소 다음 틱)
+    t->expires = timer_ticks() + (ticks > 0 ? ticks : 1);
+    if (t->expires <= w->now)
+        t->expires = w->now + 1;
+    t->fn = fn;
+    t->arg = arg;
+    t->wheel = r->id;
+    wheel_insert(w, t);
+    w->count++;
+    pthread_mutex_unlock(&w->lock);
+}
 
-    for (int i = 0; i < room_count; i++)
+void timer_cancel(Timer *t)
+{
+    // 등록된 휠의 락을 잡은 뒤 그사이 다른 휠로 옮겨지지 않았는지 다시 확인
+    while (t->pprev != NULL)
     {
-        char line[MEDIUM_BUFF_SIZE];
-        int len = snprintf(line, sizeof(line), "%d: %s (%d/%d)\n",
-                           chatrooms[i].id, chatrooms[i].title,
-                           chatrooms[i].user_count, MAX_ROOM_USERS);
-
-        if (offset + len < sizeof(buffer))
+        int id = t->wheel;
+        TimerWheel *w = &reactors[id].wheel;
+        lock_mutex(&w->lock);
+        if (t->pprev != NULL && t->wheel == id)
         {
-            memcpy(buffer + offset, line, len);
-            offset += len;
-            buffer[offset] = '\0'; // 안전하게 null-terminate
-        }
-        else
-        {
-            break; // 더 이상 공간이 없으면 중단
+            *t->pprev = t->next;
+            if (t->next != NULL)
+                t->next->pprev = t->pprev;
+            t->next = NULL;
+            t->pprev = NULL;
+            w->count--;
         }
+        pthread_mutex_unlock(&w->lock);
     }
-    send(client_fd, buffer, offset, 0);
 }
 
-void send_chatroom_info(ChatRoom *room, int idx)
+void wheel_insert(TimerWheel *w, Timer *t)
 {
-    char status[SMALL_BUFF_SIZE];
+    // 남은 틱 수에 따라 단계를 고름 (1단계 이상은 그 단계의 칸이 돌아올 때 아래 단계로 옮겨짐)
+    uint64_t delta = t->expires - w->now;
+    uint64_t max = 1ULL << (WHEEL_BITS * WHEEL_LEVELS);
+    if (delta >= max)
+    {
+        t->expires = w->now + max - 1;
+        delta = max - 1;
+    }
 
-    if (room->mode == CHAT_MODE)
-        strcpy(status, "Chat");
-    else if (room->mode == GAME_MODE)
-        strcpy(status, "Game");
-    else if (room->mode == POLL_MODE)
-        strcpy(status, "Poll");
-    else
-        strcpy(status, "????");
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+        level++;
 
-    char info[LARGE_BUFF_SIZE];
-    snprintf(info, sizeof(info), "<<<<< %s >>>>>\n", room->title);
+    Timer **slot = &w->slots[level][(t->expires >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)];
+    t->next = *slot;
+    if (t->next != NULL)
+        t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
 
-    char line[MEDIUM_BUFF_SIZE];
-    snprintf(line, sizeof(line), "참여인원: %d\n", room->user_count);
+void timer_run(Reactor *r)
+{
+    TimerWheel *w = &r->wheel;
+    uint64_t expirations;
+    if (read(w->fd, &expirations, sizeof(expirations)) < 0)
+        return;
 
-    if (strlen(info) + strlen(line) < sizeof(info))
+    uint64_t target = timer_ticks();
+    int fired = 0;
+
+    lock_mutex(&w->lock);
+    while (w->now < target && w->count > 0)
     {
-        strcat(info, line);
-    }
+        w->now++;
+
+        // 위 단계의 칸 경계에 도달하면 그 칸의 타이머를 한 단계씩 내려 보냄
+        for (int level = 1; level < WHEEL_LEVELS; level++)
+        {
+            if ((w->now & ((1ULL << (WHEEL_BITS * level)) - 1)) != 0)
+                break;
+            Timer **slot = &w->slots[level][(w->now >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)];
+            Timer *t = *slot;
+            *slot = NULL;
+            while (t != NULL)
+            {
+                Timer *next = t->next;
+                wheel_insert(w, t);
+                t = next;
+            }
+        }
 
+        // 0단계의 현재 칸에 있는 타이머는 모두 만료
+        Timer **slot = &w->slots[0][w->now & (WHEEL_SIZE - 1)];
+        while (*slot != NULL)
+        {
+            Timer *t = *slot;
+            *slot = t->next;
+            t->next = NULL;
+            t->pprev = NULL;
+            w->count--;
 
-    snprintf(line, sizeof(line), "모드: %s\n", status);
-    if (strlen(info) + strlen(line) < sizeof(info))
+            if (fired == w->fire_cap)
+            {
+                int cap = w->fire_cap ? w->fire_cap * 2 : 64;
+                TimerFire *fire = realloc(w->fire, sizeof(TimerFire) * cap);
+                if (fire == NULL)
+                {
+                    perror("realloc");
+                    continue;
+                }
+                w->fire = fire;
+                w->fire_cap = cap;
+            }
+            w->fire[fired].timer = t;
+            w->fire[fired].fn = t->fn;
+            w->fire[fired].arg = t->arg;
+            fired++;
+        }
+    }
+
+    // 남은 타이머가 없으면 틱을 멈춤
+    if (w->count == 0)
     {
-        strcat(info, line);
+        w->now = target;
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        timerfd_settime(w->fd, 0, &its, NULL);
     }
+    pthread_mutex_unlock(&w->lock);
 
-    send(room->user_fds[idx], info, strlen(info), 0);
+    // 콜백은 채팅방 락 등을 잡으므로 휠 락을 놓고 호출 (fire 배열은 이 reactor만 사용)
+    for (int k = 0; k < fired; k++)
+        w->fire[k].fn(r, w->fire[k].timer, w->fire[k].arg);
 }
 
-int find_client_index(int fd)
+void epoll_add_fd(int epfd, int fd, uint32_t events)
 {
-    for (int i = 0; i < client_count; i++)
-    {
-        if (clients[i].fd == fd)
-            return i;
-    }
-    return -1;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        perror("epoll_ctl");
 }
 
-int get_user_index(ChatRoom *room, int fd)
+void epoll_del_fd(int epfd, int fd)
 {
-    for (int i = 0; i < room->user_count; i++)
-    {
-        if (room->user_fds[i] == fd)
-            return i;
-    }
-    return -1;
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) < 0 && errno != ENOENT && errno != EBADF)
+        perror("epoll_ctl");
+}
+
+void epoll_rearm_fd(int epfd, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0 && errno != ENOENT && errno != EBADF)
+        perror("epoll_ctl");
 }
 
 void remove_client(int index)
 {
-    close(clients[index].fd);
-    clients[index] = clients[--client_count];
+    ClientInfo *client = client_at(index);
+    int fd = client->fd;
+
+    // close 이후 같은 fd가 다른 접속에 재사용될 수 있으므로 매핑을 먼저 해제
+    client_slot_of[fd] = -1;
+    conn_reset(fd);
+    close(fd);
+
+    client->fd = -1;
+    client->next_free = client_free;
+    client_free = index;
+    client_count--;
 }
 
 void remove_user(ChatRoom *room, int index)
@@ -1217,6 +6339,7 @@ void remove_user(ChatRoom *room, int index)
         room->mode = CHAT_MODE;
         room->game_host_fd = -1;
         memset(room->game_answer, 0, sizeof(room->game_answer));
+        timer_cancel(&room->game_timer);
         broadcast_to_room(room, "[GAME] 호스트가 나가 게임이 종료되었습니다.\n", -1);
     }
 
@@ -1227,18 +6350,35 @@ void remove_user(ChatRoom *room, int index)
         reset_poll_state(room);
     }
 
-    pthread_mutex_lock(&client_lock);
+    lock_mutex(&client_lock);
     int idx = find_client_index(fd);
     if (idx != -1)
     {
-        clients[idx].state = STATE_LOBBY;
-        clients[idx].room_id = -1;
+        client_at(idx)->state = STATE_LOBBY;
+        client_at(idx)->room = NULL;
     }
     pthread_mutex_unlock(&client_lock);
 
+    // 바이너리 모드 사용자에게 나간 사용자 번호를 알림 (나간 본인에게는 로비로 돌아갔다는 뜻)
+    Payload *left = NULL;
+    for (int k = 0; idx != -1 && k < room->user_count; k++)
+    {
+        int target_fd = room->user_fds[k];
+        if (!conns[target_fd].binary)
+            continue;
+        if (left == NULL && (left = proto_pack(RES_LEFT, idx, NULL, 0, 0)) == NULL)
+            break;
+        conn_write_parts(target_fd, &left, 1);
+    }
+    payload_unref(left);
+
     --room->user_count;
     room->user_fds[index] = room->user_fds[room->user_count];
     room->user_names[index] = room->user_names[room->user_count];
+
+    // 빈 채팅방은 이 시점부터 회수 대기
+    if (room->user_count == 0)
+        room->idle_since = time(NULL);
 }
 
 char *trim(char *str)
@@ -1281,6 +6421,23 @@ bool parse_valid_int(const char *input, int *result)
     return true;
 }
 
+bool parse_valid_id(const char *input, uint64_t *result)
+{
+    char *endptr;
+
+    // 부호나 공백 없이 숫자로만 이루어져야 함
+    if (!isdigit((unsigned char)input[0]))
+        return false;
+
+    errno = 0;
+    unsigned long long val = strtoull(input, &endptr, 10);
+    if (errno == ERANGE || *endptr != '\0')
+        return false;
+
+    *result = (uint64_t)val;
+    return true;
+}
+
 // --- 게임 유틸 함수 ---
 int is_valid_number(const char *num)
 {
@@ -1305,14 +6462,32 @@ void evaluate_guess(const char *guess, const char *answer, int *strikes, int *ba
 
 void broadcast_to_room(ChatRoom *room, const char *msg, int except_fd)
 {
+    // 메시지는 한 번만 복사해 모든 수신자의 송신 큐가 공유 (바이너리 모드 수신자용은 처음 필요할 때 한 번만 만듦)
+    size_t len = strlen(msg);
+    Payload *payload = payload_new(msg, len);
+    if (payload == NULL)
+        return;
+    Payload *wire = NULL;
+
+    uint64_t start = now_ns();
+    unsigned long sent = 0;
+    out_batching = coalesce_ms > 0;
     for (int i = 0; i < room->user_count; i++)
     {
         int fd = room->user_fds[i];
-        if (fd != except_fd)
-        {
-            send(fd, msg, strlen(msg), 0);
-        }
+        if (fd == except_fd)
+            continue;
+        if (!conns[fd].binary)
+            conn_send_parts(fd, &payload, 1);
+        else if (wire != NULL || (wire = proto_pack(RES_TEXT, -1, msg, len, 0)) != NULL)
+            conn_write_parts(fd, &wire, 1);
+        sent++;
     }
+    out_batching = 0;
+    record_fanout(now_ns() - start);
+    atomic_fetch_add_explicit(&room->msgs_out, sent, memory_order_relaxed);
+    payload_unref(payload);
+    payload_unref(wire);
 }
 
 void start_poll(ChatRoom *room, int host_fd, const char *host_name)
@@ -1329,34 +6504,30 @@ void start_poll(ChatRoom *room, int host_fd, const char *host_name)
     room->poll_count = 0;
     room->poll_index = 0;
 
-    // 배열 초기화
+    // 배열 초기화 (항목 문자열은 영역 사용량만 되돌림)
+    room->poll_arena_used = 0;
     for (int i = 0; i < MAX_POLL; i++)
-    {
-        if (room->poll_list[i] != NULL)
-        {
-            free(room->poll_list[i]);
-            room->poll_list[i] = NULL;
-        }
         room->poll_votes[i] = 0;
-    }
 
     for (int i = 0; i < MAX_ROOM_USERS; i++)
     {
         room->vote_received[i] = -1;
     }
+
+    // 호스트가 항목을 입력하지 않거나 일부 사용자가 투표하지 않아도 채팅방이 묶이지 않도록 마감 시각 설정
+    if (poll_timeout > 0)
+    {
+        room->poll_deadline = time(NULL) + poll_timeout;
+        timer_set(&reactors[room->reactor], &room->poll_timer, poll_timeout * 1000L, poll_expire, room->id);
+    }
 }
 
 void reset_poll_state(ChatRoom *room)
 {
-    // 메모리 해제
-    for (int i = 0; i < MAX_POLL; i++)
-    {
-        if (room->poll_list[i] != NULL)
-        {
-            free(room->poll_list[i]);
-            room->poll_list[i] = NULL;
-        }
-    }
+    timer_cancel(&room->poll_timer);
+
+    // 항목 문자열은 채팅방 영역에 있으므로 사용량만 되돌림
+    room->poll_arena_used = 0;
 
     // 기본 상태 초기화
     room->poll_count = 0;
@@ -1375,21 +6546,130 @@ void reset_poll_state(ChatRoom *room)
     }
 }
 
+int tally_poll(ChatRoom *room, char *list, size_t size)
+{
+    for (int i = 0; i < room->user_count; i++)
+    {
+        if (room->vote_received[i] == -1)
+            return 0;
+    }
+
+    format_poll_result(room, list, size);
+    return 1;
+}
+
+void format_poll_result(ChatRoom *room, char *list, size_t size)
+{
+    snprintf(list, size, "====== [POLL_RESULT] ======\n");
+    for (int i = 0; i < room->poll_count; i++)
+    {
+        char line[MEDIUM_BUFF_SIZE];
+        snprintf(line, sizeof(line), "%s : %d 표\n", room->poll_list[i], room->poll_votes[i]);
+        if (strlen(list) + strlen(line) < size)
+        {
+            strcat(list, line);
+        }
+    }
+}
+
+void poll_expire(Reactor *r, Timer *t, unsigned long room_id)
+{
+    ChatRoom *room = (ChatRoom *)((char *)t - offsetof(ChatRoom, poll_timer));
+
+    lock_mutex(&room->lock);
+    // 그사이 투표가 끝났거나 채팅방이 회수되어 다른 채팅방이 되었으면 무시
+    if (!room->active || room->id != room_id || room->mode != POLL_MODE || poll_timeout == 0)
+    {
+        pthread_mutex_unlock(&room->lock);
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now < room->poll_deadline)
+    {
+        timer_set(r, t, (room->poll_deadline - now) * 1000L, poll_expire, room_id);
+        pthread_mutex_unlock(&room->lock);
+        return;
+    }
+
+    if (room->poll_mode_stage == 2)
+    {
+        int voted = 0;
+        for (int i = 0; i < room->user_count; i++)
+        {
+            if (room->vote_received[i] != -1)
+                voted++;
+        }
+
+        // 투표하지 않은 사용자가 있어도 받은 표로 결과를 알림
+        char list[LARGE_BUFF_SIZE];
+        int n = snprintf(list, sizeof(list), "[POLL] 투표 시간이 끝났습니다. (%d/%d명 투표)\n", voted, room->user_count);
+        format_poll_result(room, list + n, sizeof(list) - n);
+        broadcast_to_room(room, list, -1);
+        log_poll(LOG_INFO, room, "시간 초과로 투표 종료 (%d/%d명 투표)", voted, room->user_count);
+    }
+    else
+    {
+        broadcast_to_room(room, "[POLL] 항목 입력 시간이 지나 투표가 취소되었습니다.\n", -1);
+        log_poll(LOG_INFO, room, "항목 입력 시간 초과로 투표 취소");
+    }
+
+    room->mode = CHAT_MODE;
+    reset_poll_state(room);
+    pthread_mutex_unlock(&room->lock);
+}
+
+void game_expire(Reactor *r, Timer *t, unsigned long room_id)
+{
+    ChatRoom *room = (ChatRoom *)((char *)t - offsetof(ChatRoom, game_timer));
+
+    lock_mutex(&room->lock);
+    if (!room->active || room->id != room_id || room->mode != GAME_MODE || game_timeout == 0)
+    {
+        pthread_mutex_unlock(&room->lock);
+        return;
+    }
+
+    // 입력마다 타이머를 옮기지 않고, 만료될 때 마지막 입력 시각을 보고 남은 시간만큼 다시 등록
+    time_t idle = time(NULL) - room->game_active_at;
+    if (idle < game_timeout)
+    {
+        timer_set(r, t, (game_timeout - idle) * 1000L, game_expire, room_id);
+        pthread_mutex_unlock(&room->lock);
+        return;
+    }
+
+    char msg[MEDIUM_LARGE_BUFF_SIZE];
+    if (strlen(room->game_answer) == 3)
+        snprintf(msg, sizeof(msg), "[GAME] %d초 동안 진행이 없어 게임이 종료되었습니다. (정답: %s)\n", game_timeout, room->game_answer);
+    else
+        snprintf(msg, sizeof(msg), "[GAME] 호스트가 정답을 입력하지 않아 게임이 종료되었습니다.\n");
+    broadcast_to_room(room, msg, -1);
+    log_game(LOG_INFO, room, "시간 초과로 게임 종료");
+
+    room->mode = CHAT_MODE;
+    room->game_host_fd = -1;
+    memset(room->game_answer, 0, sizeof(room->game_answer));
+    pthread_mutex_unlock(&room->lock);
+}
 
 void sigint_handler(int signo)
 {
-    printf("\n[NOTICE] 시그널 핸들러 시작");
-    print_time();
+    log_write(LOG_INFO, "[NOTICE] 시그널 핸들러 시작");
 
-    if (server_sock != -1)
-        close(server_sock);
+    for (int i = 0; i < reactor_count && reactors != NULL; i++)
+        close(reactors[i].listen_fd);
 
-    pthread_mutex_lock(&client_lock);
-    for (int i = 0; i < client_count; i++)
-        close(clients[i].fd);
+    lock_mutex(&client_lock);
+    for (int i = 0; i < client_chunk_count * CLIENT_CHUNK; i++)
+    {
+        if (client_at(i)->fd != -1)
+            close(client_at(i)->fd);
+    }
     pthread_mutex_unlock(&client_lock);
 
-    printf("[NOTICE] 서버 종료");
-    print_time();
+    log_write(LOG_INFO, "[NOTICE] 서버 종료");
+    store_shutdown(); // 남은 채팅방 메시지를 디스크에 기록
+    log_shutdown(); // 남은 로그를 모두 기록한 뒤 종료
     exit(0);
 }
\ No newline at end of file